@@ -0,0 +1,41 @@
+#pragma once
+#include <vector>
+
+namespace rayTracer {
+
+    /// Picks an index with a probability proportional to its weight in constant time, however
+    /// many there are (Walker's alias method, built with Vose's algorithm). Every index gets a
+    /// bucket of equal probability holding the index itself and one alias that fills up the rest
+    /// of the bucket, so a pick is one bucket lookup and one comparison.
+    class AliasTable
+    {
+    public:
+        AliasTable() = default;
+
+        /// Builds the table over the weights, which can't be negative. If they are all zero every
+        /// index is as likely.
+        explicit AliasTable(const std::vector<float>& weights);
+
+        /// Picks an index with two uniform numbers in [0, 1), one for the bucket and one for the choice
+        /// within it. A single number would leave the choice only the bits the bucket doesn't take,
+        /// about 4 of a float's 24 with a million buckets.
+        int sample(float bucketU, float choiceU) const;
+
+        /// The probability of picking the index
+        float getProbability(int index) const { return probabilities[index]; }
+
+        int size() const { return int(buckets.size()); }
+        bool empty() const { return buckets.empty(); }
+
+    private:
+        struct Bucket
+        {
+            float threshold; // below it the bucket's own index is picked, above it the alias
+            int alias;
+        };
+
+        std::vector<Bucket> buckets;
+        std::vector<float> probabilities;
+    };
+
+} // namespace rayTracer
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+namespace rayTracer {
+
+    const std::size_t CACHE_LINE_SIZE = 64;
+
+    /// Allocator for standard containers that places the elements at the given alignment,
+    /// which the default allocator doesn't guarantee for over-aligned types before C++17.
+    /// Goes through the global operator new so the allocations are counted like any other.
+    template<typename T, std::size_t Alignment>
+    struct AlignedAllocator
+    {
+        typedef T value_type;
+
+        template<typename U>
+        struct rebind
+        {
+            typedef AlignedAllocator<U, Alignment> other;
+        };
+
+        AlignedAllocator() noexcept { }
+
+        template<typename U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept { }
+
+        T* allocate(std::size_t count)
+        {
+            // Allocate enough to align the start and to keep the original pointer right before it
+            void* memory = ::operator new(count * sizeof(T) + Alignment + sizeof(void*));
+            std::uintptr_t start = reinterpret_cast<std::uintptr_t>(memory) + sizeof(void*);
+            std::uintptr_t aligned = (start + Alignment - 1) & ~std::uintptr_t(Alignment - 1);
+            reinterpret_cast<void**>(aligned)[-1] = memory;
+            return reinterpret_cast<T*>(aligned);
+        }
+
+        void deallocate(T* pointer, std::size_t) noexcept
+        {
+            if (pointer)
+                ::operator delete(reinterpret_cast<void**>(pointer)[-1]);
+        }
+    };
+
+    template<typename T, typename U, std::size_t Alignment>
+    bool operator==(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) { return true; }
+
+    template<typename T, typename U, std::size_t Alignment>
+    bool operator!=(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) { return false; }
+
+    /// A vector whose storage starts at the beginning of a cache line
+    template<typename T>
+    using CacheAlignedVector = std::vector<T, AlignedAllocator<T, CACHE_LINE_SIZE>>;
+
+} // namespace rayTracer
@@ -0,0 +1,14 @@
+#pragma once
+
+namespace rayTracer {
+
+    /// Counts the calls to the global operator new (and new[]) of the whole program, which
+    /// makes it possible to check that a piece of code doesn't touch the heap
+    namespace AllocationCounter {
+
+        /// Number of heap allocations made since the program started
+        long long getNumAllocations();
+
+    } // namespace AllocationCounter
+
+} // namespace rayTracer
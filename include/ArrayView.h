@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+namespace rayTracer {
+
+    /// Read only view of an array owned by something else, a vector or a memory mapped file.
+    /// Lets the compiled geometry be used in place wherever it is stored.
+    template<typename T>
+    class ArrayView
+    {
+    public:
+        ArrayView()
+            : first(nullptr), count(0)
+        { }
+
+        ArrayView(const T* inFirst, std::size_t inCount)
+            : first(inFirst), count(inCount)
+        { }
+
+        template<typename Allocator>
+        ArrayView(const std::vector<T, Allocator>& vector)
+            : first(vector.data()), count(vector.size())
+        { }
+
+        const T& operator[](std::size_t index) const { return first[index]; }
+
+        const T* data() const { return first; }
+        std::size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+
+        const T* begin() const { return first; }
+        const T* end() const { return first + count; }
+
+    private:
+        const T* first;
+        std::size_t count;
+    };
+
+} // namespace rayTracer
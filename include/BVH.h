@@ -0,0 +1,403 @@
+#pragma once
+#include <ArrayView.h>
+#include <BoundingBox.h>
+#include <RayPacket.h>
+#include <glm.hpp>
+#include <vector>
+
+namespace rayTracer {
+
+    /// Bounding volume hierarchy built with the surface area heuristic (SAH). It is
+    /// built over a list of primitive bounding boxes and does not know what the
+    /// primitives are, the caller supplies a function that intersects a primitive
+    /// when traversing. Used over the triangles and over the spheres of a scene.
+    class BVH
+    {
+    public:
+        struct Node
+        {
+            BoundingBox bounds;
+            int firstChildOrPrimitive; // index of left child (right = left + 1) or first primitive of a leaf
+            int primitiveCount;        // 0 for interior nodes
+
+            bool isLeaf() const { return primitiveCount > 0; }
+        };
+
+        /// Counters gathered while traversing, used to measure how good the hierarchy is
+        struct TraversalStatistics
+        {
+            TraversalStatistics()
+                : numRays(0), numNodesVisited(0), numPrimitivesTested(0)
+            { }
+
+            long long numRays;
+            long long numNodesVisited;
+            long long numPrimitivesTested;
+        };
+
+        BVH() = default;
+
+        // The arrays may point into the vectors, which keep their storage when moved but not when copied
+        BVH(const BVH&) = delete;
+        BVH& operator=(const BVH&) = delete;
+        BVH(BVH&&) = default;
+        BVH& operator=(BVH&&) = default;
+
+        /// Builds the hierarchy over the given primitive bounds. The primitive indices
+        /// handed to the intersection function later on are indices into this list.
+        /// With a block size above 1 the primitive order is split into blocks of that size
+        /// and no leaf crosses from one block into the next (the gaps are filled with -1),
+        /// which lets the owner store the primitives of a leaf together in one fixed size
+        /// block, e.g. one SIMD packet. The SAH then counts the cost of a leaf in blocks.
+        void build(const std::vector<BoundingBox>& primitiveBounds, int maxPrimitivesInLeaf = 4,
+                   int blockSize = 1);
+
+        /// Uses nodes and a primitive order built before and stored elsewhere, e.g. in a memory mapped
+        /// scene cache, instead of building the hierarchy. The arrays have to outlive the hierarchy.
+        void useExternalData(ArrayView<Node> inNodes, ArrayView<int> primitiveOrder);
+
+        /// The nodes, root first
+        ArrayView<Node> getNodes() const { return nodes; }
+
+        /// Primitive indices in the order the leaves refer to them
+        ArrayView<int> getPrimitiveOrder() const { return primitiveIndices; }
+
+        bool isEmpty() const { return nodes.empty(); }
+
+        /// Bytes used by the nodes and the primitive order
+        std::size_t getMemoryUsage() const
+        {
+            return nodes.size() * sizeof(Node) + primitiveIndices.size() * sizeof(int);
+        }
+
+        /// Bounds of everything in the hierarchy
+        BoundingBox getBounds() const { return nodes.empty() ? BoundingBox() : nodes[0].bounds; }
+
+        /// Traverses the hierarchy front to back and calls intersectPrimitive(primitiveIndex, tMax)
+        /// for the primitives in the leaves the ray passes through. The function should return
+        /// true on a hit and lower tMax to the distance of the closest hit found so far, which
+        /// lets the traversal skip every node that lies further away than that.
+        template<typename IntersectPrimitive>
+        bool intersect(glm::vec3 origin, glm::vec3 direction, float tMax,
+                       IntersectPrimitive&& intersectPrimitive, TraversalStatistics& statistics) const;
+
+        /// Same traversal but the function is called once per leaf as
+        /// intersectLeaf(firstPrimitive, primitiveCount, tMax), where firstPrimitive is
+        /// the position of the leaf's first primitive in getPrimitiveOrder().
+        template<typename IntersectLeaf>
+        bool intersectLeaves(glm::vec3 origin, glm::vec3 direction, float tMax,
+                             IntersectLeaf&& intersectLeaf, TraversalStatistics& statistics) const;
+
+        template<typename IntersectLeaf>
+        bool intersectLeaves(glm::vec3 origin, glm::vec3 direction, float tMax,
+                             IntersectLeaf&& intersectLeaf) const
+        {
+            TraversalStatistics unusedStatistics;
+            return intersectLeaves(origin, direction, tMax, intersectLeaf, unusedStatistics);
+        }
+
+        /// Same as above for when the statistics are of no interest
+        template<typename IntersectPrimitive>
+        bool intersect(glm::vec3 origin, glm::vec3 direction, float tMax,
+                       IntersectPrimitive&& intersectPrimitive) const
+        {
+            TraversalStatistics unusedStatistics;
+            return intersect(origin, direction, tMax, intersectPrimitive, unusedStatistics);
+        }
+
+        /// Any hit traversal for visibility queries. Calls occludedPrimitive(primitiveIndex) for the
+        /// primitives in the leaves the ray passes through and returns true as soon as one of them
+        /// does, i.e. when something blocks the ray before tMax. No closest hit is searched for.
+        template<typename OccludedPrimitive>
+        bool occluded(glm::vec3 origin, glm::vec3 direction, float tMax,
+                      OccludedPrimitive&& occludedPrimitive, TraversalStatistics& statistics) const;
+
+        /// Same as occluded() but called once per leaf as occludedLeaf(firstPrimitive, primitiveCount)
+        template<typename OccludedLeaf>
+        bool occludedLeaves(glm::vec3 origin, glm::vec3 direction, float tMax,
+                            OccludedLeaf&& occludedLeaf, TraversalStatistics& statistics) const;
+
+        template<typename OccludedLeaf>
+        bool occludedLeaves(glm::vec3 origin, glm::vec3 direction, float tMax,
+                            OccludedLeaf&& occludedLeaf) const
+        {
+            TraversalStatistics unusedStatistics;
+            return occludedLeaves(origin, direction, tMax, occludedLeaf, unusedStatistics);
+        }
+
+        /// Traverses the hierarchy with all the rays of the packet at once. Nodes are culled for
+        /// the whole packet when possible, and otherwise skipped for the leading rays that miss
+        /// them. intersectPrimitive(rayIndex, primitiveIndex, tMax) is called like in intersect()
+        /// with tMax being the packet's tMax for that ray.
+        template<typename IntersectPrimitive>
+        void intersectPacket(RayPacket& packet, IntersectPrimitive&& intersectPrimitive,
+                             TraversalStatistics& statistics) const;
+
+        /// Same as intersectPacket() but called once per leaf and ray as
+        /// intersectLeaf(rayIndex, firstPrimitive, primitiveCount, tMax)
+        template<typename IntersectLeaf>
+        void intersectPacketLeaves(RayPacket& packet, IntersectLeaf&& intersectLeaf,
+                                   TraversalStatistics& statistics) const;
+
+    private:
+        static const int MAX_DEPTH = 64;
+        static const int STACK_SIZE = 128;
+
+        void buildRecursive(int nodeIndex, int begin, int end, int depth,
+                            const std::vector<BoundingBox>& primitiveBounds,
+                            const std::vector<glm::vec3>& centroids);
+
+        void makeLeaf(int nodeIndex, int begin, int end);
+
+        /// Moves the leaves apart so that none of them crosses a block boundary
+        void packLeavesIntoBlocks();
+
+        /// Number of blocks needed for the given number of primitives
+        int blocksNeeded(int primitiveCount) const { return (primitiveCount + blockSize - 1) / blockSize; }
+
+        std::vector<Node> nodeStorage;
+        std::vector<int> primitiveIndexStorage;
+
+        // What traversal uses, either the storage above or external data
+        ArrayView<Node> nodes;
+        ArrayView<int> primitiveIndices; // primitives ordered so that every leaf is a contiguous range
+        int maxLeafSize = 4;
+        int blockSize = 1;
+    };
+
+    ///----------------------------------------------
+
+    template<typename IntersectPrimitive>
+    bool BVH::intersect(glm::vec3 origin, glm::vec3 direction, float tMax,
+                        IntersectPrimitive&& intersectPrimitive, TraversalStatistics& statistics) const
+    {
+        return intersectLeaves(origin, direction, tMax, [&](int firstPrimitive, int primitiveCount, float& tMax) {
+            bool hit = false;
+            for (int i = firstPrimitive; i < firstPrimitive + primitiveCount; ++i)
+            {
+                if (intersectPrimitive(primitiveIndices[i], tMax))
+                    hit = true;
+            }
+            return hit;
+        }, statistics);
+    }
+
+    ///----------------------------------------------
+
+    template<typename IntersectLeaf>
+    bool BVH::intersectLeaves(glm::vec3 origin, glm::vec3 direction, float tMax,
+                              IntersectLeaf&& intersectLeaf, TraversalStatistics& statistics) const
+    {
+        if (nodes.empty())
+            return false;
+
+        glm::vec3 invDirection = 1.0f / direction;
+
+        struct StackEntry
+        {
+            int nodeIndex;
+            float tNear;
+        };
+        StackEntry stack[STACK_SIZE];
+        int stackSize = 0;
+
+        float tNear;
+        ++statistics.numNodesVisited;
+        if (!nodes[0].bounds.intersect(origin, invDirection, tMax, tNear))
+            return false;
+        stack[stackSize++] = { 0, tNear };
+
+        bool hit = false;
+        while (stackSize > 0)
+        {
+            StackEntry entry = stack[--stackSize];
+
+            // Early termination, a closer hit has been found since the node was pushed
+            if (entry.tNear > tMax)
+                continue;
+
+            const Node& node = nodes[entry.nodeIndex];
+            if (node.isLeaf())
+            {
+                statistics.numPrimitivesTested += node.primitiveCount;
+                if (intersectLeaf(node.firstChildOrPrimitive, node.primitiveCount, tMax))
+                    hit = true;
+                continue;
+            }
+
+            int leftIndex = node.firstChildOrPrimitive;
+            int rightIndex = leftIndex + 1;
+            float tLeft, tRight;
+            statistics.numNodesVisited += 2;
+            bool hitsLeft = nodes[leftIndex].bounds.intersect(origin, invDirection, tMax, tLeft);
+            bool hitsRight = nodes[rightIndex].bounds.intersect(origin, invDirection, tMax, tRight);
+
+            // Push the far child first so that the near one is visited first
+            if (hitsLeft && hitsRight)
+            {
+                if (tLeft < tRight)
+                {
+                    stack[stackSize++] = { rightIndex, tRight };
+                    stack[stackSize++] = { leftIndex, tLeft };
+                }
+                else
+                {
+                    stack[stackSize++] = { leftIndex, tLeft };
+                    stack[stackSize++] = { rightIndex, tRight };
+                }
+            }
+            else if (hitsLeft)
+                stack[stackSize++] = { leftIndex, tLeft };
+            else if (hitsRight)
+                stack[stackSize++] = { rightIndex, tRight };
+        }
+
+        return hit;
+    }
+
+    ///----------------------------------------------
+
+    template<typename OccludedPrimitive>
+    bool BVH::occluded(glm::vec3 origin, glm::vec3 direction, float tMax,
+                       OccludedPrimitive&& occludedPrimitive, TraversalStatistics& statistics) const
+    {
+        return occludedLeaves(origin, direction, tMax, [&](int firstPrimitive, int primitiveCount) {
+            for (int i = firstPrimitive; i < firstPrimitive + primitiveCount; ++i)
+            {
+                if (occludedPrimitive(primitiveIndices[i]))
+                    return true;
+            }
+            return false;
+        }, statistics);
+    }
+
+    ///----------------------------------------------
+
+    template<typename OccludedLeaf>
+    bool BVH::occludedLeaves(glm::vec3 origin, glm::vec3 direction, float tMax,
+                             OccludedLeaf&& occludedLeaf, TraversalStatistics& statistics) const
+    {
+        if (nodes.empty())
+            return false;
+
+        glm::vec3 invDirection = 1.0f / direction;
+
+        // The order nodes are visited in does not matter, any blocker will do
+        int stack[STACK_SIZE];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+
+        float tNear;
+        while (stackSize > 0)
+        {
+            const Node& node = nodes[stack[--stackSize]];
+            ++statistics.numNodesVisited;
+            if (!node.bounds.intersect(origin, invDirection, tMax, tNear))
+                continue;
+
+            if (node.isLeaf())
+            {
+                statistics.numPrimitivesTested += node.primitiveCount;
+                if (occludedLeaf(node.firstChildOrPrimitive, node.primitiveCount))
+                    return true;
+                continue;
+            }
+
+            stack[stackSize++] = node.firstChildOrPrimitive + 1;
+            stack[stackSize++] = node.firstChildOrPrimitive;
+        }
+
+        return false;
+    }
+
+    ///----------------------------------------------
+
+    template<typename IntersectPrimitive>
+    void BVH::intersectPacket(RayPacket& packet, IntersectPrimitive&& intersectPrimitive,
+                              TraversalStatistics& statistics) const
+    {
+        intersectPacketLeaves(packet, [&](int ray, int firstPrimitive, int primitiveCount, float& tMax) {
+            for (int i = firstPrimitive; i < firstPrimitive + primitiveCount; ++i)
+                intersectPrimitive(ray, primitiveIndices[i], tMax);
+        }, statistics);
+    }
+
+    ///----------------------------------------------
+
+    template<typename IntersectLeaf>
+    void BVH::intersectPacketLeaves(RayPacket& packet, IntersectLeaf&& intersectLeaf,
+                                    TraversalStatistics& statistics) const
+    {
+        if (nodes.empty() || packet.size == 0)
+            return;
+
+        // Rays before the first active ray are known to miss the node (they missed an ancestor)
+        struct StackEntry
+        {
+            int nodeIndex;
+            int firstActiveRay;
+        };
+        StackEntry stack[STACK_SIZE];
+        int stackSize = 0;
+        stack[stackSize++] = { 0, 0 };
+
+        while (stackSize > 0)
+        {
+            StackEntry entry = stack[--stackSize];
+            const Node& node = nodes[entry.nodeIndex];
+            ++statistics.numNodesVisited;
+
+            if (packet.missesBox(node.bounds))
+                continue;
+
+            // Find the first ray that actually hits the node
+            int firstActiveRay = entry.firstActiveRay;
+            float tNear;
+            while (firstActiveRay < packet.size &&
+                   !node.bounds.intersect(packet.origins[firstActiveRay], packet.invDirections[firstActiveRay],
+                                          packet.tMax[firstActiveRay], tNear))
+                ++firstActiveRay;
+
+            if (firstActiveRay == packet.size)
+                continue;
+
+            if (node.isLeaf())
+            {
+                for (int ray = firstActiveRay; ray < packet.size; ++ray)
+                {
+                    if (ray != firstActiveRay &&
+                        !node.bounds.intersect(packet.origins[ray], packet.invDirections[ray], packet.tMax[ray], tNear))
+                        continue;
+
+                    statistics.numPrimitivesTested += node.primitiveCount;
+                    intersectLeaf(ray, node.firstChildOrPrimitive, node.primitiveCount, packet.tMax[ray]);
+                }
+                packet.updateLargestTMax();
+                continue;
+            }
+
+            // Visit the child that is closest along the first active ray first
+            int leftIndex = node.firstChildOrPrimitive;
+            int rightIndex = leftIndex + 1;
+            float tLeft, tRight;
+            if (!nodes[leftIndex].bounds.intersect(packet.origins[firstActiveRay], packet.invDirections[firstActiveRay],
+                                                   packet.tMax[firstActiveRay], tLeft))
+                tLeft = std::numeric_limits<float>::max();
+            if (!nodes[rightIndex].bounds.intersect(packet.origins[firstActiveRay], packet.invDirections[firstActiveRay],
+                                                    packet.tMax[firstActiveRay], tRight))
+                tRight = std::numeric_limits<float>::max();
+
+            if (tLeft < tRight)
+            {
+                stack[stackSize++] = { rightIndex, firstActiveRay };
+                stack[stackSize++] = { leftIndex, firstActiveRay };
+            }
+            else
+            {
+                stack[stackSize++] = { leftIndex, firstActiveRay };
+                stack[stackSize++] = { rightIndex, firstActiveRay };
+            }
+        }
+    }
+
+} // namespace rayTracer
@@ -0,0 +1,80 @@
+#pragma once
+#include <glm.hpp>
+#include <limits>
+
+namespace rayTracer {
+
+    /// Axis aligned bounding box. A default constructed box is empty (min > max)
+    /// so that expanding it with the first point/box gives that point/box.
+    struct BoundingBox
+    {
+        BoundingBox()
+            : min(glm::vec3(std::numeric_limits<float>::max()))
+            , max(glm::vec3(-std::numeric_limits<float>::max()))
+        { }
+
+        BoundingBox(glm::vec3 inMin, glm::vec3 inMax)
+            : min(inMin), max(inMax)
+        { }
+
+        void expand(glm::vec3 point)
+        {
+            min = glm::min(min, point);
+            max = glm::max(max, point);
+        }
+
+        void expand(const BoundingBox& box)
+        {
+            min = glm::min(min, box.min);
+            max = glm::max(max, box.max);
+        }
+
+        /// Grows the box by the given amount in every direction. Used to give flat
+        /// objects (e.g. axis aligned planes) some thickness.
+        void pad(float amount)
+        {
+            min -= glm::vec3(amount);
+            max += glm::vec3(amount);
+        }
+
+        bool isEmpty() const
+        {
+            return min.x > max.x || min.y > max.y || min.z > max.z;
+        }
+
+        glm::vec3 centroid() const { return 0.5f * (min + max); }
+
+        glm::vec3 extent() const { return max - min; }
+
+        float surfaceArea() const
+        {
+            if (isEmpty())
+                return 0.0f;
+
+            glm::vec3 e = extent();
+            return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+        }
+
+        /// Slab test against the ray origin + t * direction, where the inverse of the
+        /// direction is given. Returns true if the ray overlaps the box somewhere in
+        /// [0, tMax], in which case tNear is set to the distance where it enters the box.
+        bool intersect(glm::vec3 origin, glm::vec3 invDirection, float tMax, float& tNear) const
+        {
+            glm::vec3 t0 = (min - origin) * invDirection;
+            glm::vec3 t1 = (max - origin) * invDirection;
+            glm::vec3 tSmall = glm::min(t0, t1);
+            glm::vec3 tBig = glm::max(t0, t1);
+
+            float tEnter = glm::max(glm::max(tSmall.x, tSmall.y), glm::max(tSmall.z, 0.0f));
+            // Scale the exit distance up a tiny bit so rounding errors never make us miss a hit
+            float tExit = glm::min(glm::min(tBig.x, tBig.y), glm::min(tBig.z, tMax)) * 1.0000004f;
+
+            tNear = tEnter;
+            return tEnter <= tExit;
+        }
+
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+
+} // namespace rayTracer
@@ -1,12 +1,15 @@
 #pragma once
+#include <ImageWriter.h>
+#include <Ray.h>
+#include <cstdint>
 #include <fstream>
 #include <glm.hpp>
 #include <memory>
+#include <string>
 #include <vector>
 
 namespace rayTracer {
 
-class Ray;
 class Scene;
 
 class Camera {
@@ -14,9 +17,15 @@ public:
     enum class ImageResolution {
         RESOLUTION_480p,
         RESOLUTION_720p,
-        RESOLUTION_1080p
+        RESOLUTION_1080p,
+        RESOLUTION_4K,
+        RESOLUTION_8K,
+        RESOLUTION_16K
     };
 
+    /// Largest width and height of an image
+    static const int MAX_RESOLUTION = 16384;
+
     explicit Camera(glm::vec3 eye,
                     glm::vec3 center,
                     glm::vec3 up,
@@ -24,29 +33,97 @@ public:
                     ImageResolution imageResolution,
                     std::string name);
 
+    /// Any width and height, each clamped to [1, MAX_RESOLUTION]
+    explicit Camera(glm::vec3 eye,
+                    glm::vec3 center,
+                    glm::vec3 up,
+                    float fov,
+                    int frameWidth,
+                    int frameHeight,
+                    std::string name);
+
+    /// Only renders the pixels [firstRow, lastRow) x [firstColumn, lastColumn) of the frame, counting rows
+    /// from the top. The image then is the crop window, and pixel [x, y] below is pixel [x, y] of the window.
+    /// Clears the pixel buffers.
+    void setCropWindow(int firstRow, int firstColumn, int lastRow, int lastColumn);
+
     /// Creates a ray shooting out from pixel x and y. Possible to add some randomness [-0.5, 0.5] to it
-    std::shared_ptr<Ray> createCameraRay(int pixelX, int pixelY, float randomnessX, float randomnessY);
+    Ray createCameraRay(int pixelX, int pixelY, float randomnessX, float randomnessY);
+
+    /// Index of pixel [x, y] of the image within the whole frame. The random numbers of its samples
+    /// are keyed on it, so that a crop window renders the same pixels as the whole frame.
+    std::uint32_t getFramePixelIndex(int x, int y) const;
 
     // Sets the pixel value at pixel [x, y] to the given value.
     void setPixelValue(int x, int y, glm::vec3 pixelValue);
 
-    /// Generates a .ppm image using the pixel values stored in 'pixels'
-    void generateImage();
+    /// Number of samples taken for pixel [x, y]
+    void setPixelSampleCount(int x, int y, int sampleCount);
+    int getPixelSampleCount(int x, int y) const;
 
-    /// Get functions for pixel height, pixel width and name
+    /// Sets all pixel values and sample counts to zero. The buffers, one contiguous allocation each, are
+    /// only allocated by this or by the progressive rendering functions, so that images streamed to the
+    /// output file never need memory for the whole frame.
+    void clearPixels();
+
+    /// Writes the pixel values stored in 'pixels' to an image, in the format of the extension of the path
+    bool generateImage(const std::string& path, const ImageWriter::DisplaySettings& displaySettings) const;
+
+    /// Progressive rendering: every pass sets all pixel values and accumulatePass() adds them to the
+    /// accumulation buffer, replacing them by the average of all passes so far
+    void clearAccumulation();
+    void accumulatePass();
+    int getNumAccumulatedPasses() const;
+
+    /// Checkpoints of progressive renders hold the accumulation buffers and the number of passes,
+    /// which is also the sample index the next pass continues from. The seed is stored to make sure
+    /// a render is only resumed with the same random numbers. Loading returns false if there is no
+    /// usable checkpoint at the path. The checkpoint of an image is stored next to it.
+    static std::string getCheckpointPath(const std::string& imagePath);
+    void serializeAccumulation(unsigned int randomSeed, std::vector<char>& data) const;
+    bool loadAccumulation(const std::string& path, unsigned int randomSeed);
+
+    /// Estimates the relative RMS error of the accumulated image from how much the average of the
+    /// even passes differs from the average of the odd ones. Infinite before the second pass.
+    float estimateRelativeError() const;
+
+    /// Renders split over several processes: every shard writes the pixel values and sample counts
+    /// it rendered to a partial result and the merge sets every pixel to the average over all
+    /// shards, weighted by their sample counts. Returns false if a file can't be used.
+    static std::string getPartialResultPath(const std::string& imagePath, int shardIndex, int numShards);
+    bool writePartialResult(const std::string& path) const;
+    bool mergePartialResults(const std::vector<std::string>& paths);
+
+    /// Writes a heatmap of the sample counts next to the image, from black for none through red
+    /// and yellow to white for the largest count
+    static std::string getSampleCountImagePath(const std::string& imagePath);
+    bool generateSampleCountImage(const std::string& path) const;
+
+    /// Get functions for pixel height, pixel width and name. The pixel height and width are those of
+    /// the image, which is the crop window if there is one.
     int getPixelHeight() const;
     int getPixelWidth() const;
     std::string getName() const;
 
 private:
+    /// Allocates the pixel buffers if they aren't yet
+    void allocatePixels();
+
     std::string name;
 
     glm::vec3 eye, center, up;
     float fov;
+    int frameHeight, frameWidth;
+    int cropFirstRow, cropFirstColumn;
     int pixelHeight, pixelWidth;
     glm::mat4 VP_inv;
 
-    std::vector<std::vector<glm::vec3>> pixels;
+    std::vector<glm::vec3> pixels; // row by row
+    std::vector<int> sampleCounts;
+
+    std::vector<glm::vec3> accumulatedPixels; // sum of all passes, row by row
+    std::vector<glm::vec3> evenPassPixels; // sum of the even passes only
+    int numAccumulatedPasses;
 };
 
 } // namespace rayTracer
\ No newline at end of file
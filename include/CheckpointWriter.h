@@ -0,0 +1,41 @@
+#pragma once
+#include <WorkerThread.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace rayTracer {
+
+    /// Writes checkpoint files on a background thread so the render doesn't wait for the disk.
+    /// The data goes to a temporary file that replaces the checkpoint once it is complete, so a
+    /// process killed in the middle of a write still leaves the previous checkpoint intact.
+    class CheckpointWriter
+    {
+    public:
+        /// Writes on the given thread, which has to be started before the first write
+        explicit CheckpointWriter(WorkerThread& thread);
+        CheckpointWriter(const CheckpointWriter&) = delete;
+        CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+        /// Waits for the last write to finish
+        ~CheckpointWriter();
+
+        /// Sets the path of the checkpoints and makes room for data of the given size, so that the
+        /// writes of a render don't allocate
+        void prepare(const std::string& checkpointPath, std::size_t dataSize);
+
+        /// Starts writing the data to the checkpoint. The data is swapped with the buffer of the previous
+        /// write, which is waited for first, so the two buffers are reused from one checkpoint to the next.
+        void write(std::vector<char>& data);
+
+        /// Waits for the write in progress, if any
+        void wait();
+
+    private:
+        WorkerThread& writerThread;
+        std::vector<char> buffer; // what the writer thread is writing
+        std::string path;
+        std::string temporaryPath;
+    };
+
+} // namespace rayTracer
@@ -0,0 +1,169 @@
+#pragma once
+#include <AlignedAllocator.h>
+#include <ArrayView.h>
+#include <BVH.h>
+#include <RayPacket.h>
+#include <TrianglePacket.h>
+#include <glm.hpp>
+#include <vector>
+
+namespace rayTracer {
+
+    class Ray;
+
+    /// All the geometry of a scene compiled into flat, cache line aligned arrays: one buffer
+    /// with every triangle and one with every sphere, each with its own BVH and stored in the
+    /// order of the BVH leaves. Every primitive knows the object and material it belongs to, so
+    /// a hit can be shaded without going back to the scene objects.
+    ///
+    /// Repeated geometry is added as instances of other stores, the meshes, which hold their
+    /// triangles in object space. The instances get a BVH of their own over their bounds in the
+    /// scene, the top level of a two level hierarchy. Rays are moved into object space when they
+    /// enter an instance and traverse the mesh's BVH there.
+    class GeometryStore
+    {
+    public:
+        /// What is needed to shade a triangle hit, stored alongside the triangle packets
+        struct TriangleInfo
+        {
+            glm::vec3 normal;
+            int objectIndex;
+            int materialIndex;
+        };
+
+        struct alignas(32) SphereRecord
+        {
+            glm::vec3 center;
+            float radius;
+            int objectIndex;
+            int materialIndex;
+            int padding[2]; // always zero, the scene cache stores the record byte for byte
+        };
+
+        /// A placed copy of a mesh. The material replaces the materials of the mesh's triangles.
+        struct alignas(64) InstanceRecord
+        {
+            glm::mat4x3 worldToObject;
+            int meshIndex; // into the meshes of the store
+            int objectIndex;
+            int materialIndex;
+            int padding; // always zero, the scene cache stores the record byte for byte
+        };
+
+        /// Everything build() produces, what a scene cache stores
+        struct CompiledData
+        {
+            int numTriangles;
+            ArrayView<BVH::Node> triangleNodes;
+            ArrayView<int> triangleOrder;
+            ArrayView<TrianglePacket> trianglePackets;
+            ArrayView<TriangleInfo> triangleInfos;
+            ArrayView<BVH::Node> sphereNodes;
+            ArrayView<int> sphereOrder;
+            ArrayView<SphereRecord> spheres;
+            ArrayView<BVH::Node> instanceNodes;
+            ArrayView<int> instanceOrder;
+            ArrayView<InstanceRecord> instances;
+            ArrayView<const GeometryStore*> meshes;
+        };
+
+        GeometryStore() = default;
+        GeometryStore(const GeometryStore&) = delete;
+        GeometryStore& operator=(const GeometryStore&) = delete;
+
+        /// Removes all geometry
+        void clear();
+
+        /// Adds primitives, they become visible to the queries after build()
+        void addTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, glm::vec3 normal, int objectIndex, int materialIndex);
+        void addSphere(glm::vec3 center, float radius, int objectIndex, int materialIndex);
+
+        /// Adds an instance of the triangles of a built mesh, placed by the transform. The mesh is
+        /// shared by all its instances and has to outlive the store.
+        void addInstance(const GeometryStore& mesh, const glm::mat4x4& objectToWorld, int objectIndex,
+                         int materialIndex);
+
+        /// Builds the hierarchies and lays the primitives out in leaf order
+        void build();
+
+        /// The arrays of the built geometry
+        CompiledData getCompiledData() const;
+
+        /// Uses geometry built before and stored elsewhere, e.g. in a memory mapped scene cache, in
+        /// place of the added primitives. Only the list of meshes is copied, the other arrays and
+        /// the meshes have to outlive the store.
+        void useCompiledData(const CompiledData& data);
+
+        /// Finds the closest hit along the ray that is closer than the ray's current intersection
+        /// and stores it in the ray. Without the BVH every primitive is tested.
+        bool intersect(Ray& ray, bool useAccelerationStructure, BVH::TraversalStatistics& statistics) const;
+
+        /// Returns true if any primitive blocks the ray origin + t * direction for a t below tMax
+        bool occluded(glm::vec3 origin, glm::vec3 direction, float tMax, bool useAccelerationStructure,
+                      BVH::TraversalStatistics& statistics) const;
+
+        /// Finds the closest hit of every ray in the packet, 'rays' should match the packet
+        void intersectPacket(RayPacket& packet, Ray* rays, bool useAccelerationStructure,
+                             BVH::TraversalStatistics& statistics) const;
+
+        int getNumTriangles() const { return numTriangles; }
+        int getNumSpheres() const { return int(spheres.size()); }
+        int getNumInstances() const { return int(instances.size()); }
+        int getNumMeshes() const { return int(meshes.size()); }
+
+        /// Bounds of the built triangles and spheres, not counting the instances
+        BoundingBox getBounds() const;
+
+        /// Bytes used for the triangles, including their BVH
+        std::size_t getTriangleMemoryUsage() const;
+
+        /// Bytes used for the spheres, including their BVH
+        std::size_t getSphereMemoryUsage() const;
+
+        /// Bytes used for the instances, including their BVH but not the meshes
+        std::size_t getInstanceMemoryUsage() const;
+
+    private:
+        /// Closest hit with the triangles of the store in the space the ray is given in. Lowers tMax
+        /// to the distance and sets the triangle to its position in the packets on a hit.
+        bool intersectTriangles(glm::vec3 origin, glm::vec3 direction, float& tMax, int& closestTriangle,
+                                bool useAccelerationStructure, BVH::TraversalStatistics& statistics) const;
+
+        bool occludedByTriangles(glm::vec3 origin, glm::vec3 direction, float tMax, bool useAccelerationStructure,
+                                 BVH::TraversalStatistics& statistics) const;
+
+        /// Closest hit with the meshes of the instances from first to first + count. Sets the instance
+        /// and the triangle within its mesh on a hit.
+        bool intersectInstances(int firstInstance, int instanceCount, glm::vec3 origin, glm::vec3 direction,
+                                float& tMax, int& closestInstance, int& closestTriangle,
+                                bool useAccelerationStructure, BVH::TraversalStatistics& statistics) const;
+
+        /// The shading normal of a triangle of an instance's mesh in world space
+        glm::vec3 getInstanceNormal(int instance, int triangle) const;
+
+        /// Triangles as they are added, packed into the packets by build()
+        std::vector<glm::vec3> stagedTriangleVertices;
+        std::vector<TriangleInfo> stagedTriangleInfos;
+        std::vector<glm::mat4x4> stagedInstanceTransforms; // object to world, for the bounds
+
+        int numTriangles = 0;
+        BVH triangleBVH;
+        CacheAlignedVector<TrianglePacket> trianglePacketStorage;
+        CacheAlignedVector<TriangleInfo> triangleInfoStorage;
+
+        BVH sphereBVH;
+        CacheAlignedVector<SphereRecord> sphereStorage;
+
+        BVH instanceBVH;
+        CacheAlignedVector<InstanceRecord> instanceStorage;
+        std::vector<const GeometryStore*> meshStorage;
+
+        // What the queries use, either the storage above or compiled data stored elsewhere
+        ArrayView<TrianglePacket> trianglePackets;
+        ArrayView<TriangleInfo> triangleInfos; // one per packet lane
+        ArrayView<SphereRecord> spheres;
+        ArrayView<InstanceRecord> instances;
+        ArrayView<const GeometryStore*> meshes;
+    };
+
+} // namespace rayTracer
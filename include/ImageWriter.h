@@ -0,0 +1,112 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <glm.hpp>
+#include <string>
+#include <vector>
+
+namespace rayTracer {
+
+    /// Encodes images and writes them to disk, either a whole image in memory with a single write or
+    /// streamed a few rows at a time, so that only those rows have to be in memory. The format
+    /// follows the extension of the path: .ppm and .png hold 8 bit values, .pfm 32 bit floats and
+    /// .exr 16 bit half floats. The float formats keep the linear pixel values as they are, for
+    /// the 8 bit ones they go through the exposure, tone mapping and sRGB curve first.
+    class ImageWriter
+    {
+    public:
+        enum class Format {
+            PPM,
+            PNG,
+            PFM,
+            EXR
+        };
+
+        enum class ToneMapping {
+            CLAMP, // values above 1 are cut off
+            REINHARD // x / (1 + x), compresses the highlights instead
+        };
+
+        /// How linear pixel values are turned into 8 bit values
+        struct DisplaySettings
+        {
+            float exposure; // multiplies the values before the tone mapping
+            ToneMapping toneMapping;
+            bool useSRGBCurve; // false stores the tone mapped values linearly
+
+            DisplaySettings()
+                : exposure(1.0f)
+                , toneMapping(ToneMapping::CLAMP)
+                , useSRGBCurve(true)
+            { }
+        };
+
+        ImageWriter();
+        ImageWriter(const ImageWriter&) = delete;
+        ImageWriter& operator=(const ImageWriter&) = delete;
+
+        /// Writes the image to the path in the format of its extension. The rows are pointers to
+        /// the pixels of every row, top row first. Returns false if the extension isn't known or
+        /// the file can't be written.
+        static bool writeImage(const std::string& path, const glm::vec3* const* rows, int width, int height,
+                               const DisplaySettings& displaySettings);
+
+        /// Streaming: open the file, write all rows from the top down in any number of calls and close
+        /// it. The header is written by open() and the end of the file by close(). Every call returns
+        /// false if the file can't be written, and close() also if rows are missing. Room for writing
+        /// maxRowsPerWrite rows is made by open(), so writing no more at a time doesn't allocate.
+        bool open(const std::string& path, int width, int height, const DisplaySettings& displaySettings,
+                  int maxRowsPerWrite = 1);
+        bool writeRows(const glm::vec3* const* rows, int numRows);
+        bool close();
+
+        /// Returns false if the extension of the path isn't one of the formats
+        static bool getFormat(const std::string& path, Format& format);
+
+        /// The path with its extension, if any, replaced by the given one, e.g. ".checkpoint"
+        static std::string replaceExtension(const std::string& path, const std::string& extension);
+
+        /// Converts numValues linear floats to 8 bit display values
+        static void convertToBytes(const float* values, int numValues, const DisplaySettings& displaySettings,
+                                   std::uint8_t* bytes);
+
+        /// Converts numValues floats to IEEE half floats, rounding to nearest even
+        static void convertToHalfs(const float* values, int numValues, std::uint16_t* halfs);
+
+    private:
+        /// Sets up the encoding of an image, false if the format of the path isn't known
+        bool start(const std::string& path, int width, int height, const DisplaySettings& displaySettings);
+
+        /// Append the encoded header, the next rows and the end of the file to the data
+        void encodeHeader(std::vector<char>& data);
+        void encodeRows(const glm::vec3* const* rows, int numRows, std::vector<char>& data);
+        void encodeTrailer(std::vector<char>& data);
+
+        /// Adds bytes of PNG scan lines to the stored deflate blocks of its zlib stream
+        void appendScanlineBytes(const char* bytes, std::size_t size, std::vector<char>& data);
+
+        /// Where the PFM rows the file holds from the bottom up go
+        std::uint64_t getPFMRowsOffset(int firstRow, int numRows) const;
+
+        Format format;
+        int width, height;
+        DisplaySettings displaySettings;
+        int numRowsEncoded;
+        std::size_t headerSize;
+
+        // PNG state carried from one call to the next
+        std::uint32_t crc; // of the IDAT chunk so far
+        std::uint32_t adlerA, adlerB; // Adler-32 sums of the scan lines so far
+        std::size_t numScanlineBytesLeft; // not added to the stream yet
+        std::size_t numBlockBytesLeft; // still fitting in the current stored block
+
+        // Streaming
+        std::string path;
+        std::ofstream file;
+        std::vector<char> buffer; // reused for the encoded rows of every call
+        std::vector<float> rowValues; // one row or channel converted at a time
+        std::vector<std::uint8_t> rowBytes;
+        std::vector<std::uint16_t> rowHalfs;
+    };
+
+} // namespace rayTracer
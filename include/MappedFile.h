@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+namespace rayTracer {
+
+    /// A whole file mapped read only into memory. The pages are only read from disk when they
+    /// are first touched, so threads working on different parts of a file read it in parallel
+    /// without any copies.
+    class MappedFile
+    {
+    public:
+        MappedFile();
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        ~MappedFile();
+
+        /// Maps the file, unmapping any file mapped before. Returns false if it can't be mapped.
+        bool open(const std::string& path);
+
+        void close();
+
+        /// The contents of the file, not null terminated. Null for an empty file.
+        const char* getData() const { return data; }
+        std::size_t getSize() const { return size; }
+
+    private:
+        const char* data;
+        std::size_t size;
+#ifdef _WIN32
+        void* fileHandle;
+        void* mappingHandle;
+#endif
+    };
+
+} // namespace rayTracer
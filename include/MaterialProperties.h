@@ -1,74 +1,78 @@
 #pragma once
-#include <memory>
 #include <glm.hpp>
 
 namespace rayTracer {
 
-    /// Abstract material class, subclasses should be different BRDF models
-    class MaterialProperties
-    {
-    public:
-        /// The brdf takes an incoming light direction, wIn and outgoing direction, wOut,
-        /// and returns the ratio of reflected radiance exiting along wOut to the irradiance
-        /// incident on the surface from direction wIn. wIn and wOut is represented in
-        /// hemispherical coordinates
-        virtual glm::vec3 getBRDF( const float wInAzimuth, const float wInInclination,
-                const float wOutAzimuth, const float wOutInclination) const = 0;
-
-    protected:
-
-        MaterialProperties();
-
-        explicit MaterialProperties(glm::vec3 reflectionCoefficients);
+    class RandomSampler;
 
-        glm::vec3 rho; // constant reflection coefficient
-        glm::vec3 rhoOverPi;
+    /// The different BRDF models, used to pick the evaluation in MaterialProperties::getBRDF.
+    /// A new material needs a value here, a create function and a case in getBRDF, getBRDFs, sample,
+    /// getPDF and getPDFs. These switch on the type without a default, so -Wswitch points out a missing case.
+    enum class MaterialType : unsigned char
+    {
+        Lambertian,
+        OrenNayar,
+        PerfectMirror,
+        Emissive
     };
 
-    using MaterialPtr = std::shared_ptr<MaterialProperties>;
-
-    class LambertianMaterial : public MaterialProperties
+    /// How the integrators should treat a material, combined as a bit set
+    enum MaterialFlags : unsigned char
     {
-    public:
-        explicit LambertianMaterial(glm::vec3 reflectionCoefficients);
-
-        glm::vec3 getBRDF( const float wInAzimuth, const float wInInclination,
-                const float wOutAzimuth, const float wOutInclination) const override;
+        MATERIAL_DIFFUSE = 1 << 0, // gets direct lighting through shadow rays
+        MATERIAL_SPECULAR = 1 << 1, // reflects in a single direction
+        MATERIAL_EMISSIVE = 1 << 2 // a light source
     };
 
-    class OrenNayarMaterial : public MaterialProperties
+    /// A material stored as a plain record. The scene keeps all materials in one flat table
+    /// and objects and intersections refer to them by their index in it.
+    struct MaterialProperties
     {
-    public:
-        OrenNayarMaterial(glm::vec3 reflectionCoefficients, float gaussianStandardDeviation );
+        /// Creation functions for the different materials
+        static MaterialProperties createLambertian(glm::vec3 reflectionCoefficients);
+        static MaterialProperties createOrenNayar(glm::vec3 reflectionCoefficients, float gaussianStandardDeviation);
+        static MaterialProperties createPerfectMirror();
+        static MaterialProperties createEmissive(glm::vec3 reflectionCoefficients, float inFlux);
 
-        glm::vec3 getBRDF( const float wInAzimuth, const float wInInclination,
-                           const float wOutAzimuth, const float wOutInclination) const override;
+        /// The brdf takes an incoming light direction, wIn and outgoing direction, wOut,
+        /// and returns the ratio of reflected radiance exiting along wOut to the irradiance
+        /// incident on the surface from direction wIn. wIn and wOut point away from the surface
+        /// and are unit vectors in the shading frame, where the normal is the z axis.
+        glm::vec3 getBRDF(glm::vec3 wIn, glm::vec3 wOut) const;
 
-    private:
-        float sigma;
-    };
+        /// Evaluates the brdf for several incoming directions and the same outgoing direction,
+        /// such as the shadow rays of a point. 'brdfs' may be the same array as 'wIns'.
+        void getBRDFs(const glm::vec3* wIns, int count, glm::vec3 wOut, glm::vec3* brdfs) const;
 
-    class PerfectMirrorMaterial : public MaterialProperties
-    {
-    public:
-        PerfectMirrorMaterial() = default;
+        /// Draws an incoming direction wIn for the outgoing direction wOut, both in the shading
+        /// frame, roughly in proportion to the light the material reflects from it. Returns the
+        /// brdf times the cosine of wIn over the pdf, the weight of the light arriving from wIn,
+        /// and sets the pdf over solid angle. Perfect mirrors reflect wOut with a weight of one
+        /// and a pdf of 0 since their pdf is not a density.
+        glm::vec3 sample(glm::vec3 wOut, RandomSampler& sampler, glm::vec3& wIn, float& pdf) const;
 
-        glm::vec3 getBRDF( const float wInAzimuth, const float wInInclination,
-                           const float wOutAzimuth, const float wOutInclination) const override;
-    };
+        /// The pdf of sample() drawing wIn for wOut, over solid angle
+        float getPDF(glm::vec3 wIn, glm::vec3 wOut) const;
 
-    class EmissiveMaterial : public MaterialProperties
-    {
-    public:
-        EmissiveMaterial(glm::vec3 reflectionCoefficients, float inFlux);
+        /// The pdfs of several incoming directions and the same outgoing direction
+        void getPDFs(const glm::vec3* wIns, int count, glm::vec3 wOut, float* pdfs) const;
+
+        /// A direction in the hemisphere around the z axis drawn with a pdf of cos(theta) / pi
+        static glm::vec3 sampleCosineHemisphere(RandomSampler& sampler);
+
+        bool isDiffuse() const { return (flags & MATERIAL_DIFFUSE) != 0; }
+        bool isSpecular() const { return (flags & MATERIAL_SPECULAR) != 0; }
+        bool isEmissive() const { return (flags & MATERIAL_EMISSIVE) != 0; }
 
-        glm::vec3 getBRDF( const float wInAzimuth, const float wInInclination,
-                           const float wOutAzimuth, const float wOutInclination) const override;
+        MaterialType type;
+        unsigned char flags;
+        unsigned char padding[2]; // always zero, the scene cache stores the record byte for byte
 
-        float getFlux() const { return flux; }
+        glm::vec3 rho; // constant reflection coefficient
+        glm::vec3 rhoOverPi;
 
-    private:
-        float flux;
+        float orenNayarA, orenNayarB; // derived from the standard deviation of the facet angles
+        float flux; // emitted by emissive materials
     };
 
-} // namespace rayTracer
\ No newline at end of file
+} // namespace rayTracer
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <glm.hpp>
+#include <string>
+#include <vector>
+
+namespace rayTracer {
+
+    /// Loads triangle meshes from Wavefront OBJ and binary PLY files. The file is memory mapped and
+    /// parsed straight from the mapped bytes, in chunks spread over all threads. Polygons are split
+    /// into triangle fans. Texture coordinates, normals, groups and materials are skipped.
+    class MeshLoader
+    {
+    public:
+        struct Mesh
+        {
+            std::vector<glm::vec3> vertices;
+            std::vector<glm::ivec3> triangleIndices;
+        };
+
+        /// Loads the .obj or .ply file at the path into the mesh. Triangles with an index out of
+        /// range or without any area are dropped. Returns false if the file can't be read or
+        /// isn't in a supported format.
+        static bool load(const std::string& path, Mesh& mesh);
+
+        /// Parse a whole file that is already in memory
+        static bool parseOBJ(const char* data, std::size_t size, Mesh& mesh);
+        static bool parsePLY(const char* data, std::size_t size, Mesh& mesh);
+    };
+
+} // namespace rayTracer
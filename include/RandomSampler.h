@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+
+namespace rayTracer {
+
+    /// Counter based random numbers for one path. Every number is a hash of where it is used in
+    /// the render: (pixel, sample, bounce, dimension), where the dimension counts the numbers
+    /// drawn so far at the current bounce. There is no state shared between paths, so threads
+    /// never wait on each other and a render gives the same image whatever the number of threads
+    /// or the order the paths are traced in.
+    class RandomSampler
+    {
+    public:
+        RandomSampler();
+        RandomSampler(std::uint32_t pixel, std::uint32_t sample, std::uint32_t seed);
+
+        /// Returns the next number of the current bounce, uniform in [0, 1)
+        float next();
+
+        /// Returns a sampler for the numbers of the following bounce of the same path
+        RandomSampler nextBounce() const;
+
+        std::uint32_t getBounce() const { return bounce; }
+
+    private:
+        std::uint32_t pixelKey; // the pixel index mixed with the seed of the render
+        std::uint32_t sample;
+        std::uint32_t bounce;
+        std::uint32_t dimension;
+    };
+
+} // namespace rayTracer
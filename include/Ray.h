@@ -1,78 +1,71 @@
 #pragma once
+#include <RandomSampler.h>
+#include <ShadingFrame.h>
 #include <glm.hpp>
-#include <memory>
-#include <random>
 
 namespace rayTracer {
 
-    class MaterialProperties;
-    using MaterialPtr = std::shared_ptr<MaterialProperties>;
+    struct MaterialProperties;
 
+    /// A ray with the closest intersection found so far stored in place. Rays are plain values,
+    /// they are created on the stack and copied around without touching the heap.
     class Ray
     {
     public:
         struct Intersection
         {
-            Intersection(glm::vec3 point, glm::vec3 inNormal, float distance, MaterialPtr inMaterial)
-                    : distanceToRayOrigin(distance), intersectionPoint(point), normal(inNormal), material(inMaterial)
+            Intersection()
+                    : distanceToRayOrigin(0.0f), intersectionPoint(0.0f), normal(0.0f), materialIndex(-1), objectIndex(-1)
             { }
 
-            glm::mat4 getWorldToLocalMatrix(glm::vec3 rayDirection) const
-            {
-                glm::vec3 axisX = rayDirection - glm::dot(rayDirection, normal) * normal;
-                glm::vec3 axisY = glm::cross(-1.f * axisX, normal);
-                return glm::inverse(glm::mat4( axisX.x, axisX.y, axisX.z, 0.0,
-                        axisY.x, axisY.y, axisY.z, 0.0,
-                        normal.x, normal.y, normal.z, 0.0,
-                        0.0, 0.0, 0.0, 1.0));
-            }
+            Intersection(glm::vec3 point, glm::vec3 inNormal, float distance, int inMaterialIndex, int inObjectIndex)
+                    : distanceToRayOrigin(distance), intersectionPoint(point), normal(inNormal), frame(inNormal),
+                      materialIndex(inMaterialIndex), objectIndex(inObjectIndex)
+            { }
 
             float distanceToRayOrigin;
             glm::vec3 intersectionPoint;
             glm::vec3 normal;
-            MaterialPtr material;
+            ShadingFrame frame; // built once per hit for evaluating the BRDF
+            int materialIndex; // index in the material table of the scene
+            int objectIndex; // the object index the primitive was added to the geometry store with
         };
 
+        Ray();
         Ray(glm::vec3 inStartPoint, glm::vec3 inDirection);
 
         /// Get functions
-        glm::vec3 getStartPoint() { return startPoint; }
-        glm::vec3 getDirection() { return direction; }
-        const std::shared_ptr<Intersection> getIntersection() { return rayIntersection; }
-
-        float lengthSquared() const;
-
-        /// Returns true if the given new distance is shorter than what is stored
-        bool foundCloserRayIntersection(float newDistanceToOrigin);
+        glm::vec3 getStartPoint() const { return startPoint; }
+        glm::vec3 getDirection() const { return direction; }
+        bool hasIntersection() const { return intersected; }
+        const Intersection& getIntersection() const { return rayIntersection; }
 
         /// Updates the intersection to the given intersection
-        void updateRayIntersection(std::shared_ptr<Intersection> newRayIntersection);
+        void updateRayIntersection(const Intersection& newRayIntersection);
 
         /// Generate new rays from the current one which will reflect/refract
-        /// at the point of the current ray's intersection point.
-        std::shared_ptr<Ray> generateReflectedRay(
-                std::mt19937* randGenerator,
-                std::uniform_real_distribution<float>* randDistribution) const;
-        glm::vec3 generateRandomReflectedRayDirection(
-                std::mt19937* randGenerator,
-                std::uniform_real_distribution<float>* randDistribution) const;
-        std::shared_ptr<Ray> generateRefractedRay() const;
-        std::shared_ptr<Ray> generateShadowRay(glm::vec3 pointOnLightSource) const;
-
-        /// Returns the value of the BRDF between the current ray and the reflected ray
-        glm::vec3 getValueOfBRDF(std::shared_ptr<Ray> reflectedRay) const;
-
-        /// Returns true if the ray has intersected with a diffuse object
-        bool hitsDiffuseObject() const;
-
-        /// Returns true if the ray has intersected with an emissive object
-        bool hitsEmissiveObject() const;
+        /// at the point of the current ray's intersection point. The ray
+        /// needs to have an intersection, the material is the one hit.
+        /// The reflected ray is drawn from the material, the weight is the
+        /// BRDF times the cosine over the pdf and the pdf is over solid angle,
+        /// 0 for perfect mirrors.
+        Ray generateReflectedRay(const MaterialProperties& material, RandomSampler& sampler,
+                                 glm::vec3& weight, float& pdf) const;
+        bool generateRefractedRay(Ray& refractedRay) const;
+        Ray generateShadowRay(glm::vec3 pointOnLightSource) const;
+
+        /// Returns the values of the BRDF of the material hit between the current ray and several
+        /// directions leaving the intersection point, e.g. towards points on a light source, and
+        /// the pdfs of the material drawing them. The values may be written over the directions.
+        void getValuesOfBRDF(const MaterialProperties& material, const glm::vec3* directions, int count,
+                             glm::vec3* values, float* pdfs) const;
 
     private:
         glm::vec3 startPoint;
         glm::vec3 direction;
 
-        std::shared_ptr<Intersection> rayIntersection;
+        Intersection rayIntersection;
+        bool intersected;
     };
 
 } // namespace rayTracer
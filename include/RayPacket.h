@@ -0,0 +1,122 @@
+#pragma once
+#include <BoundingBox.h>
+#include <glm.hpp>
+#include <limits>
+
+namespace rayTracer {
+
+    /// A bundle of coherent rays (e.g. the camera rays of a block of pixels) that traverses
+    /// an acceleration structure together. Besides the individual rays it keeps the interval
+    /// spanned by their origins and inverse directions, which lets a whole packet be culled
+    /// against a bounding box with one test as long as all directions point the same way.
+    struct RayPacket
+    {
+        static const int MAX_SIZE = 64; // 8x8 pixels
+
+        RayPacket()
+            : size(0)
+            , hasCoherentDirections(false)
+            , largestTMax(0.0f)
+        { }
+
+        /// Adds a ray to the packet, the direction has to be normalized
+        void addRay(glm::vec3 origin, glm::vec3 direction)
+        {
+            origins[size] = origin;
+            directions[size] = direction;
+            invDirections[size] = 1.0f / direction;
+            tMax[size] = std::numeric_limits<float>::max();
+            ++size;
+        }
+
+        /// Computes the bounds used for culling, has to be called after the last ray is added. An
+        /// empty packet is never culled and has nothing to read the bounds from.
+        void finalize()
+        {
+            if (size == 0)
+            {
+                hasCoherentDirections = false;
+                largestTMax = 0.0f;
+                return;
+            }
+
+            minOrigin = maxOrigin = origins[0];
+            minInvDirection = maxInvDirection = invDirections[0];
+            largestTMax = tMax[0];
+            for (int i = 1; i < size; ++i)
+            {
+                minOrigin = glm::min(minOrigin, origins[i]);
+                maxOrigin = glm::max(maxOrigin, origins[i]);
+                minInvDirection = glm::min(minInvDirection, invDirections[i]);
+                maxInvDirection = glm::max(maxInvDirection, invDirections[i]);
+                largestTMax = glm::max(largestTMax, tMax[i]);
+            }
+
+            // The interval test needs every direction to have the same (non zero) sign per axis
+            hasCoherentDirections = true;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                bool allPositive = minInvDirection[axis] > 0.0f && maxInvDirection[axis] < std::numeric_limits<float>::infinity();
+                bool allNegative = maxInvDirection[axis] < 0.0f && minInvDirection[axis] > -std::numeric_limits<float>::infinity();
+                if (!allPositive && !allNegative)
+                    hasCoherentDirections = false;
+            }
+        }
+
+        /// Updates the largest tMax of the packet, call after the tMax of any ray has been lowered
+        void updateLargestTMax()
+        {
+            if (size == 0)
+                return;
+
+            largestTMax = tMax[0];
+            for (int i = 1; i < size; ++i)
+                largestTMax = glm::max(largestTMax, tMax[i]);
+        }
+
+        /// Conservative test of the whole packet against the box using interval arithmetic.
+        /// Returns true only if it is certain that no ray in the packet hits the box.
+        bool missesBox(const BoundingBox& box) const
+        {
+            if (!hasCoherentDirections)
+                return false;
+
+            float tEnter = 0.0f;
+            float tExit = largestTMax;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                bool positive = minInvDirection[axis] > 0.0f;
+                float nearPlane = positive ? box.min[axis] : box.max[axis];
+                float farPlane = positive ? box.max[axis] : box.min[axis];
+
+                // [plane - maxOrigin, plane - minOrigin] * [minInvDirection, maxInvDirection]
+                float near0 = (nearPlane - maxOrigin[axis]) * minInvDirection[axis];
+                float near1 = (nearPlane - maxOrigin[axis]) * maxInvDirection[axis];
+                float near2 = (nearPlane - minOrigin[axis]) * minInvDirection[axis];
+                float near3 = (nearPlane - minOrigin[axis]) * maxInvDirection[axis];
+                float far0 = (farPlane - maxOrigin[axis]) * minInvDirection[axis];
+                float far1 = (farPlane - maxOrigin[axis]) * maxInvDirection[axis];
+                float far2 = (farPlane - minOrigin[axis]) * minInvDirection[axis];
+                float far3 = (farPlane - minOrigin[axis]) * maxInvDirection[axis];
+
+                tEnter = glm::max(tEnter, glm::min(glm::min(near0, near1), glm::min(near2, near3)));
+                tExit = glm::min(tExit, glm::max(glm::max(far0, far1), glm::max(far2, far3)));
+            }
+
+            // Same slack as the single ray test so rounding never culls a hit
+            return tEnter > tExit * 1.0000004f;
+        }
+
+        int size;
+        glm::vec3 origins[MAX_SIZE];
+        glm::vec3 directions[MAX_SIZE];
+        glm::vec3 invDirections[MAX_SIZE];
+        float tMax[MAX_SIZE]; // distance to the closest hit found so far for each ray
+
+        bool hasCoherentDirections;
+        glm::vec3 minOrigin, maxOrigin;
+        glm::vec3 minInvDirection, maxInvDirection;
+        float largestTMax;
+    };
+
+} // namespace rayTracer
@@ -1,4 +1,6 @@
 #pragma once
+#include <ImageWriter.h>
+#include <string>
 
 namespace rayTracer {
 
@@ -7,13 +9,60 @@ namespace rayTracer {
 		int numSubSamplesPerPixel;
 		int numShadowRays;
 		float russianRouletteCoefficient;
+		float maxSampleValue; // clamps the channels of every camera sample to this to hide fireflies, which darkens the image. 0 for no clamp
 		int outputProgressEveryXPercent;
+		bool useAccelerationStructure; // false tests every ray against every object
+		bool usePacketTracing; // trace the camera rays of packetSize x packetSize pixels together
+		int packetSize; // at most 8
+		int tileSize; // width and height of the image tiles the threads take turns rendering
+		bool useWavefrontIntegrator; // trace paths breadth first in batches instead of one by one recursively
+		int wavefrontPathsPerBatch; // number of paths kept in flight by the wavefront integrator
+		unsigned int randomSeed; // renders with the same seed and settings give the same image
+		bool useProgressiveRendering; // add passes of one sample per pixel until one of the limits below is hit
+		int maxPasses; // 0 for no limit
+		float maxRenderTimeSeconds; // checked after every pass, 0 for no limit
+		float convergenceThreshold; // stop once the estimated relative error is below this, 0 for no limit
+		int outputImageEveryXPasses; // write the image so far every x passes, 0 to only write it at the end
+		int checkpointEveryXPasses; // write a checkpoint every x passes and after the last one, 0 for none
+		bool resumeFromCheckpoint; // continue a progressive render after the passes of its last checkpoint
+		bool useAdaptiveSampling; // numSubSamplesPerPixel to start with, then more for noisy blocks of packetSize x packetSize pixels. Not with the progressive or wavefront modes
+		int maxSubSamplesPerPixel; // limit for the adaptive sampling
+		float adaptiveErrorThreshold; // RMS standard error of the pixel values of a block, 0-1 like the pixel values, to get below
+		int numShards; // split the frame over this many renders that each write a partial result, 1 renders it all
+		int shardIndex; // the shard to render, from 0 to numShards - 1
+		bool shardBySamples; // shards render a range of the samples of every pixel instead of every numShards'th tile
+		std::string outputPath; // the format follows the extension: .ppm, .png, .pfm or .exr. Checkpoints and partial results go next to it
+		ImageWriter::DisplaySettings displaySettings; // exposure, tone mapping and sRGB curve of the .ppm and .png images
+		bool useStreamingOutput; // write the image a band of tile rows at a time while rendering, without memory for the whole frame. Not with the progressive, wavefront or sharded modes
 
 		RenderSettings()
 			: numSubSamplesPerPixel(1)
 			, numShadowRays(1)
 			, russianRouletteCoefficient(0.9f)
+			, maxSampleValue(0.0f)
 			, outputProgressEveryXPercent(10)
+			, useAccelerationStructure(true)
+			, usePacketTracing(false)
+			, packetSize(4)
+			, tileSize(16)
+			, useWavefrontIntegrator(false)
+			, wavefrontPathsPerBatch(1 << 16)
+			, randomSeed(0)
+			, useProgressiveRendering(false)
+			, maxPasses(0)
+			, maxRenderTimeSeconds(0.0f)
+			, convergenceThreshold(0.0f)
+			, outputImageEveryXPasses(0)
+			, checkpointEveryXPasses(0)
+			, resumeFromCheckpoint(false)
+			, useAdaptiveSampling(false)
+			, maxSubSamplesPerPixel(64)
+			, adaptiveErrorThreshold(0.01f)
+			, numShards(1)
+			, shardIndex(0)
+			, shardBySamples(false)
+			, outputPath("../renderedImage.ppm")
+			, useStreamingOutput(false)
 		{ }
 	};
 }
@@ -1,18 +1,27 @@
 #pragma once
+#include <AliasTable.h>
+#include <BVH.h>
 #include <Camera.h>
+#include <CheckpointWriter.h>
+#include <GeometryStore.h>
+#include <MaterialProperties.h>
+#include <RandomSampler.h>
 #include <RenderSettings.h>
+#include <TileScheduler.h>
+#include <WorkerThread.h>
 #include <glm.hpp>
 #include <map>
 #include <memory>
+#include <string>
 #include <vector>
-#include <random>
 
 namespace rayTracer {
 
-class MaterialProperties;
-using MaterialPtr = std::shared_ptr<MaterialProperties>;
+class SceneCache;
 class SceneObject;
+class SharedMesh;
 class Ray;
+class WavefrontIntegrator;
 
 class Scene {
 public:
@@ -25,45 +34,216 @@ public:
     /// Renders the current scene given the name/id of the camera to render from
     void render(const std::string cameraName, const RenderSettings& settings);
 
+    /// Number of heap allocations made while tracing in the last render, the one render() prints
+    long long getNumAllocationsWhileTracing() const { return numAllocationsWhileTracing; }
+
     /// ---------------------------------------------------------------------
-    /// Functions to add objects to scene
+    /// Functions to add objects to scene, before the first render
+
+    /// Adds a material to the material table of the scene and returns its index,
+    /// which is what the objects using it are given
+    int addMaterial(const MaterialProperties& material);
 
     /// Adds a sphere with the specified settings to the scene
-    void addSphere(float radius, glm::vec3 centerPosition, MaterialPtr material, bool emissive = false);
+    void addSphere(float radius, glm::vec3 centerPosition, int material, bool emissive = false);
 
     /// Adds a box with the specified settings to the scene
-    void addBox(glm::mat4x4 transform, MaterialPtr material, bool emissive = false );
+    void addBox(glm::mat4x4 transform, int material, bool emissive = false );
 
     /// Adds a plane with the specified settings to the scene
-    void addPlane(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, MaterialPtr material, bool emissive = false);
+    void addPlane(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, int material, bool emissive = false);
+
+    /// Adds a triangle mesh from a .obj or .ply file, transformed into place. Returns false if the
+    /// file can't be loaded.
+    bool addMesh(const std::string& path, glm::mat4x4 transform, int material, bool emissive = false);
+
+    /// Adds an instance of a shared mesh placed by the transform, with its own material. The
+    /// triangles of the mesh are stored once however many instances of it are added.
+    void addInstance(std::shared_ptr<const SharedMesh> mesh, glm::mat4x4 transform, int material,
+                     bool emissive = false);
+
+    /// Saves the compiled geometry, the materials and the light sources to a scene cache that
+    /// loadCache() can use in later runs. Returns false if it can't be written.
+    bool saveCache(const std::string& path);
+
+    /// Replaces the objects and materials of the scene with those of a cache written by saveCache().
+    /// The geometry is used straight from the memory mapped file. Only the light sources are kept
+    /// as objects, objects added afterwards aren't rendered. Returns false if the file can't be read
+    /// or was written by another version.
+    bool loadCache(const std::string& path);
 
     /// Adds a camera to the scene
     void addCamera(std::shared_ptr<Camera> camera);
 
 private:
-    /// Trace the ray through the scene recursively
-    glm::vec3 traceRay(std::shared_ptr<Ray> ray) const;
+    friend class WavefrontIntegrator;
+
+    /// Where a thread renders a tile before it is copied to the image, both stored row by row
+    struct TileBuffer
+    {
+        std::vector<glm::vec3> pixels;
+        std::vector<int> sampleCounts;
+    };
+
+    /// The file a streamed render is written to and the two bands of rows it is rendered in, one
+    /// band is written while the next one renders
+    struct StreamingOutput
+    {
+        ImageWriter imageWriter;
+        TileBuffer bands[2];
+        std::vector<const glm::vec3*> bandRows[2]; // the first pixel of every row of the bands
+        bool written; // false once the file couldn't be opened or written
+    };
+
+    /// How many shadow rays to a light source are set up together
+    static const int SHADOW_RAY_BATCH_SIZE = 16;
+
+    /// An unoccluded shadow ray segment from a shaded point to a point on a light source
+    /// together with the light it would carry if nothing blocks it
+    struct ShadowConnection
+    {
+        glm::vec3 origin;
+        glm::vec3 direction;
+        float distance; // stops just short of the light source
+        float lightPdf; // of the point on the light source, over solid angle
+        glm::vec3 contribution;
+    };
+
+    /// Compiles the scene objects into the geometry store and builds its hierarchies the first
+    /// time, after which the objects that aren't light sources free their triangles
+    void compileGeometry();
+
+    /// Builds the table the shadow rays pick the light sources from
+    void buildLightSelection();
+
+    /// Sets up everything the render needs before it starts, so the passes and bands reuse it instead of
+    /// allocating: the tile scheduler for the whole image of the camera and the tile buffers of the
+    /// threads, the wavefront integrator for the largest batch of numSamples per pixel and the output
+    /// file of a streamed render
+    void prepareRendering(Camera& camera, int numSamples);
+
+    /// Number of rows the wavefront integrator renders together with numSamples per pixel
+    int getWavefrontRowsPerBatch(const Camera& camera, int numSamples) const;
+
+    /// Sets up the accumulation buffer of the camera for a progressive render, loaded from the checkpoint
+    /// when resuming, and the checkpoint writer. Returns the pass to start from.
+    int prepareProgressive(Camera& camera);
+
+    /// Renders passes of one sample per pixel into the accumulation buffer of the camera, starting with
+    /// firstPass, until the pass, time or convergence limit of the render settings is reached
+    void renderProgressive(Camera& camera, int firstPass, BVH::TraversalStatistics& statistics);
+
+    /// Sets every pixel to the average of its samples [firstSample, firstSample + numSamples)
+    /// using the recursive integrator. The image is split into tiles that the threads take
+    /// from a work stealing scheduler.
+    void renderTiles(Camera& camera, int firstSample, int numSamples, bool showProgress,
+                     BVH::TraversalStatistics& statistics);
+
+    /// Renders the rows [firstRow, lastRow) like renderTiles. The pixels go to the camera or, if a rows
+    /// buffer is given, to that buffer, which holds the rows one after the other starting with firstRow.
+    void renderTileRows(Camera& camera, int firstRow, int lastRow, int firstSample, int numSamples,
+                        bool showProgress, TileBuffer* rowsBuffer, BVH::TraversalStatistics& statistics);
+
+    /// Same as renderTiles but the image is written to the output file a band of tile rows at a
+    /// time as soon as the band is done, instead of being stored in the camera
+    void renderStreaming(Camera& camera, int firstSample, int numSamples, BVH::TraversalStatistics& statistics);
+
+    /// Same as renderTiles with the wavefront integrator, a batch of rows at a time
+    void renderWavefront(Camera& camera, int firstSample, int numSamples, bool showProgress,
+                         BVH::TraversalStatistics& statistics);
+
+    /// The tile size of the render settings rounded up to whole pixel blocks
+    int getTileSize() const;
+
+    /// Renders the pixels of the tile into the tile buffer, a block at a time. With adaptive sampling
+    /// numSamples is the minimum number of samples per pixel.
+    void renderTile(Camera& camera, const TileScheduler::Tile& tile, int firstSample, int numSamples,
+                    TileBuffer& tileBuffer, BVH::TraversalStatistics& statistics);
+
+    /// Renders the block of packetSize x packetSize pixels of the tile starting at the given row and
+    /// column. With packet tracing the camera rays of each sample are traced as one packet.
+    void renderPixelBlock(Camera& camera, const TileScheduler::Tile& tile, int firstRow, int firstColumn,
+                          int firstSample, int numSamples, TileBuffer& tileBuffer,
+                          BVH::TraversalStatistics& statistics);
+
+    /// Returns the material of the object the ray has intersected
+    const MaterialProperties& getMaterial(const Ray& ray) const;
+
+    /// Trace the ray through the scene recursively, drawing the random numbers
+    /// of the bounce from the sampler. The pdf is the one the ray was drawn with
+    /// at a diffuse surface, 0 for camera rays and mirror reflections.
+    glm::vec3 traceRay(Ray& ray, RandomSampler& sampler, float pdf, BVH::TraversalStatistics& statistics) const;
+
+    /// Calculates the light coming back along a ray that has already been intersected with the scene
+    glm::vec3 shadeIntersection(const Ray& ray, RandomSampler& sampler, float pdf,
+                                BVH::TraversalStatistics& statistics) const;
+
+    /// Clamps the light a camera ray brought back to the max sample value of the render settings, if
+    /// one is set. Only whole paths are clamped, so that without a max the estimate stays unbiased.
+    glm::vec3 clampSample(glm::vec3 sample) const;
+
+    /// Returns the light emitted back along the ray by the light source it hit, weighted against
+    /// finding the same light through shadow rays when the ray was drawn at a diffuse surface with
+    /// the given pdf. Only the front of light sources emits, as seen by the shadow rays.
+    glm::vec3 getEmittedLight(const Ray& ray, float pdf) const;
 
     /// Given a ray it will find the closest intersection point within
     /// the scene.
-    bool findClosestIntersection(std::shared_ptr<Ray> currentRay) const;
+    bool findClosestIntersection(Ray& currentRay, BVH::TraversalStatistics& statistics) const;
 
-    /// Calculates the direct lighting on a point in space
-    glm::vec3 calculateDirectLighting(const std::shared_ptr<Ray> ray) const;
+    /// Finds the closest intersection for every ray of the packet, the rays
+    /// in 'rays' should match the ones in the packet
+    void findClosestIntersections(RayPacket& packet, Ray* rays,
+                                  BVH::TraversalStatistics& statistics) const;
+
+    /// Returns true if anything in the scene blocks the ray origin + t * direction
+    /// for a t below tMax. Stops at the first blocker found.
+    bool occluded(glm::vec3 origin, glm::vec3 direction, float tMax, BVH::TraversalStatistics& statistics) const;
 
-    /// Calculates the contribution from the given shadow ray on the intersection point of the original ray.
-    glm::vec3 getShadowRayContribution(const std::shared_ptr<Ray> originalRay, std::shared_ptr<Ray> shadowRay) const;
+    /// Calculates the direct lighting on a point in space
+    glm::vec3 calculateDirectLighting(const Ray& ray, RandomSampler& sampler, BVH::TraversalStatistics& statistics) const;
+
+    /// Sets up the shadow ray from the intersection point of the original ray to the given point
+    /// on a light source, its contribution being the geometric term without the BRDF. Returns
+    /// false if the light can't reach the point regardless of occlusion. The point was picked with
+    /// pointPdf over the area of the light source.
+    bool createShadowConnection(const Ray& originalRay, glm::vec3 pointOnLightSource,
+                                glm::vec3 lightSourceNormal, float pointPdf,
+                                ShadowConnection& connection) const;
+
+    /// Sets up shadow rays from the intersection point of the original ray to 'count' random points
+    /// on the light sources, at most SHADOW_RAY_BATCH_SIZE. Every shadow ray picks a light source in
+    /// proportion to its power. The ones that can carry light are written to 'connections' with the
+    /// light they add to the estimate of the point if nothing blocks them. It includes the BRDF, all
+    /// of them evaluated together, and the weight against finding the light by sampling the BRDF.
+    /// Their number is returned.
+    int connectToLights(const Ray& originalRay, int count, RandomSampler& sampler,
+                        ShadowConnection* connections) const;
     
 private:
+    std::vector<MaterialProperties> materials;
     std::vector<std::shared_ptr<SceneObject>> sceneObjects;
     std::vector<int> emissiveObjectIndices; // indices into scene objects
+    std::vector<int> lightIndices; // by object index in the geometry, the position in emissiveObjectIndices or -1
+    AliasTable lightSelection; // over emissiveObjectIndices
+
+    GeometryStore geometry; // what rays are traced against, compiled from the scene objects
+    bool geometryIsDirty;
+    bool geometryIsReleased; // the objects have freed what the store holds, so it can't be compiled again
+    std::shared_ptr<SceneCache> sceneCache; // holds the geometry when it was loaded from a cache
+    std::vector<std::unique_ptr<GeometryStore>> cachedMeshes; // the meshes of the instances in the cache
 
     std::map<std::string, std::shared_ptr<Camera>> sceneCameras;
 
     RenderSettings renderSettings;
-
-    std::mt19937* gen;
-    std::uniform_real_distribution<float>* dis;
+    long long numAllocationsWhileTracing;
+    TileScheduler tileScheduler; // reset for every image or band of tiles, sorted again only when their size changes
+    std::vector<TileBuffer> tileBuffers; // one per thread, kept from one pass to the next
+    std::unique_ptr<WavefrontIntegrator> wavefrontIntegrator; // set up for every render that uses it
+    WorkerThread outputThread; // writes the streamed bands and the checkpoints while the render goes on
+    CheckpointWriter checkpointWriter;
+    std::vector<char> checkpointData; // the accumulation of the camera, swapped with the writer's buffer
+    StreamingOutput streamingOutput;
 };
 
 } // namespace rayTracer
\ No newline at end of file
@@ -0,0 +1,129 @@
+#pragma once
+#include <ArrayView.h>
+#include <MappedFile.h>
+#include <cstddef>
+#include <cstdint>
+#include <glm.hpp>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace rayTracer {
+
+    /// A compiled scene stored on disk in the layout it is rendered from: the materials, the light
+    /// sources and the packed geometry of the geometry store together with its hierarchies. A
+    /// loaded cache is memory mapped and the sections are used in place, so loading one costs
+    /// the page faults of the parts that get touched and nothing is rebuilt.
+    ///
+    /// The file starts with a header holding the format version, a byte order mark, the size of
+    /// the records of every section and where the sections are. The sections follow it, each one
+    /// starting on a cache line. A cache written by another version, on a machine with another
+    /// byte order or by a build with differently sized records is rejected.
+    class SceneCache
+    {
+    public:
+        static const std::uint32_t VERSION = 3;
+
+        enum Section {
+            MATERIALS,
+            LIGHTS,
+            LIGHT_VERTICES, // of the triangles of the lights, three per triangle
+            TRIANGLE_NODES,
+            TRIANGLE_ORDER,
+            TRIANGLE_PACKETS,
+            TRIANGLE_INFOS,
+            SPHERE_NODES,
+            SPHERE_ORDER,
+            SPHERES,
+            INSTANCE_NODES,
+            INSTANCE_ORDER,
+            INSTANCES,
+            MESHES,
+            MESH_NODES, // of all the meshes one after the other, the same for the next three
+            MESH_ORDER,
+            MESH_PACKETS,
+            MESH_INFOS,
+            NUM_SECTIONS
+        };
+
+        /// A light source, either a sphere or a range of triangles in LIGHT_VERTICES
+        struct LightRecord
+        {
+            int objectIndex; // in the geometry
+            int materialIndex;
+            int firstVertex;
+            int numVertices; // 0 for a sphere
+            float radius;
+            glm::vec3 center;
+        };
+
+        /// Where the arrays of a mesh of the instances are in the MESH_ sections. It has as many
+        /// triangle infos as packet lanes.
+        struct MeshRecord
+        {
+            int numTriangles;
+            int firstNode, numNodes;
+            int firstOrder, numOrder;
+            int firstPacket, numPackets;
+        };
+
+        SceneCache();
+        SceneCache(const SceneCache&) = delete;
+        SceneCache& operator=(const SceneCache&) = delete;
+
+        /// Writing: set every section, which has to stay alive until it is written, then write the file
+        template<typename T>
+        void setSection(Section section, ArrayView<T> records)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "The records of the cache are written byte for byte");
+            sections[section] = records.data();
+            sectionSizes[section] = records.size() * sizeof(T);
+        }
+
+        template<typename T, typename Allocator>
+        void setSection(Section section, const std::vector<T, Allocator>& records)
+        {
+            setSection(section, ArrayView<T>(records));
+        }
+
+        void setNumTriangles(int inNumTriangles) { numTriangles = inNumTriangles; }
+
+        /// Returns false if the file can't be written
+        bool write(const std::string& path) const;
+
+        /// Reading: maps the file, returns false if it can't be read or isn't a cache of this version
+        bool open(const std::string& path);
+
+        /// The records of a section, pointing into the mapped file
+        template<typename T>
+        ArrayView<T> getSection(Section section) const
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "The records of the cache are read byte for byte");
+            return ArrayView<T>(static_cast<const T*>(sections[section]), std::size_t(sectionSizes[section] / sizeof(T)));
+        }
+
+        int getNumTriangles() const { return numTriangles; }
+
+    private:
+        struct Header
+        {
+            char magic[8];
+            std::uint32_t version;
+            std::uint32_t byteOrderMark;
+            std::uint32_t recordSizes[NUM_SECTIONS];
+            std::int32_t numTriangles;
+            std::uint64_t sectionOffsets[NUM_SECTIONS];
+            std::uint64_t sectionSizes[NUM_SECTIONS];
+        };
+
+        /// Size of one record of the section in this build
+        static std::uint32_t getRecordSize(Section section);
+
+        const void* sections[NUM_SECTIONS];
+        std::uint64_t sectionSizes[NUM_SECTIONS];
+        int numTriangles;
+
+        MappedFile file;
+    };
+
+} // namespace rayTracer
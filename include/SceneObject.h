@@ -1,46 +1,75 @@
 #pragma once
+#include <AliasTable.h>
+#include <BoundingBox.h>
+#include <GeometryStore.h>
 #include <glm.hpp>
 #include <memory>
+#include <string>
 #include <vector>
-#include <random>
 
 namespace rayTracer {
 
-    class MaterialProperties;
-    using MaterialPtr = std::shared_ptr<MaterialProperties>;
+    struct MaterialProperties;
+    class RandomSampler;
     class Ray;
 
     /**********************************/
     /***         SceneObject        ***/
     /**********************************/
 
-    /// Abstract base class of the different possible objects
-    /// that can be added to a scene
+    /// Abstract base class of the different possible objects that can be added to a
+    /// scene. The objects describe the scene, rays are traced against the primitives they
+    /// add to the scene's geometry store.
     class SceneObject {
     public:
-        /// Checks if the given ray intersects the current object
-        virtual bool intersect(std::shared_ptr<Ray> currentRay) = 0;
+        /// A point on the surface of an object together with the surface normal there and the
+        /// probability density it was picked with
+        struct SurfacePoint
+        {
+            glm::vec3 position;
+            glm::vec3 normal;
+            float pdf; // over area
+        };
+
+        /// Adds the primitives of the object to the store, tagged with the given object index
+        virtual void addToGeometryStore(GeometryStore& geometryStore, int objectIndex) const = 0;
+
+        /// Frees what only adding the object to the store needed, once the store is built. The object
+        /// can't be added to a store again afterwards. Nothing is freed unless overridden.
+        virtual void releaseGeometry() { }
 
         /// Returns the area of the object
         float area() const { return surfaceArea; }
 
         float radiance() const { return emittedRadiance; }
 
-        /// Returns a random point on the object where the surface normal
-        /// is within 90 degrees of the negative rays direction (the naive
-        /// way of checking if the point is visible from that direction)
-        virtual glm::vec3 getRandomPointOnObject( std::shared_ptr<Ray> ray,
-                std::mt19937* randGenerator,
-                std::uniform_real_distribution<float>* randDistribution) const = 0;
+        /// Returns the index of the object's material in the material table of the scene
+        int getMaterialIndex() const { return materialIndex; }
+
+        /// Returns the axis aligned bounding box of the object
+        const BoundingBox& getBoundingBox() const { return boundingBox; }
+
+        /// Returns a random point on the object to light the intersection point of the ray with,
+        /// together with the pdf it was picked with. Only for light sources.
+        virtual SurfacePoint getRandomPointOnObject(const Ray& ray, RandomSampler& sampler) const = 0;
+
+        /// Returns the pdf over area that getRandomPointOnObject() picks the point on the surface
+        /// with when lighting the point 'from'. Uniform over the surface unless overridden.
+        virtual float getPdfOfPoint(glm::vec3 /*from*/, glm::vec3 /*position*/, glm::vec3 /*normal*/) const
+        {
+            return 1.0f / surfaceArea;
+        }
 
     protected:
-        explicit SceneObject(MaterialPtr inMaterial);
+        explicit SceneObject(int inMaterialIndex);
 
-        void calculateRadiance();
+        /// Sets the emitted radiance from the material, the area has to be calculated first
+        void calculateRadiance(const MaterialProperties& material);
 
-        MaterialPtr material;
+        int materialIndex;
         float surfaceArea;
         float emittedRadiance;
+        BoundingBox boundingBox;
     };
 
     /**********************************/
@@ -50,26 +79,34 @@ namespace rayTracer {
     class Sphere : public SceneObject
     {
     public:
-        Sphere(float inRadius, glm::vec3 inCenterPosition, MaterialPtr material);
+        Sphere(float inRadius, glm::vec3 inCenterPosition, int materialIndex, const MaterialProperties& material);
 
-        /// Checks if the given ray intersects the current object
-        bool intersect(std::shared_ptr<Ray> currentRay) override;
+        /// Adds the sphere to the store
+        void addToGeometryStore(GeometryStore& geometryStore, int objectIndex) const override;
 
-        /// Returns a random point on the object where the surface normal
-        /// is within 90 degrees of the negative rays direction (the naive
-        /// way of checking if the point is visible from that direction)
-        glm::vec3 getRandomPointOnObject( std::shared_ptr<Ray> ray,
-                                          std::mt19937* randGenerator,
-                                          std::uniform_real_distribution<float>* randDistribution) const override;
+        /// Returns a random point on the part of the sphere visible from the intersection point
+        /// of the ray, picked uniformly over the cone of directions the sphere fills
+        SurfacePoint getRandomPointOnObject(const Ray& ray, RandomSampler& sampler) const override;
+
+        /// The pdf of the cone sampling over the area of the visible part, 0 on the far side
+        float getPdfOfPoint(glm::vec3 from, glm::vec3 position, glm::vec3 normal) const override;
+
+        float getRadius() const { return radius; }
+        glm::vec3 getCenterPosition() const { return centerPosition; }
 
     private:
         float radius;
         glm::vec3 centerPosition;
 
-        bool static solveQuadratic(const float &a, const float &b, const float &c, float &x0, float &x1);
+        /// One minus the cosine of the half angle of the cone the sphere fills from a point at the
+        /// squared distance from its center, which has to be outside of it
+        float getOneMinusCosThetaMax(float distance2) const;
 
         /// Calculates the area of the object
         void calculateArea();
+
+        /// Calculates the bounding box of the object
+        void calculateBoundingBox();
     };
 
     /**********************************/
@@ -80,36 +117,114 @@ namespace rayTracer {
     {
     public:
         VertexObject(std::vector<glm::vec3> &inVertices, std::vector<glm::ivec3> &inTriangleIndices,
-                     MaterialPtr material);
+                     int materialIndex, const MaterialProperties& material);
 
-        /// Checks if the given ray intersects the current object
-        bool intersect(std::shared_ptr<Ray> currentRay) override;
+        /// Takes over the vertices and triangles instead of copying them
+        VertexObject(std::vector<glm::vec3> &&inVertices, std::vector<glm::ivec3> &&inTriangleIndices,
+                     int materialIndex, const MaterialProperties& material);
 
-        /// Returns a random point on the object where the surface normal
-        /// is within 90 degrees of the negative rays direction (the naive
-        /// way of checking if the point is visible from that direction)
-        glm::vec3 getRandomPointOnObject( std::shared_ptr<Ray> ray,
-                                          std::mt19937* randGenerator,
-                                          std::uniform_real_distribution<float>* randDistribution) const override;
+        /// Adds the triangles of the object to the store
+        void addToGeometryStore(GeometryStore& geometryStore, int objectIndex) const override;
+
+        /// Frees the triangles unless the object is a light source, the store holds them
+        void releaseGeometry() override;
+
+        /// Returns a random point on the object, uniformly distributed over the area of a light source
+        SurfacePoint getRandomPointOnObject(const Ray& ray, RandomSampler& sampler) const override;
 
         /// Factory functions to create specific vertex objects
-        static std::shared_ptr<VertexObject> createBox(glm::mat4x4 transform, MaterialPtr material);
+        static std::shared_ptr<VertexObject> createBox(glm::mat4x4 transform,
+                                                       int materialIndex, const MaterialProperties& material);
         static std::shared_ptr<VertexObject> createPlane(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3,
-                                                         MaterialPtr material);
+                                                         int materialIndex, const MaterialProperties& material);
+
+        /// Loads a .obj or .ply mesh and transforms its vertices. Returns nullptr if it can't be loaded.
+        static std::shared_ptr<VertexObject> createFromFile(const std::string& path, glm::mat4x4 transform,
+                                                            int materialIndex, const MaterialProperties& material);
+
+        /// The triangles, only kept by light sources once they have been released
+        const std::vector<glm::vec3>& getVertices() const { return vertices; }
+        const std::vector<glm::ivec3>& getTriangleIndices() const { return triangleIndices; }
 
     private:
         std::vector<glm::vec3> vertices;
         std::vector<glm::ivec3> triangleIndices;
-        std::vector<glm::vec3> triangleNormals;
+        AliasTable triangleSelection; // by area, only for light sources
 
         /// Calculates the normal of a triangle
-        glm::vec3 calculateTriangleNormal(int index);
+        glm::vec3 calculateTriangleNormal(int index) const;
 
-        /// Finding intersection point on a triangle using The Möller–Trumbore ray-triangle intersection algorithm
-        bool intersectTriangle(std::shared_ptr<Ray> currentRay, int triangleIndex);
+        /// Calculates the area of the object, and for a light source the table to pick its triangles with
+        void calculateArea(const MaterialProperties& material);
 
-        /// Calculates the area of the object
-        void calculateArea();
+        /// Calculates the bounding box of the object
+        void calculateBoundingBox();
+    };
+
+    /**********************************/
+    /***         SharedMesh         ***/
+    /**********************************/
+
+    /// Triangles in object space that any number of mesh instances share. They are compiled into
+    /// a geometry store of their own once, when the mesh is created, which the instances refer to.
+    class SharedMesh
+    {
+    public:
+        SharedMesh(std::vector<glm::vec3> &&inVertices, std::vector<glm::ivec3> &&inTriangleIndices);
+
+        /// Factory functions, a box from -0.5 to 0.5 along every axis like VertexObject::createBox
+        /// before its transform and a .obj or .ply mesh, nullptr if it can't be loaded
+        static std::shared_ptr<SharedMesh> createBox();
+        static std::shared_ptr<SharedMesh> createFromFile(const std::string& path);
+
+        const GeometryStore& getGeometry() const { return geometry; }
+
+        const std::vector<glm::vec3>& getVertices() const { return vertices; }
+        const std::vector<glm::ivec3>& getTriangleIndices() const { return triangleIndices; }
+
+        /// Returns the area of the mesh in object space
+        float area() const { return surfaceArea; }
+
+    private:
+        std::vector<glm::vec3> vertices;
+        std::vector<glm::ivec3> triangleIndices;
+        float surfaceArea;
+        GeometryStore geometry;
+    };
+
+    /**********************************/
+    /***  SceneObject MeshInstance  ***/
+    /**********************************/
+
+    /// A shared mesh placed in the scene by a transform and with a material of its own. Holds no
+    /// geometry, only the transform, so a mesh can be repeated many times at little cost.
+    class MeshInstance : public SceneObject
+    {
+    public:
+        MeshInstance(std::shared_ptr<const SharedMesh> inMesh, glm::mat4x4 inTransform,
+                     int materialIndex, const MaterialProperties& material);
+
+        /// Adds the instance to the store, the mesh's triangles stay in the mesh
+        void addToGeometryStore(GeometryStore& geometryStore, int objectIndex) const override;
+
+        /// Returns a random point on the object, see VertexObject
+        SurfacePoint getRandomPointOnObject(const Ray& ray, RandomSampler& sampler) const override;
+
+        const SharedMesh& getMesh() const { return *mesh; }
+        const glm::mat4x4& getTransform() const { return transform; }
+
+    private:
+        std::shared_ptr<const SharedMesh> mesh;
+        glm::mat4x4 transform; // object to world
+        glm::mat3 normalTransform;
+        AliasTable triangleSelection; // by area in the scene, only for light sources
+
+        /// Calculates the area of the object in the scene, and for a light source the table to
+        /// pick its triangles with
+        void calculateArea(const MaterialProperties& material);
+
+        /// Calculates the bounding box of the object
+        void calculateBoundingBox();
     };
 
 } // namespace rayTracer
\ No newline at end of file
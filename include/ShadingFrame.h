@@ -0,0 +1,45 @@
+#pragma once
+#include <cmath>
+#include <glm.hpp>
+
+namespace rayTracer {
+
+    /// An orthonormal frame around a surface normal, in which the BRDFs are evaluated. In local
+    /// coordinates the normal is the z axis, so the cosine of the angle between a direction and
+    /// the normal is its z component.
+    ///
+    /// The tangents are built without branches or trigonometry, after Duff et al. 2017, "Building
+    /// an Orthonormal Basis, Revisited".
+    struct ShadingFrame
+    {
+        ShadingFrame()
+            : tangent(1.0f, 0.0f, 0.0f), bitangent(0.0f, 1.0f, 0.0f), normal(0.0f, 0.0f, 1.0f)
+        { }
+
+        /// The normal has to be of unit length
+        explicit ShadingFrame(glm::vec3 inNormal)
+            : normal(inNormal)
+        {
+            float sign = std::copysign(1.0f, normal.z);
+            float a = -1.0f / (sign + normal.z);
+            float b = normal.x * normal.y * a;
+            tangent = glm::vec3(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+            bitangent = glm::vec3(b, sign + normal.y * normal.y * a, -normal.y);
+        }
+
+        glm::vec3 toLocal(glm::vec3 direction) const
+        {
+            return glm::vec3(glm::dot(direction, tangent), glm::dot(direction, bitangent), glm::dot(direction, normal));
+        }
+
+        glm::vec3 toWorld(glm::vec3 direction) const
+        {
+            return direction.x * tangent + direction.y * bitangent + direction.z * normal;
+        }
+
+        glm::vec3 tangent;
+        glm::vec3 bitangent;
+        glm::vec3 normal;
+    };
+
+} // namespace rayTracer
@@ -0,0 +1,70 @@
+#pragma once
+#include <AlignedAllocator.h>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace rayTracer {
+
+    /// Hands out the tiles of an image to the threads of a parallel region. The tiles are put in
+    /// Morton order and every thread starts out owning a contiguous range of them, so the tiles a
+    /// thread renders lie close together on the image. A thread takes its tiles from the front of
+    /// its own range and when that runs out it steals half of what is left from the back of
+    /// another thread's range. Taking and stealing are single compare and swaps, no locks.
+    class TileScheduler
+    {
+    public:
+        /// The pixels [firstRow, lastRow) x [firstColumn, lastColumn) of the image
+        struct Tile
+        {
+            int firstRow, firstColumn;
+            int lastRow, lastColumn;
+        };
+
+        /// Has no tiles until reset() is called
+        TileScheduler();
+
+        /// Only every numShards'th tile starting at shardIndex is handed out, for renders split over several processes
+        TileScheduler(int pixelWidth, int pixelHeight, int tileSize, int numThreads, int shardIndex = 0, int numShards = 1);
+
+        /// Starts over with the tiles of another image, with the same arguments as the constructor. The storage
+        /// is kept, so once it has been set up for an image no smaller one allocates as long as the number of
+        /// threads stays the same. Called again with the same arguments the tiles aren't laid out and sorted
+        /// again, they are only handed out anew. Must not be called while tiles are being handed out.
+        void reset(int pixelWidth, int pixelHeight, int tileSize, int numThreads, int shardIndex = 0, int numShards = 1);
+
+        /// Gets the next tile for the given thread. Returns false when there are no tiles left anywhere.
+        bool nextTile(int thread, Tile& tile);
+
+        int getNumTiles() const { return int(tiles.size()); }
+
+    private:
+        /// The tiles [begin, end) still to be rendered of one thread, packed in one word so that
+        /// both ends can be updated together. Each range sits on its own cache line.
+        struct alignas(CACHE_LINE_SIZE) WorkRange
+        {
+            std::atomic<std::uint64_t> range;
+        };
+
+        static std::uint64_t packRange(std::uint32_t begin, std::uint32_t end)
+        {
+            return (std::uint64_t(begin) << 32) | end;
+        }
+
+        /// Takes the first tile of the thread's own range
+        bool takeTile(int thread, int& tileIndex);
+
+        /// Moves half of the tiles left in another thread's range to this thread and takes the first of them
+        bool stealTiles(int thread, int& tileIndex);
+
+        /// Gives every thread an equal contiguous range of the tiles
+        void splitTiles();
+
+        std::vector<Tile> tiles;
+        std::vector<std::pair<std::uint32_t, Tile>> orderedTiles; // all the tiles by Morton code, kept for reset()
+        CacheAlignedVector<WorkRange> workRanges; // one per thread
+        int lastArguments[5]; // the image and shard arguments of the last reset(), all zero before the first
+    };
+
+} // namespace rayTracer
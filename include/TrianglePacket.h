@@ -0,0 +1,60 @@
+#pragma once
+#include <glm.hpp>
+#include <vector>
+
+namespace rayTracer {
+
+    /// Up to eight triangles stored as structure of arrays with the first vertex and
+    /// both edges precomputed, so that one ray can be tested against all of them at once
+    /// with the Möller–Trumbore algorithm. Unused lanes hold a degenerate triangle that
+    /// never gets hit.
+    struct alignas(32) TrianglePacket
+    {
+        static const int WIDTH = 8;
+
+        TrianglePacket();
+
+        /// Stores the triangle with the given corners in the given lane
+        void setTriangle(int lane, glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, int triangleIndex);
+
+        float v0[3][WIDTH];
+        float edge1[3][WIDTH];
+        float edge2[3][WIDTH];
+        int triangleIndices[WIDTH]; // index of the triangle in the mesh, -1 for unused lanes
+    };
+
+    namespace TriangleKernel {
+
+        enum class InstructionSet
+        {
+            Scalar,
+            SSE,  // four lanes at a time
+            AVX2  // eight lanes at a time
+        };
+
+        /// The instruction set used for the packet tests, picked the first time this is
+        /// called based on what the CPU supports
+        InstructionSet getInstructionSet();
+
+        /// Forces a specific instruction set (falls back to the best supported one if the
+        /// CPU lacks it). Meshes built afterwards get leaves sized for it.
+        void setInstructionSet(InstructionSet instructionSet);
+
+        /// Number of triangles worth putting in one BVH leaf for the current instruction set
+        int preferredLeafSize();
+
+        /// Tests the ray against 'count' triangles of the packet starting at 'firstLane'. Returns
+        /// the lane of the closest hit with a distance in (EPSILON, tMax), or -1 if there is none,
+        /// in which case t is left untouched. Gives the same result as testing the triangles one
+        /// by one in lane order.
+        int intersect(const TrianglePacket& packet, int firstLane, int count,
+                      glm::vec3 origin, glm::vec3 direction, float tMax, float& t);
+
+        /// Returns true if any of the 'count' triangles starting at 'firstLane' is hit at a
+        /// distance in (EPSILON, tMax). Cheaper than intersect() as no closest hit is searched for.
+        bool occluded(const TrianglePacket& packet, int firstLane, int count,
+                      glm::vec3 origin, glm::vec3 direction, float tMax);
+
+    } // namespace TriangleKernel
+
+} // namespace rayTracer
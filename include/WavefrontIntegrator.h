@@ -0,0 +1,91 @@
+#pragma once
+#include <BVH.h>
+#include <Ray.h>
+#include <Scene.h>
+#include <glm.hpp>
+#include <memory>
+#include <vector>
+
+namespace rayTracer {
+
+    class Camera;
+
+    /// Path tracer that advances a whole batch of paths one bounce at a time instead of following
+    /// each path to its end recursively. Every bounce runs as separate stages over arrays of path
+    /// states: extend (closest hit for every active path), shade (BRDF, Russian roulette and light
+    /// samples), connect (any hit test for all shadow rays of the bounce) and compact (drops the
+    /// terminated paths). Produces the same estimate as Scene::traceRay.
+    class WavefrontIntegrator
+    {
+    public:
+        /// Makes room for batches of up to maxPathsPerBatch paths with the render settings of the scene,
+        /// so that rendering them doesn't allocate. Only a batch whose paths go on for much longer than
+        /// the Russian roulette lets them on average needs more room for its vertices, which is kept.
+        WavefrontIntegrator(const Scene& scene, int maxPathsPerBatch);
+
+        /// Renders the samples [firstSample, firstSample + samplesPerPixel) of the pixels in the rows
+        /// [firstRow, lastRow) of the camera
+        void renderRows(Camera& camera, int firstRow, int lastRow, int firstSample, int samplesPerPixel,
+                        BVH::TraversalStatistics& statistics);
+
+    private:
+        /// What happened at one vertex of a path. The radiance is put together from the end of the path
+        /// back to the camera, the light of the next vertex weighted and added to the light found at
+        /// this one. Those are the sums Scene::shadeIntersection forms on its way back up, so both
+        /// integrators give the same image up to rounding. Only the whole sample is clamped, in resolve().
+        struct PathVertex
+        {
+            glm::vec3 emitted; // light from an emissive surface that was hit
+            glm::vec3 directLight; // light from the shadow rays
+            glm::vec3 weight; // of the light coming back from the next vertex
+            glm::vec3 radiance; // light leaving the vertex along the path, filled in when resolving
+            int nextVertex; // index of the next vertex in the following bounce, -1 if the path ends here
+        };
+
+        /// A shadow ray waiting to be tested together with the path vertex it belongs to
+        struct ShadowRay
+        {
+            Scene::ShadowConnection connection;
+            int vertex;
+        };
+
+        /// Creates the camera rays for every sample of the pixels in the rows
+        void generate(Camera& camera, int firstRow, int lastRow, int firstSample);
+
+        /// Finds the closest intersection of every active path
+        void extend(BVH::TraversalStatistics& statistics);
+
+        /// Evaluates the surfaces that were hit and queues up the next rays and the shadow rays
+        void shade(int bounce);
+
+        /// Tests the queued shadow rays and adds up the light of the unoccluded ones
+        void connect(int bounce, BVH::TraversalStatistics& statistics);
+
+        /// Keeps only the paths that continue and links their vertices to the next bounce
+        void compact(int bounce);
+
+        /// Puts together the radiance of every path from the last bounce back to the camera
+        /// and stores the pixel values
+        void resolve(Camera& camera, int firstRow, int lastRow);
+
+        const Scene& scene;
+        int samplesPerPixel; // of the current batch
+        int shadowRaysPerPath;
+        int numBounces; // bounces traced for the current batch
+
+        // State of the active paths, indexed the same as the vertices of the current bounce
+        std::vector<Ray> rays;
+        std::vector<Ray> nextRays;
+        std::vector<float> pdfs; // the rays were drawn with at a diffuse surface, 0 for camera rays and mirror reflections
+        std::vector<float> nextPdfs;
+        std::vector<RandomSampler> samplers; // each path draws its numbers in the same order as Scene::traceRay
+        std::vector<char> hits;
+        std::vector<char> continues;
+
+        std::vector<PathVertex> vertices; // of all bounces one after the other, the first bounce has one per path
+        std::vector<int> firstVertices; // index of the first vertex of every bounce and one past the last
+        std::vector<ShadowRay> shadowRaySlots; // shadowRaysPerPath for every active path
+        std::vector<ShadowRay> shadowRayQueue; // the slots that hold a shadow ray, without gaps
+    };
+
+} // namespace rayTracer
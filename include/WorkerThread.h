@@ -0,0 +1,44 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace rayTracer {
+
+    /// A thread that runs jobs in the background one at a time, for writing files while the render
+    /// goes on. The thread is kept from one job to the next and waits on a condition variable in
+    /// between, so that handing it a job doesn't create a thread, which allocates.
+    class WorkerThread
+    {
+    public:
+        WorkerThread() = default;
+        WorkerThread(const WorkerThread&) = delete;
+        WorkerThread& operator=(const WorkerThread&) = delete;
+
+        /// Waits for the last job and ends the thread
+        ~WorkerThread();
+
+        /// Starts the thread if it isn't running yet
+        void start();
+
+        /// Waits for the job in progress, if any, and hands the next one to the thread, which has to
+        /// be started. A job that captures no more than two pointers is stored without allocating.
+        void run(std::function<void()> job);
+
+        /// Waits for the job in progress, if any
+        void wait();
+
+    private:
+        /// What the thread does, runs the jobs as they come in until it is told to stop
+        void loop();
+
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable condition; // signalled when a job is handed over, finished or the thread should stop
+        std::function<void()> job;
+        bool hasJob = false;
+        bool stopping = false;
+    };
+
+} // namespace rayTracer
@@ -1,4 +1,8 @@
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <string>
+#include <vector>
 #include <Camera.h>
 #include <RenderSettings.h>
 #include <Scene.h>
@@ -7,7 +11,23 @@ using rayTracer::Camera;
 using rayTracer::RenderSettings;
 using rayTracer::Scene;
 
-int main() {
+/// Optional arguments, the first two split a frame over several processes:
+///   --shard <index> <count>  renders one shard of the frame into a partial result
+///   --merge <count>          combines the partial results of all shards into the image
+///   --output <path>          the image to write, .ppm, .png, .pfm or .exr
+///   --resolution <w> <h>     size of the frame, up to 16384 x 16384
+///   --crop <firstRow> <firstColumn> <lastRow> <lastColumn>
+///                            only renders that window of the frame
+///   --stream                 writes the image while rendering instead of keeping all of it in memory
+///   --mesh <path>            adds a white .obj or .ply mesh to the scene, as it is in the file
+///   --save-cache <path>      saves the compiled scene to a scene cache before rendering it
+///   --load-cache <path>      renders the scene of a scene cache instead of building one
+///   --progressive <passes>   renders passes of one sample per pixel, 0 passes for numSubSamplesPerPixel
+///   --checkpoint-every <passes>
+///                            writes a checkpoint of a progressive render every that many passes
+///   --resume                 continues a progressive render from its last checkpoint
+///   --max-sample-value <v>   clamps every sample to hide fireflies, darkening the image
+int main(int argc, char** argv) {
     std::cout << "~ Everything the light touches ~" << std::endl;
 
     // Create settings to use
@@ -17,8 +37,96 @@ int main() {
     settings.russianRouletteCoefficient = 0.9f;
     settings.outputProgressEveryXPercent = 2;
 
+    int numShardsToMerge = 0;
+    int frameWidth = 1280, frameHeight = 720;
+    int crop[4] = {0, 0, 0, 0};
+    bool useCropWindow = false;
+    std::vector<std::string> meshPaths;
+    std::string saveCachePath, loadCachePath;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!std::strcmp(argv[i], "--shard") && i + 2 < argc)
+        {
+            settings.shardIndex = std::atoi(argv[++i]);
+            settings.numShards = std::atoi(argv[++i]);
+        }
+        else if (!std::strcmp(argv[i], "--merge") && i + 1 < argc)
+        {
+            numShardsToMerge = std::atoi(argv[++i]);
+        }
+        else if (!std::strcmp(argv[i], "--output") && i + 1 < argc)
+        {
+            settings.outputPath = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "--resolution") && i + 2 < argc)
+        {
+            frameWidth = std::atoi(argv[++i]);
+            frameHeight = std::atoi(argv[++i]);
+        }
+        else if (!std::strcmp(argv[i], "--crop") && i + 4 < argc)
+        {
+            for (int& value : crop)
+                value = std::atoi(argv[++i]);
+            useCropWindow = true;
+        }
+        else if (!std::strcmp(argv[i], "--stream"))
+        {
+            settings.useStreamingOutput = true;
+        }
+        else if (!std::strcmp(argv[i], "--mesh") && i + 1 < argc)
+        {
+            meshPaths.push_back(argv[++i]);
+        }
+        else if (!std::strcmp(argv[i], "--save-cache") && i + 1 < argc)
+        {
+            saveCachePath = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "--load-cache") && i + 1 < argc)
+        {
+            loadCachePath = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "--progressive") && i + 1 < argc)
+        {
+            settings.useProgressiveRendering = true;
+            settings.maxPasses = std::atoi(argv[++i]);
+        }
+        else if (!std::strcmp(argv[i], "--checkpoint-every") && i + 1 < argc)
+        {
+            settings.checkpointEveryXPasses = std::atoi(argv[++i]);
+        }
+        else if (!std::strcmp(argv[i], "--resume"))
+        {
+            settings.resumeFromCheckpoint = true;
+        }
+        else if (!std::strcmp(argv[i], "--max-sample-value") && i + 1 < argc)
+        {
+            settings.maxSampleValue = float(std::atof(argv[++i]));
+        }
+    }
+
     // Create scene. The default is a cornell box.
-    std::shared_ptr<Scene> scene = Scene::createDefaultScene();
+    std::shared_ptr<Scene> scene;
+    if (!loadCachePath.empty())
+    {
+        scene = std::make_shared<Scene>();
+        if (!scene->loadCache(loadCachePath))
+            return 1;
+    }
+    else
+    {
+        scene = Scene::createDefaultScene();
+        if (!meshPaths.empty())
+        {
+            int meshMaterial = scene->addMaterial(rayTracer::MaterialProperties::createLambertian(glm::vec3(1.0f)));
+            for (const std::string& meshPath : meshPaths)
+            {
+                if (!scene->addMesh(meshPath, glm::mat4x4(1.0f), meshMaterial))
+                    return 1;
+            }
+        }
+    }
+    if (!saveCachePath.empty() && !scene->saveCache(saveCachePath))
+        return 1;
 
     // Create camera
     std::shared_ptr<Camera> camera = std::make_shared<Camera>(
@@ -26,8 +134,23 @@ int main() {
         glm::vec3(0, 0, 0), // Center (position to look at)
         glm::vec3(0, 1, 0), // Up vector
         glm::pi<float>() / 3.5f, // Field of view in radians
-        Camera::ImageResolution::RESOLUTION_720p,
+        frameWidth,
+        frameHeight,
         "MainCamera");
+    if (useCropWindow)
+        camera->setCropWindow(crop[0], crop[1], crop[2], crop[3]);
+
+    // Put the image together from the shards rendered by other processes
+    if (numShardsToMerge > 0)
+    {
+        std::vector<std::string> partialResultPaths;
+        for (int shard = 0; shard < numShardsToMerge; ++shard)
+            partialResultPaths.push_back(Camera::getPartialResultPath(settings.outputPath, shard, numShardsToMerge));
+        if (!camera->mergePartialResults(partialResultPaths))
+            return 1;
+
+        return camera->generateImage(settings.outputPath, settings.displaySettings) ? 0 : 1;
+    }
 
     // Add camera to the scene
     scene->addCamera(camera);
@@ -0,0 +1,65 @@
+#include <AliasTable.h>
+#include <algorithm>
+
+namespace rayTracer {
+
+    AliasTable::AliasTable(const std::vector<float>& weights)
+        : buckets(weights.size()), probabilities(weights.size())
+    {
+        int numBuckets = int(weights.size());
+        if (numBuckets == 0)
+            return;
+
+        // Summed in double so that many small weights still count
+        double totalWeight = 0.0;
+        for (float weight : weights)
+            totalWeight += weight;
+
+        // The weight of every index as a fraction of one bucket
+        std::vector<double> scaledWeights(numBuckets);
+        for (int index = 0; index < numBuckets; ++index)
+        {
+            double probability = totalWeight > 0.0 ? weights[index] / totalWeight : 1.0 / numBuckets;
+            probabilities[index] = float(probability);
+            scaledWeights[index] = probability * numBuckets;
+        }
+
+        std::vector<int> small, large;
+        for (int index = 0; index < numBuckets; ++index)
+            (scaledWeights[index] < 1.0 ? small : large).push_back(index);
+
+        // Every bucket that is not full is topped up from one that has too much
+        while (!small.empty() && !large.empty())
+        {
+            int lessIndex = small.back();
+            int moreIndex = large.back();
+            small.pop_back();
+
+            buckets[lessIndex].threshold = float(scaledWeights[lessIndex]);
+            buckets[lessIndex].alias = moreIndex;
+
+            scaledWeights[moreIndex] -= 1.0 - scaledWeights[lessIndex];
+            if (scaledWeights[moreIndex] < 1.0)
+            {
+                large.pop_back();
+                small.push_back(moreIndex);
+            }
+        }
+
+        // What is left is full up to rounding
+        for (int index : small)
+            buckets[index] = Bucket{1.0f, index};
+        for (int index : large)
+            buckets[index] = Bucket{1.0f, index};
+    }
+
+    ///----------------------------------------------
+
+    int AliasTable::sample(float bucketU, float choiceU) const
+    {
+        int index = std::min(int(bucketU * float(buckets.size())), int(buckets.size()) - 1);
+        const Bucket& bucket = buckets[index];
+        return choiceU < bucket.threshold ? index : bucket.alias;
+    }
+
+} // namespace rayTracer
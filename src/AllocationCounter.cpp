@@ -0,0 +1,68 @@
+#include <AllocationCounter.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace rayTracer {
+
+    namespace {
+        std::atomic<long long> numAllocations(0);
+
+        void* allocate(std::size_t size)
+        {
+            numAllocations.fetch_add(1, std::memory_order_relaxed);
+            return std::malloc(size == 0 ? 1 : size);
+        }
+    } // anonymous namespace
+
+    long long AllocationCounter::getNumAllocations()
+    {
+        return numAllocations.load(std::memory_order_relaxed);
+    }
+
+} // namespace rayTracer
+
+/// Replacements of the global allocation functions, every form of new ends up in allocate()
+
+void* operator new(std::size_t size)
+{
+    void* memory = rayTracer::allocate(size);
+    if (!memory)
+        throw std::bad_alloc();
+    return memory;
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return rayTracer::allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return rayTracer::allocate(size);
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, const std::nothrow_t&) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete[](void* memory, const std::nothrow_t&) noexcept
+{
+    std::free(memory);
+}
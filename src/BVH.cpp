@@ -0,0 +1,232 @@
+#include <BVH.h>
+#include <algorithm>
+
+namespace rayTracer {
+
+    namespace {
+        const int NUM_BINS = 16;
+
+        // Relative cost of traversing a node compared to intersecting a primitive
+        const float TRAVERSAL_COST = 1.0f;
+
+        struct Bin
+        {
+            Bin() : count(0) { }
+
+            BoundingBox bounds;
+            int count;
+        };
+    } // anonymous namespace
+
+    void BVH::build(const std::vector<BoundingBox>& primitiveBounds, int maxPrimitivesInLeaf, int inBlockSize)
+    {
+        nodeStorage.clear();
+        primitiveIndexStorage.clear();
+        nodes = ArrayView<Node>();
+        primitiveIndices = ArrayView<int>();
+        maxLeafSize = std::max(1, maxPrimitivesInLeaf);
+        blockSize = std::max(1, inBlockSize);
+        if (blockSize > 1)
+            maxLeafSize = std::min(maxLeafSize, blockSize); // a leaf has to fit in one block
+
+        int numPrimitives = int(primitiveBounds.size());
+        if (numPrimitives == 0)
+            return;
+
+        primitiveIndexStorage.resize(numPrimitives);
+        std::vector<glm::vec3> centroids(numPrimitives);
+        for (int i = 0; i < numPrimitives; ++i)
+        {
+            primitiveIndexStorage[i] = i;
+            centroids[i] = primitiveBounds[i].centroid();
+        }
+
+        nodeStorage.reserve(2 * numPrimitives);
+        nodeStorage.emplace_back();
+        buildRecursive(0, 0, numPrimitives, 0, primitiveBounds, centroids);
+        nodeStorage.shrink_to_fit();
+
+        if (blockSize > 1)
+            packLeavesIntoBlocks();
+
+        nodes = nodeStorage;
+        primitiveIndices = primitiveIndexStorage;
+    }
+
+    ///----------------------------------------------
+
+    void BVH::useExternalData(ArrayView<Node> inNodes, ArrayView<int> primitiveOrder)
+    {
+        std::vector<Node>().swap(nodeStorage);
+        std::vector<int>().swap(primitiveIndexStorage);
+        nodes = inNodes;
+        primitiveIndices = primitiveOrder;
+    }
+
+    ///----------------------------------------------
+
+    void BVH::packLeavesIntoBlocks()
+    {
+        // The leaves cover the primitive order without overlapping, visit them in that order
+        std::vector<int> leaves;
+        for (int i = 0; i < int(nodeStorage.size()); ++i)
+        {
+            if (nodeStorage[i].isLeaf())
+                leaves.push_back(i);
+        }
+        std::sort(leaves.begin(), leaves.end(), [&](int a, int b) {
+            return nodeStorage[a].firstChildOrPrimitive < nodeStorage[b].firstChildOrPrimitive;
+        });
+
+        // Leaves share a block as long as they fit in what is left of it
+        std::vector<int> packedIndices;
+        packedIndices.reserve(primitiveIndexStorage.size() + primitiveIndexStorage.size() / 2);
+        for (int leaf : leaves)
+        {
+            Node& node = nodeStorage[leaf];
+            int usedInBlock = int(packedIndices.size()) % blockSize;
+            if (usedInBlock + node.primitiveCount > blockSize && usedInBlock > 0)
+                packedIndices.resize(packedIndices.size() + blockSize - usedInBlock, -1);
+
+            int packedStart = int(packedIndices.size());
+            packedIndices.insert(packedIndices.end(),
+                                 primitiveIndexStorage.begin() + node.firstChildOrPrimitive,
+                                 primitiveIndexStorage.begin() + node.firstChildOrPrimitive + node.primitiveCount);
+            node.firstChildOrPrimitive = packedStart;
+        }
+        packedIndices.resize(blocksNeeded(int(packedIndices.size())) * blockSize, -1);
+
+        primitiveIndexStorage.swap(packedIndices);
+    }
+
+    ///----------------------------------------------
+
+    void BVH::makeLeaf(int nodeIndex, int begin, int end)
+    {
+        nodeStorage[nodeIndex].firstChildOrPrimitive = begin;
+        nodeStorage[nodeIndex].primitiveCount = end - begin;
+    }
+
+    ///----------------------------------------------
+
+    void BVH::buildRecursive(int nodeIndex, int begin, int end, int depth,
+                             const std::vector<BoundingBox>& primitiveBounds,
+                             const std::vector<glm::vec3>& centroids)
+    {
+        BoundingBox nodeBounds, centroidBounds;
+        for (int i = begin; i < end; ++i)
+        {
+            nodeBounds.expand(primitiveBounds[primitiveIndexStorage[i]]);
+            centroidBounds.expand(centroids[primitiveIndexStorage[i]]);
+        }
+        nodeStorage[nodeIndex].bounds = nodeBounds;
+
+        int count = end - begin;
+        if (count == 1)
+        {
+            makeLeaf(nodeIndex, begin, end);
+            return;
+        }
+
+        // Find the cheapest split according to the SAH by binning the primitive centroids
+        // along each axis and evaluating the cost of splitting in between every bin.
+        glm::vec3 centroidExtent = centroidBounds.extent();
+        float bestCost = std::numeric_limits<float>::max();
+        int bestAxis = -1;
+        int bestSplit = 0;
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (centroidExtent[axis] <= 0.0f)
+                continue;
+
+            Bin bins[NUM_BINS];
+            float binScale = float(NUM_BINS) / centroidExtent[axis];
+            for (int i = begin; i < end; ++i)
+            {
+                int primitive = primitiveIndexStorage[i];
+                int bin = std::min(NUM_BINS - 1, int((centroids[primitive][axis] - centroidBounds.min[axis]) * binScale));
+                bins[bin].count++;
+                bins[bin].bounds.expand(primitiveBounds[primitive]);
+            }
+
+            // Sweep from the right to get the area and count of everything right of each split
+            float rightAreas[NUM_BINS - 1];
+            int rightCounts[NUM_BINS - 1];
+            BoundingBox rightBounds;
+            int rightCount = 0;
+            for (int split = NUM_BINS - 1; split > 0; --split)
+            {
+                rightBounds.expand(bins[split].bounds);
+                rightCount += bins[split].count;
+                rightAreas[split - 1] = rightBounds.surfaceArea();
+                rightCounts[split - 1] = rightCount;
+            }
+
+            BoundingBox leftBounds;
+            int leftCount = 0;
+            for (int split = 0; split < NUM_BINS - 1; ++split)
+            {
+                leftBounds.expand(bins[split].bounds);
+                leftCount += bins[split].count;
+                if (leftCount == 0 || rightCounts[split] == 0)
+                    continue;
+
+                float cost = leftBounds.surfaceArea() * float(blocksNeeded(leftCount))
+                             + rightAreas[split] * float(blocksNeeded(rightCounts[split]));
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = split;
+                }
+            }
+        }
+
+        float nodeArea = nodeBounds.surfaceArea();
+        float leafCost = float(blocksNeeded(count));
+        float splitCost = nodeArea > 0.0f ? TRAVERSAL_COST + bestCost / nodeArea : leafCost;
+
+        int mid = begin;
+        if (bestAxis >= 0 && (splitCost < leafCost || count > maxLeafSize) && depth < MAX_DEPTH)
+        {
+            float binScale = float(NUM_BINS) / centroidExtent[bestAxis];
+            float axisMin = centroidBounds.min[bestAxis];
+            int* first = &primitiveIndexStorage[0];
+            int* middle = std::partition(first + begin, first + end, [&](int primitive) {
+                int bin = std::min(NUM_BINS - 1, int((centroids[primitive][bestAxis] - axisMin) * binScale));
+                return bin <= bestSplit;
+            });
+            mid = int(middle - first);
+        }
+        else if (count > maxLeafSize)
+        {
+            // Either all centroids coincide or the tree is getting too deep, fall back to
+            // splitting at the median along the longest axis to keep leaves small.
+            int axis = 0;
+            glm::vec3 extent = nodeBounds.extent();
+            if (extent.y > extent[axis]) axis = 1;
+            if (extent.z > extent[axis]) axis = 2;
+            mid = (begin + end) / 2;
+            int* first = &primitiveIndexStorage[0];
+            std::nth_element(first + begin, first + mid, first + end,
+                             [&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+        }
+
+        if (mid == begin || mid == end)
+        {
+            makeLeaf(nodeIndex, begin, end);
+            return;
+        }
+
+        int leftIndex = int(nodeStorage.size());
+        nodeStorage.emplace_back();
+        nodeStorage.emplace_back();
+        nodeStorage[nodeIndex].firstChildOrPrimitive = leftIndex;
+        nodeStorage[nodeIndex].primitiveCount = 0;
+
+        buildRecursive(leftIndex, begin, mid, depth + 1, primitiveBounds, centroids);
+        buildRecursive(leftIndex + 1, mid, end, depth + 1, primitiveBounds, centroids);
+    }
+
+} // namespace rayTracer
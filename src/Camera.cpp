@@ -1,101 +1,459 @@
 #include <Camera.h>
 #include <Ray.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <limits>
 
 namespace rayTracer {
 
+    namespace {
+
+        const char PARTIAL_RESULT_MAGIC[8] = {'R', 'T', 'S', 'H', 'A', 'R', 'D', '1'};
+        const char CHECKPOINT_MAGIC[8] = {'R', 'T', 'C', 'K', 'P', 'T', '0', '1'};
+
+        /// What a checkpoint starts with, followed by the sum of all passes and the sum of the even passes
+        struct CheckpointHeader
+        {
+            char magic[8];
+            std::int32_t width, height;
+            std::uint32_t randomSeed;
+            std::int32_t numPasses;
+        };
+
+        static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "the buffers are stored as plain floats");
+
+        /// What a partial result stores per pixel
+        struct PartialPixel
+        {
+            float value[3];
+            std::int32_t sampleCount;
+        };
+
+        glm::ivec2 getResolutionSize(Camera::ImageResolution imageResolution)
+        {
+            switch(imageResolution){
+                case Camera::ImageResolution::RESOLUTION_480p:
+                    return glm::ivec2(640, 480);
+                case Camera::ImageResolution::RESOLUTION_720p:
+                    return glm::ivec2(1280, 720);
+                case Camera::ImageResolution::RESOLUTION_1080p:
+                    return glm::ivec2(1920, 1080);
+                case Camera::ImageResolution::RESOLUTION_4K:
+                    return glm::ivec2(3840, 2160);
+                case Camera::ImageResolution::RESOLUTION_8K:
+                    return glm::ivec2(7680, 4320);
+                case Camera::ImageResolution::RESOLUTION_16K:
+                    return glm::ivec2(15360, 8640);
+                default:
+                    return glm::ivec2(100, 100);
+            }
+        }
+
+    } // anonymous namespace
+
+    const int Camera::MAX_RESOLUTION;
+
     Camera::Camera(glm::vec3 eye,
                    glm::vec3 center,
                    glm::vec3 up,
                    float fov,
                    ImageResolution imageResolution,
                    std::string name)
-                   : name(name), eye (eye), center(center), up(up), fov(fov)
-    {
-        switch(imageResolution){
-            case ImageResolution::RESOLUTION_480p:
-                pixelHeight = 480;
-                pixelWidth = 640;
-                break;
-            case ImageResolution::RESOLUTION_720p:
-                pixelHeight = 720;
-                pixelWidth = 1280;
-                break;
-            case ImageResolution::RESOLUTION_1080p:
-                pixelHeight = 1080;
-                pixelWidth = 1920;
-                break;
-            default:
-                pixelHeight = 100;
-                pixelWidth = 100;
-                break;
-        }
+                   : Camera(eye, center, up, fov, getResolutionSize(imageResolution).x,
+                            getResolutionSize(imageResolution).y, name)
+    { }
 
-        pixels.resize(pixelHeight);
-        for ( int i = 0 ; i < pixelHeight ; i++ )
-            pixels[i].resize(pixelWidth);
+    ///----------------------------------------------
 
+    Camera::Camera(glm::vec3 eye,
+                   glm::vec3 center,
+                   glm::vec3 up,
+                   float fov,
+                   int frameWidth,
+                   int frameHeight,
+                   std::string name)
+                   : name(name), eye (eye), center(center), up(up), fov(fov)
+                   , frameHeight(glm::clamp(frameHeight, 1, MAX_RESOLUTION))
+                   , frameWidth(glm::clamp(frameWidth, 1, MAX_RESOLUTION))
+                   , cropFirstRow(0), cropFirstColumn(0)
+                   , pixelHeight(this->frameHeight), pixelWidth(this->frameWidth)
+                   , numAccumulatedPasses(0)
+    {
         // View and perspective matrices are used in the unProject() function
         glm::mat4 V = glm::lookAt(eye, center, up);
-        float aspect = float(pixelWidth) / (float)pixelHeight;
+        float aspect = float(this->frameWidth) / (float)this->frameHeight;
         glm::mat4 P = glm::perspective(fov, aspect, 0.1f, 100.0f);
         VP_inv = glm::inverse(V * P);
     }
 
     ///----------------------------------------------
 
-    std::shared_ptr<Ray> Camera::createCameraRay(int pixelX, int pixelY, float randomnessX, float randomnessY)
+    void Camera::setCropWindow(int firstRow, int firstColumn, int lastRow, int lastColumn)
+    {
+        cropFirstRow = glm::clamp(firstRow, 0, frameHeight - 1);
+        cropFirstColumn = glm::clamp(firstColumn, 0, frameWidth - 1);
+        pixelHeight = glm::clamp(lastRow, cropFirstRow + 1, frameHeight) - cropFirstRow;
+        pixelWidth = glm::clamp(lastColumn, cropFirstColumn + 1, frameWidth) - cropFirstColumn;
+
+        std::vector<glm::vec3>().swap(pixels);
+        std::vector<int>().swap(sampleCounts);
+        std::vector<glm::vec3>().swap(accumulatedPixels);
+        std::vector<glm::vec3>().swap(evenPassPixels);
+        numAccumulatedPasses = 0;
+    }
+
+    ///----------------------------------------------
+
+    Ray Camera::createCameraRay(int pixelX, int pixelY, float randomnessX, float randomnessY)
     {
+        // From the image to the frame, y goes up from the bottom
+        float frameX = float(cropFirstColumn + pixelX) + randomnessX;
+        float frameY = float(frameHeight - cropFirstRow - pixelHeight + pixelY) + randomnessY;
+
         glm::vec4 from4 = VP_inv *
-            glm::vec4((((float)pixelX + randomnessX) / (float)pixelWidth - 0.5) * 2,
-                (((float)pixelY + randomnessY) / (float)pixelHeight - 0.5) * 2,
+            glm::vec4((frameX / (float)frameWidth - 0.5) * 2,
+                (frameY / (float)frameHeight - 0.5) * 2,
                 1, 1);
 
         glm::vec4 to4 = VP_inv *
-            glm::vec4((((float)pixelX + randomnessX) / (float)pixelWidth - 0.5) * 2,
-                (((float)pixelY + randomnessY) / (float)pixelHeight - 0.5) * 2,
+            glm::vec4((frameX / (float)frameWidth - 0.5) * 2,
+                (frameY / (float)frameHeight - 0.5) * 2,
                 -1, 1);
 
         glm::vec3 from = glm::vec3(from4) * from4.w;
         glm::vec3 to = glm::vec3(to4) * to4.w;
 
         glm::vec3 direction = glm::normalize(to - from);
-        return std::make_shared<Ray>(eye, direction);
+        return Ray(eye, direction);
+    }
+
+    ///----------------------------------------------
+
+    std::uint32_t Camera::getFramePixelIndex(int x, int y) const
+    {
+        return std::uint32_t(cropFirstRow + x) * std::uint32_t(frameWidth) + std::uint32_t(cropFirstColumn + y);
     }
 
     ///----------------------------------------------
 
     void Camera::setPixelValue(int x, int y, glm::vec3 pixelValue)
     {
-        if (x < 0 || x >= pixelHeight || y < 0 || y >= pixelWidth)
+        if (x < 0 || x >= pixelHeight || y < 0 || y >= pixelWidth || pixels.empty())
             return;
 
-        pixels[x][y] = pixelValue;
+        pixels[x * pixelWidth + y] = pixelValue;
     }
 
     ///----------------------------------------------
 
-    void Camera::generateImage() {
-        FILE* f;
-        fopen_s(&f, "../renderedImage.ppm", "wb");
-        
-        if (!f)
-        {
-            std::cout << "Can't open file, closing down.." << std::endl;
+    void Camera::setPixelSampleCount(int x, int y, int sampleCount)
+    {
+        if (x < 0 || x >= pixelHeight || y < 0 || y >= pixelWidth || sampleCounts.empty())
             return;
+
+        sampleCounts[x * pixelWidth + y] = sampleCount;
+    }
+
+    ///----------------------------------------------
+
+    int Camera::getPixelSampleCount(int x, int y) const
+    {
+        if (sampleCounts.empty())
+            return 0;
+        return sampleCounts[x * pixelWidth + y];
+    }
+
+    ///----------------------------------------------
+
+    void Camera::clearPixels()
+    {
+        allocatePixels();
+        std::fill(pixels.begin(), pixels.end(), glm::vec3(0.0f));
+        std::fill(sampleCounts.begin(), sampleCounts.end(), 0);
+    }
+
+    ///----------------------------------------------
+
+    void Camera::allocatePixels()
+    {
+        pixels.resize(std::size_t(pixelHeight) * pixelWidth);
+        sampleCounts.resize(std::size_t(pixelHeight) * pixelWidth);
+    }
+
+    ///----------------------------------------------
+
+    std::string Camera::getPartialResultPath(const std::string& imagePath, int shardIndex, int numShards)
+    {
+        return ImageWriter::replaceExtension(imagePath, ".shard" + std::to_string(shardIndex) + "of"
+                + std::to_string(numShards) + ".partial");
+    }
+
+    ///----------------------------------------------
+
+    bool Camera::writePartialResult(const std::string& path) const
+    {
+        std::ofstream file(path, std::ios::binary);
+        if (!file)
+        {
+            std::cout << "Can't open " << path << " for writing the partial result" << std::endl;
+            return false;
+        }
+
+        std::vector<PartialPixel> partialPixels(pixels.size());
+        for (std::size_t index = 0; index < pixels.size(); index++) {
+            PartialPixel& partialPixel = partialPixels[index];
+            partialPixel.value[0] = pixels[index].r;
+            partialPixel.value[1] = pixels[index].g;
+            partialPixel.value[2] = pixels[index].b;
+            partialPixel.sampleCount = sampleCounts[index];
         }
 
-        fprintf(f, "P6\n%i %i 255\n", pixelWidth, pixelHeight);
+        std::int32_t size[2] = {pixelWidth, pixelHeight};
+        file.write(PARTIAL_RESULT_MAGIC, sizeof(PARTIAL_RESULT_MAGIC));
+        file.write(reinterpret_cast<const char*>(size), sizeof(size));
+        file.write(reinterpret_cast<const char*>(partialPixels.data()), partialPixels.size() * sizeof(PartialPixel));
+        file.close();
+        bool written = bool(file);
+
+        if (!written)
+            std::cout << "Failed to write the partial result to " << path << std::endl;
+        return written;
+    }
 
+    ///----------------------------------------------
+
+    bool Camera::mergePartialResults(const std::vector<std::string>& paths)
+    {
+        clearPixels();
+
+        std::vector<PartialPixel> partialPixels(pixels.size());
+        for (const std::string& path : paths)
+        {
+            std::ifstream file(path, std::ios::binary);
+            if (!file)
+            {
+                std::cout << "Can't open the partial result " << path << std::endl;
+                return false;
+            }
+
+            char magic[sizeof(PARTIAL_RESULT_MAGIC)];
+            std::int32_t size[2];
+            bool read = file.read(magic, sizeof(magic))
+                    && std::memcmp(magic, PARTIAL_RESULT_MAGIC, sizeof(magic)) == 0
+                    && file.read(reinterpret_cast<char*>(size), sizeof(size))
+                    && size[0] == pixelWidth && size[1] == pixelHeight
+                    && file.read(reinterpret_cast<char*>(partialPixels.data()), partialPixels.size() * sizeof(PartialPixel));
+
+            if (!read)
+            {
+                std::cout << path << " is not a partial result of a " << pixelWidth << "x" << pixelHeight
+                          << " image" << std::endl;
+                return false;
+            }
+
+            for (int i = 0; i < pixelHeight; i++) {
+                for (int j = 0; j < pixelWidth; j++) {
+                    const PartialPixel& partialPixel = partialPixels[i * pixelWidth + j];
+                    int& sampleCount = sampleCounts[i * pixelWidth + j];
+                    if (partialPixel.sampleCount <= 0)
+                        continue;
+
+                    // A pixel rendered by a single shard keeps its value exactly
+                    glm::vec3 value = glm::vec3(partialPixel.value[0], partialPixel.value[1], partialPixel.value[2]);
+                    glm::vec3& pixel = pixels[i * pixelWidth + j];
+                    if (sampleCount == 0)
+                        pixel = value;
+                    else
+                        pixel = glm::vec3((glm::dvec3(pixel) * double(sampleCount)
+                                + glm::dvec3(value) * double(partialPixel.sampleCount))
+                                / double(sampleCount + partialPixel.sampleCount));
+                    sampleCount += partialPixel.sampleCount;
+                }
+            }
+        }
+        return true;
+    }
+
+    ///----------------------------------------------
+
+    bool Camera::generateImage(const std::string& path, const ImageWriter::DisplaySettings& displaySettings) const
+    {
+        if (pixels.empty())
+        {
+            std::cout << "Nothing has been rendered to write to " << path << std::endl;
+            return false;
+        }
+
+        std::vector<const glm::vec3*> rows(pixelHeight);
+        for (int i = 0; i < pixelHeight; i++)
+            rows[i] = &pixels[i * pixelWidth];
+
+        return ImageWriter::writeImage(path, rows.data(), pixelWidth, pixelHeight, displaySettings);
+    }
+
+    ///----------------------------------------------
+
+    std::string Camera::getSampleCountImagePath(const std::string& imagePath)
+    {
+        return ImageWriter::replaceExtension(imagePath, ".sampleCounts.ppm");
+    }
+
+    ///----------------------------------------------
+
+    bool Camera::generateSampleCountImage(const std::string& path) const
+    {
+        if (sampleCounts.empty())
+            return false;
+
+        int maxSampleCount = 1;
+        for (int sampleCount : sampleCounts)
+            maxSampleCount = glm::max(maxSampleCount, sampleCount);
+
+        std::vector<glm::vec3> heatmap(sampleCounts.size());
+        std::vector<const glm::vec3*> rows(pixelHeight);
         for (int i = 0; i < pixelHeight; i++) {
             for (int j = 0; j < pixelWidth; j++) {
-                glm::vec3 pixel = pixels[i][j] * glm::vec3(255,255,255);
-                fputc((int) (pixel.r), f);
-                fputc((int) (pixel.g), f);
-                fputc((int) (pixel.b), f);
+                float t = 3.0f * float(sampleCounts[i * pixelWidth + j]) / float(maxSampleCount);
+                heatmap[i * pixelWidth + j] = glm::clamp(glm::vec3(t, t - 1.0f, t - 2.0f), 0.0f, 1.0f);
             }
+            rows[i] = &heatmap[i * pixelWidth];
         }
-        fclose(f);
+
+        // The colors are display values already
+        ImageWriter::DisplaySettings displaySettings;
+        displaySettings.useSRGBCurve = false;
+        return ImageWriter::writeImage(path, rows.data(), pixelWidth, pixelHeight, displaySettings);
+    }
+
+    ///----------------------------------------------
+
+    void Camera::clearAccumulation()
+    {
+        allocatePixels();
+        accumulatedPixels.assign(pixels.size(), glm::vec3(0.0f));
+        evenPassPixels.assign(pixels.size(), glm::vec3(0.0f));
+        numAccumulatedPasses = 0;
+    }
+
+    ///----------------------------------------------
+
+    void Camera::accumulatePass()
+    {
+        if (accumulatedPixels.empty())
+            clearAccumulation();
+
+        bool evenPass = numAccumulatedPasses % 2 == 0;
+        ++numAccumulatedPasses;
+        for (std::size_t index = 0; index < pixels.size(); index++) {
+            accumulatedPixels[index] += pixels[index];
+            if (evenPass)
+                evenPassPixels[index] += pixels[index];
+            pixels[index] = accumulatedPixels[index] / float(numAccumulatedPasses);
+        }
+    }
+
+    ///----------------------------------------------
+
+    int Camera::getNumAccumulatedPasses() const
+    {
+        return numAccumulatedPasses;
+    }
+
+    ///----------------------------------------------
+
+    std::string Camera::getCheckpointPath(const std::string& imagePath)
+    {
+        return ImageWriter::replaceExtension(imagePath, ".checkpoint");
+    }
+
+    ///----------------------------------------------
+
+    void Camera::serializeAccumulation(unsigned int randomSeed, std::vector<char>& data) const
+    {
+        CheckpointHeader header;
+        std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+        header.width = pixelWidth;
+        header.height = pixelHeight;
+        header.randomSeed = randomSeed;
+        header.numPasses = numAccumulatedPasses;
+
+        std::size_t bufferSize = accumulatedPixels.size() * sizeof(glm::vec3);
+        data.resize(sizeof(header) + 2 * bufferSize);
+        std::memcpy(data.data(), &header, sizeof(header));
+        if (bufferSize > 0)
+        {
+            std::memcpy(data.data() + sizeof(header), accumulatedPixels.data(), bufferSize);
+            std::memcpy(data.data() + sizeof(header) + bufferSize, evenPassPixels.data(), bufferSize);
+        }
+    }
+
+    ///----------------------------------------------
+
+    bool Camera::loadAccumulation(const std::string& path, unsigned int randomSeed)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            std::cout << "No checkpoint to resume from at " << path << std::endl;
+            return false;
+        }
+
+        clearAccumulation();
+        CheckpointHeader header;
+        std::size_t bufferSize = accumulatedPixels.size() * sizeof(glm::vec3);
+        bool read = file.read(reinterpret_cast<char*>(&header), sizeof(header))
+                && std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) == 0
+                && header.width == pixelWidth && header.height == pixelHeight
+                && header.randomSeed == randomSeed && header.numPasses >= 0
+                && file.read(reinterpret_cast<char*>(accumulatedPixels.data()), bufferSize)
+                && file.read(reinterpret_cast<char*>(evenPassPixels.data()), bufferSize);
+
+        if (!read)
+        {
+            std::cout << path << " is not a checkpoint of a " << pixelWidth << "x" << pixelHeight
+                      << " render with seed " << randomSeed << std::endl;
+            clearAccumulation();
+            return false;
+        }
+
+        numAccumulatedPasses = header.numPasses;
+        for (std::size_t index = 0; index < pixels.size(); index++)
+            pixels[index] = accumulatedPixels[index] / float(glm::max(numAccumulatedPasses, 1));
+        return true;
+    }
+
+    ///----------------------------------------------
+
+    float Camera::estimateRelativeError() const
+    {
+        int numEvenPasses = (numAccumulatedPasses + 1) / 2;
+        int numOddPasses = numAccumulatedPasses / 2;
+        if (numOddPasses == 0)
+            return std::numeric_limits<float>::infinity();
+
+        double sumSquaredDifference = 0.0;
+        double sum = 0.0;
+        for (int index = 0; index < int(accumulatedPixels.size()); ++index) {
+            glm::vec3 evenAverage = evenPassPixels[index] / float(numEvenPasses);
+            glm::vec3 oddAverage = (accumulatedPixels[index] - evenPassPixels[index]) / float(numOddPasses);
+            glm::vec3 difference = evenAverage - oddAverage;
+            sumSquaredDifference += glm::dot(difference, difference);
+            sum += accumulatedPixels[index].r + accumulatedPixels[index].g + accumulatedPixels[index].b;
+        }
+
+        // The two halves are independent estimates, the variance of their difference scaled by
+        // numEven * numOdd / num^2 is the variance of the average of all passes
+        double numValues = 3.0 * double(accumulatedPixels.size());
+        double mean = sum / (numValues * numAccumulatedPasses);
+        if (mean <= 0.0)
+            return 0.0f;
+
+        double rmsDifference = std::sqrt(sumSquaredDifference / numValues);
+        double rmsError = rmsDifference * std::sqrt(double(numEvenPasses) * numOddPasses) / numAccumulatedPasses;
+        return float(rmsError / mean);
     }
 
     ///----------------------------------------------
@@ -0,0 +1,77 @@
+#include <CheckpointWriter.h>
+#include <cstdio>
+#include <iostream>
+
+namespace rayTracer {
+
+    namespace {
+
+        /// Uses the C functions as opening a file stream allocates its buffer
+        void writeFile(const std::string& path, const std::string& temporaryPath, const std::vector<char>& data)
+        {
+            std::FILE* file = std::fopen(temporaryPath.c_str(), "wb");
+            if (!file)
+            {
+                std::cout << "Can't open " << temporaryPath << " for writing the checkpoint" << std::endl;
+                return;
+            }
+
+            bool written = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+            written = std::fclose(file) == 0 && written;
+            if (!written)
+            {
+                std::cout << "Failed to write the checkpoint to " << temporaryPath << std::endl;
+                return;
+            }
+
+            // Replacing an existing file with rename isn't allowed everywhere
+            if (std::rename(temporaryPath.c_str(), path.c_str()) != 0)
+            {
+                std::remove(path.c_str());
+                if (std::rename(temporaryPath.c_str(), path.c_str()) != 0)
+                    std::cout << "Failed to replace the checkpoint " << path << std::endl;
+            }
+        }
+
+    } // anonymous namespace
+
+    CheckpointWriter::CheckpointWriter(WorkerThread& thread)
+    : writerThread(thread)
+    { }
+
+    ///----------------------------------------------
+
+    CheckpointWriter::~CheckpointWriter()
+    {
+        wait();
+    }
+
+    ///----------------------------------------------
+
+    void CheckpointWriter::prepare(const std::string& checkpointPath, std::size_t dataSize)
+    {
+        wait();
+
+        path = checkpointPath;
+        temporaryPath = checkpointPath + ".tmp";
+        buffer.reserve(dataSize);
+    }
+
+    ///----------------------------------------------
+
+    void CheckpointWriter::write(std::vector<char>& data)
+    {
+        wait();
+
+        buffer.swap(data);
+        writerThread.run([this]() { writeFile(path, temporaryPath, buffer); });
+    }
+
+    ///----------------------------------------------
+
+    void CheckpointWriter::wait()
+    {
+        writerThread.wait();
+    }
+
+} // namespace rayTracer
@@ -0,0 +1,572 @@
+#include <GeometryStore.h>
+#include <Ray.h>
+#include <algorithm>
+#include <limits>
+
+namespace rayTracer {
+
+    namespace {
+        const float EPSILON = 1e-6f;
+
+        // Padding added to bounding boxes so that flat triangles still have a volume
+        const float BOUNDING_BOX_PADDING = 1e-4f;
+
+        const int SPHERES_PER_LEAF = 4;
+        const int INSTANCES_PER_LEAF = 2;
+
+        bool solveQuadratic(const float &a, const float &b, const float &c, float &x0, float &x1)
+        {
+            float discriminant = b * b - 4.0f * a * c;
+            if (discriminant < 0) return false;
+            else if (glm::abs(discriminant) < EPSILON) x0 = x1 = -0.5f * b / a;
+            else {
+                float q = (b > 0) ?
+                          -0.5f * (b + glm::sqrt(discriminant)) :
+                          -0.5f * (b - glm::sqrt(discriminant));
+                x0 = q / a;
+                x1 = c / q;
+            }
+            if (x0 > x1) std::swap(x0, x1);
+
+            return true;
+        }
+
+        /// Finds the distance to the closest point in front of the origin where the ray hits the sphere
+        bool intersectSphere(const GeometryStore::SphereRecord& sphere, glm::vec3 origin, glm::vec3 direction,
+                             float& distance)
+        {
+            glm::vec3 dirRayOriginToCenter = origin - sphere.center; //L
+            float a = glm::dot(direction, direction);
+            float b = 2.f * glm::dot(direction, dirRayOriginToCenter);
+            float c = glm::dot(dirRayOriginToCenter, dirRayOriginToCenter) - sphere.radius * sphere.radius;
+
+            float d0, d1;
+            if (!solveQuadratic(a, b, c, d0, d1)) return false;
+
+            if (d0 < 0) {
+                d0 = d1;
+                if (d0 < 0) return false;
+            }
+
+            distance = d0;
+            return true;
+        }
+    } // anonymous namespace
+
+    void GeometryStore::clear()
+    {
+        stagedTriangleVertices.clear();
+        stagedTriangleInfos.clear();
+        stagedInstanceTransforms.clear();
+        numTriangles = 0;
+        triangleBVH = BVH();
+        trianglePacketStorage.clear();
+        triangleInfoStorage.clear();
+        trianglePackets = ArrayView<TrianglePacket>();
+        triangleInfos = ArrayView<TriangleInfo>();
+        sphereBVH = BVH();
+        sphereStorage.clear();
+        spheres = ArrayView<SphereRecord>();
+        instanceBVH = BVH();
+        instanceStorage.clear();
+        meshStorage.clear();
+        instances = ArrayView<InstanceRecord>();
+        meshes = ArrayView<const GeometryStore*>();
+    }
+
+    ///----------------------------------------------
+
+    void GeometryStore::addTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, glm::vec3 normal,
+                                    int objectIndex, int materialIndex)
+    {
+        stagedTriangleVertices.push_back(v0);
+        stagedTriangleVertices.push_back(v1);
+        stagedTriangleVertices.push_back(v2);
+
+        TriangleInfo info;
+        info.normal = normal;
+        info.objectIndex = objectIndex;
+        info.materialIndex = materialIndex;
+        stagedTriangleInfos.push_back(info);
+    }
+
+    ///----------------------------------------------
+
+    void GeometryStore::addSphere(glm::vec3 center, float radius, int objectIndex, int materialIndex)
+    {
+        SphereRecord sphere;
+        sphere.center = center;
+        sphere.radius = radius;
+        sphere.objectIndex = objectIndex;
+        sphere.materialIndex = materialIndex;
+        sphere.padding[0] = sphere.padding[1] = 0;
+        sphereStorage.push_back(sphere);
+    }
+
+    ///----------------------------------------------
+
+    void GeometryStore::addInstance(const GeometryStore& mesh, const glm::mat4x4& objectToWorld, int objectIndex,
+                                    int materialIndex)
+    {
+        // Usually the instances of a mesh are added one after the other
+        int meshIndex = int(meshStorage.size()) - 1;
+        if (meshIndex < 0 || meshStorage[meshIndex] != &mesh)
+        {
+            meshIndex = int(std::find(meshStorage.begin(), meshStorage.end(), &mesh) - meshStorage.begin());
+            if (meshIndex == int(meshStorage.size()))
+                meshStorage.push_back(&mesh);
+        }
+
+        InstanceRecord instance;
+        instance.worldToObject = glm::mat4x3(glm::inverse(objectToWorld));
+        instance.meshIndex = meshIndex;
+        instance.objectIndex = objectIndex;
+        instance.materialIndex = materialIndex;
+        instance.padding = 0;
+        instanceStorage.push_back(instance);
+        stagedInstanceTransforms.push_back(objectToWorld);
+    }
+
+    ///----------------------------------------------
+
+    void GeometryStore::build()
+    {
+        // Triangles, the leaves are placed so that each one fits in a single triangle packet
+        numTriangles = int(stagedTriangleInfos.size());
+        std::vector<BoundingBox> triangleBounds(numTriangles);
+        for (int triangle = 0; triangle < numTriangles; ++triangle)
+        {
+            triangleBounds[triangle].expand(stagedTriangleVertices[3 * triangle]);
+            triangleBounds[triangle].expand(stagedTriangleVertices[3 * triangle + 1]);
+            triangleBounds[triangle].expand(stagedTriangleVertices[3 * triangle + 2]);
+            triangleBounds[triangle].pad(BOUNDING_BOX_PADDING);
+        }
+
+        int leafSize = TriangleKernel::preferredLeafSize();
+        triangleBVH.build(triangleBounds, leafSize, leafSize);
+
+        ArrayView<int> triangleOrder = triangleBVH.getPrimitiveOrder();
+        int numPackets = int((triangleOrder.size() + TrianglePacket::WIDTH - 1) / TrianglePacket::WIDTH);
+        trianglePacketStorage.assign(numPackets, TrianglePacket());
+
+        TriangleInfo unusedLane;
+        unusedLane.normal = glm::vec3(0.0f);
+        unusedLane.objectIndex = unusedLane.materialIndex = -1;
+        triangleInfoStorage.assign(numPackets * TrianglePacket::WIDTH, unusedLane);
+
+        for (int position = 0; position < int(triangleOrder.size()); ++position)
+        {
+            int triangle = triangleOrder[position];
+            if (triangle < 0)
+                continue;
+
+            trianglePacketStorage[position / TrianglePacket::WIDTH].setTriangle(
+                    position % TrianglePacket::WIDTH,
+                    stagedTriangleVertices[3 * triangle],
+                    stagedTriangleVertices[3 * triangle + 1],
+                    stagedTriangleVertices[3 * triangle + 2],
+                    triangle);
+            triangleInfoStorage[position] = stagedTriangleInfos[triangle];
+        }
+
+        // The packets hold everything from now on
+        std::vector<glm::vec3>().swap(stagedTriangleVertices);
+        std::vector<TriangleInfo>().swap(stagedTriangleInfos);
+
+        // Spheres, reordered so that the leaves refer to contiguous ranges of the buffer
+        std::vector<BoundingBox> sphereBounds(sphereStorage.size());
+        for (int sphere = 0; sphere < int(sphereStorage.size()); ++sphere)
+        {
+            sphereBounds[sphere] = BoundingBox(sphereStorage[sphere].center - glm::vec3(sphereStorage[sphere].radius),
+                                               sphereStorage[sphere].center + glm::vec3(sphereStorage[sphere].radius));
+            sphereBounds[sphere].pad(BOUNDING_BOX_PADDING);
+        }
+        sphereBVH.build(sphereBounds, SPHERES_PER_LEAF);
+
+        CacheAlignedVector<SphereRecord> orderedSpheres;
+        orderedSpheres.reserve(sphereStorage.size());
+        for (int sphere : sphereBVH.getPrimitiveOrder())
+            orderedSpheres.push_back(sphereStorage[sphere]);
+        sphereStorage.swap(orderedSpheres);
+
+        // Instances, bounded by the corners of their mesh's bounds moved into the scene
+        std::vector<BoundingBox> instanceBounds(instanceStorage.size());
+        for (int instance = 0; instance < int(instanceStorage.size()); ++instance)
+        {
+            BoundingBox meshBounds = meshStorage[instanceStorage[instance].meshIndex]->getBounds();
+            for (int corner = 0; corner < 8; ++corner)
+            {
+                glm::vec3 point((corner & 1) ? meshBounds.max.x : meshBounds.min.x,
+                                (corner & 2) ? meshBounds.max.y : meshBounds.min.y,
+                                (corner & 4) ? meshBounds.max.z : meshBounds.min.z);
+                instanceBounds[instance].expand(glm::vec3(stagedInstanceTransforms[instance] * glm::vec4(point, 1.0f)));
+            }
+            instanceBounds[instance].pad(BOUNDING_BOX_PADDING);
+        }
+        instanceBVH.build(instanceBounds, INSTANCES_PER_LEAF);
+        std::vector<glm::mat4x4>().swap(stagedInstanceTransforms);
+
+        CacheAlignedVector<InstanceRecord> orderedInstances;
+        orderedInstances.reserve(instanceStorage.size());
+        for (int instance : instanceBVH.getPrimitiveOrder())
+            orderedInstances.push_back(instanceStorage[instance]);
+        instanceStorage.swap(orderedInstances);
+
+        trianglePackets = trianglePacketStorage;
+        triangleInfos = triangleInfoStorage;
+        spheres = sphereStorage;
+        instances = instanceStorage;
+        meshes = meshStorage;
+    }
+
+    ///----------------------------------------------
+
+    GeometryStore::CompiledData GeometryStore::getCompiledData() const
+    {
+        CompiledData data;
+        data.numTriangles = numTriangles;
+        data.triangleNodes = triangleBVH.getNodes();
+        data.triangleOrder = triangleBVH.getPrimitiveOrder();
+        data.trianglePackets = trianglePackets;
+        data.triangleInfos = triangleInfos;
+        data.sphereNodes = sphereBVH.getNodes();
+        data.sphereOrder = sphereBVH.getPrimitiveOrder();
+        data.spheres = spheres;
+        data.instanceNodes = instanceBVH.getNodes();
+        data.instanceOrder = instanceBVH.getPrimitiveOrder();
+        data.instances = instances;
+        data.meshes = meshes;
+        return data;
+    }
+
+    ///----------------------------------------------
+
+    void GeometryStore::useCompiledData(const CompiledData& data)
+    {
+        clear();
+        numTriangles = data.numTriangles;
+        triangleBVH.useExternalData(data.triangleNodes, data.triangleOrder);
+        trianglePackets = data.trianglePackets;
+        triangleInfos = data.triangleInfos;
+        sphereBVH.useExternalData(data.sphereNodes, data.sphereOrder);
+        spheres = data.spheres;
+        instanceBVH.useExternalData(data.instanceNodes, data.instanceOrder);
+        instances = data.instances;
+        meshStorage.assign(data.meshes.begin(), data.meshes.end());
+        meshes = meshStorage;
+    }
+
+    ///----------------------------------------------
+
+    BoundingBox GeometryStore::getBounds() const
+    {
+        BoundingBox bounds = triangleBVH.getBounds();
+        bounds.expand(sphereBVH.getBounds());
+        return bounds;
+    }
+
+    ///----------------------------------------------
+
+    bool GeometryStore::intersectTriangles(glm::vec3 origin, glm::vec3 direction, float& tMax, int& closestTriangle,
+                                           bool useAccelerationStructure, BVH::TraversalStatistics& statistics) const
+    {
+        // Every leaf of the triangle BVH is stored in (part of) one triangle packet
+        auto intersectLeaf = [&](int firstTriangle, int triangleCount, float& leafTMax) {
+            int firstLane = firstTriangle % TrianglePacket::WIDTH;
+            int lane = TriangleKernel::intersect(trianglePackets[firstTriangle / TrianglePacket::WIDTH], firstLane,
+                                                 triangleCount, origin, direction, leafTMax, leafTMax);
+            if (lane < 0)
+                return false;
+            closestTriangle = firstTriangle - firstLane + lane;
+            tMax = leafTMax;
+            return true;
+        };
+
+        if (useAccelerationStructure)
+            return triangleBVH.intersectLeaves(origin, direction, tMax, intersectLeaf, statistics);
+
+        statistics.numPrimitivesTested += numTriangles;
+        bool hit = false;
+        for (int packet = 0; packet < int(trianglePackets.size()); ++packet)
+        {
+            if (intersectLeaf(packet * TrianglePacket::WIDTH, TrianglePacket::WIDTH, tMax))
+                hit = true;
+        }
+        return hit;
+    }
+
+    ///----------------------------------------------
+
+    bool GeometryStore::occludedByTriangles(glm::vec3 origin, glm::vec3 direction, float tMax,
+                                            bool useAccelerationStructure, BVH::TraversalStatistics& statistics) const
+    {
+        auto occludedLeaf = [&](int firstTriangle, int triangleCount) {
+            return TriangleKernel::occluded(trianglePackets[firstTriangle / TrianglePacket::WIDTH],
+                                            firstTriangle % TrianglePacket::WIDTH, triangleCount,
+                                            origin, direction, tMax);
+        };
+
+        if (useAccelerationStructure)
+            return triangleBVH.occludedLeaves(origin, direction, tMax, occludedLeaf, statistics);
+
+        statistics.numPrimitivesTested += numTriangles;
+        for (int packet = 0; packet < int(trianglePackets.size()); ++packet)
+        {
+            if (occludedLeaf(packet * TrianglePacket::WIDTH, TrianglePacket::WIDTH))
+                return true;
+        }
+        return false;
+    }
+
+    ///----------------------------------------------
+
+    bool GeometryStore::intersectInstances(int firstInstance, int instanceCount, glm::vec3 origin, glm::vec3 direction,
+                                           float& tMax, int& closestInstance, int& closestTriangle,
+                                           bool useAccelerationStructure, BVH::TraversalStatistics& statistics) const
+    {
+        // The direction isn't normalized in object space, so distances along the ray stay the same
+        bool hit = false;
+        for (int instance = firstInstance; instance < firstInstance + instanceCount; ++instance)
+        {
+            const InstanceRecord& record = instances[instance];
+            glm::vec3 objectOrigin = record.worldToObject * glm::vec4(origin, 1.0f);
+            glm::vec3 objectDirection = record.worldToObject * glm::vec4(direction, 0.0f);
+            if (meshes[record.meshIndex]->intersectTriangles(objectOrigin, objectDirection, tMax, closestTriangle,
+                                                             useAccelerationStructure, statistics))
+            {
+                closestInstance = instance;
+                hit = true;
+            }
+        }
+        return hit;
+    }
+
+    ///----------------------------------------------
+
+    glm::vec3 GeometryStore::getInstanceNormal(int instance, int triangle) const
+    {
+        // Normals go through the inverse transpose of the object to world transform
+        const InstanceRecord& record = instances[instance];
+        glm::vec3 normal = meshes[record.meshIndex]->triangleInfos[triangle].normal;
+        return glm::normalize(glm::transpose(glm::mat3(record.worldToObject)) * normal);
+    }
+
+    ///----------------------------------------------
+
+    bool GeometryStore::intersect(Ray& ray, bool useAccelerationStructure, BVH::TraversalStatistics& statistics) const
+    {
+        glm::vec3 origin = ray.getStartPoint();
+        glm::vec3 direction = ray.getDirection();
+
+        // Only look for hits closer than what the ray has already found
+        float closestDistance = std::numeric_limits<float>::max();
+        if (ray.hasIntersection())
+            closestDistance = ray.getIntersection().distanceToRayOrigin;
+
+        // Every kind of primitive is only hit when it's closer than the ones tested before
+        int closestTriangle = -1;
+        int closestSphere = -1;
+        int closestInstance = -1, closestInstanceTriangle = -1;
+
+        intersectTriangles(origin, direction, closestDistance, closestTriangle, useAccelerationStructure, statistics);
+
+        auto intersectSpheres = [&](int firstSphere, int sphereCount, float& tMax) {
+            bool hit = false;
+            for (int sphere = firstSphere; sphere < firstSphere + sphereCount; ++sphere)
+            {
+                float distance;
+                if (intersectSphere(spheres[sphere], origin, direction, distance) && distance < tMax)
+                {
+                    tMax = distance;
+                    closestSphere = sphere;
+                    closestDistance = tMax;
+                    hit = true;
+                }
+            }
+            return hit;
+        };
+
+        auto intersectInstanceLeaf = [&](int firstInstance, int instanceCount, float& tMax) {
+            bool hit = intersectInstances(firstInstance, instanceCount, origin, direction, tMax, closestInstance,
+                                          closestInstanceTriangle, useAccelerationStructure, statistics);
+            closestDistance = tMax;
+            return hit;
+        };
+
+        if (useAccelerationStructure)
+        {
+            sphereBVH.intersectLeaves(origin, direction, closestDistance, intersectSpheres, statistics);
+            instanceBVH.intersectLeaves(origin, direction, closestDistance, intersectInstanceLeaf, statistics);
+        }
+        else
+        {
+            statistics.numPrimitivesTested += int(spheres.size()) + int(instances.size());
+            intersectSpheres(0, int(spheres.size()), closestDistance);
+            intersectInstanceLeaf(0, int(instances.size()), closestDistance);
+        }
+
+        // We have an intersection
+        glm::vec3 intersectionPoint = origin + closestDistance * direction;
+        if (closestInstance >= 0)
+        {
+            ray.updateRayIntersection(Ray::Intersection(intersectionPoint,
+                                                        getInstanceNormal(closestInstance, closestInstanceTriangle),
+                                                        closestDistance, instances[closestInstance].materialIndex,
+                                                        instances[closestInstance].objectIndex));
+            return true;
+        }
+        if (closestSphere >= 0)
+        {
+            const SphereRecord& sphere = spheres[closestSphere];
+            ray.updateRayIntersection(Ray::Intersection(intersectionPoint, glm::normalize(intersectionPoint - sphere.center),
+                                                        closestDistance, sphere.materialIndex, sphere.objectIndex));
+            return true;
+        }
+        if (closestTriangle >= 0)
+        {
+            const TriangleInfo& info = triangleInfos[closestTriangle];
+            ray.updateRayIntersection(Ray::Intersection(intersectionPoint, info.normal, closestDistance,
+                                                        info.materialIndex, info.objectIndex));
+            return true;
+        }
+        return false;
+    }
+
+    ///----------------------------------------------
+
+    bool GeometryStore::occluded(glm::vec3 origin, glm::vec3 direction, float tMax, bool useAccelerationStructure,
+                                 BVH::TraversalStatistics& statistics) const
+    {
+        auto occludedBySpheres = [&](int firstSphere, int sphereCount) {
+            for (int sphere = firstSphere; sphere < firstSphere + sphereCount; ++sphere)
+            {
+                float distance;
+                if (intersectSphere(spheres[sphere], origin, direction, distance) && distance < tMax)
+                    return true;
+            }
+            return false;
+        };
+
+        auto occludedByInstances = [&](int firstInstance, int instanceCount) {
+            for (int instance = firstInstance; instance < firstInstance + instanceCount; ++instance)
+            {
+                const InstanceRecord& record = instances[instance];
+                glm::vec3 objectOrigin = record.worldToObject * glm::vec4(origin, 1.0f);
+                glm::vec3 objectDirection = record.worldToObject * glm::vec4(direction, 0.0f);
+                if (meshes[record.meshIndex]->occludedByTriangles(objectOrigin, objectDirection, tMax,
+                                                                  useAccelerationStructure, statistics))
+                    return true;
+            }
+            return false;
+        };
+
+        if (occludedByTriangles(origin, direction, tMax, useAccelerationStructure, statistics))
+            return true;
+
+        if (useAccelerationStructure)
+        {
+            return sphereBVH.occludedLeaves(origin, direction, tMax, occludedBySpheres, statistics)
+                   || instanceBVH.occludedLeaves(origin, direction, tMax, occludedByInstances, statistics);
+        }
+
+        statistics.numPrimitivesTested += int(spheres.size()) + int(instances.size());
+        return occludedBySpheres(0, int(spheres.size())) || occludedByInstances(0, int(instances.size()));
+    }
+
+    ///----------------------------------------------
+
+    void GeometryStore::intersectPacket(RayPacket& packet, Ray* rays, bool useAccelerationStructure,
+                                        BVH::TraversalStatistics& statistics) const
+    {
+        if (!useAccelerationStructure)
+        {
+            for (int ray = 0; ray < packet.size; ++ray)
+                intersect(rays[ray], false, statistics);
+            return;
+        }
+
+        int closestTriangles[RayPacket::MAX_SIZE];
+        int closestSpheres[RayPacket::MAX_SIZE];
+        int closestInstances[RayPacket::MAX_SIZE];
+        int closestInstanceTriangles[RayPacket::MAX_SIZE];
+        for (int ray = 0; ray < packet.size; ++ray)
+            closestTriangles[ray] = closestSpheres[ray] = closestInstances[ray] = -1;
+
+        triangleBVH.intersectPacketLeaves(packet, [&](int ray, int firstTriangle, int triangleCount, float& tMax) {
+            int firstLane = firstTriangle % TrianglePacket::WIDTH;
+            int lane = TriangleKernel::intersect(trianglePackets[firstTriangle / TrianglePacket::WIDTH], firstLane,
+                                                 triangleCount, packet.origins[ray], packet.directions[ray], tMax, tMax);
+            if (lane >= 0)
+                closestTriangles[ray] = firstTriangle - firstLane + lane;
+        }, statistics);
+
+        sphereBVH.intersectPacketLeaves(packet, [&](int ray, int firstSphere, int sphereCount, float& tMax) {
+            for (int sphere = firstSphere; sphere < firstSphere + sphereCount; ++sphere)
+            {
+                float distance;
+                if (intersectSphere(spheres[sphere], packet.origins[ray], packet.directions[ray], distance)
+                    && distance < tMax)
+                {
+                    tMax = distance;
+                    closestSpheres[ray] = sphere;
+                }
+            }
+        }, statistics);
+
+        // The packet goes through the top level together, every ray on its own through the meshes
+        instanceBVH.intersectPacketLeaves(packet, [&](int ray, int firstInstance, int instanceCount, float& tMax) {
+            intersectInstances(firstInstance, instanceCount, packet.origins[ray], packet.directions[ray], tMax,
+                               closestInstances[ray], closestInstanceTriangles[ray], true, statistics);
+        }, statistics);
+
+        for (int ray = 0; ray < packet.size; ++ray)
+        {
+            float distance = packet.tMax[ray];
+            glm::vec3 intersectionPoint = packet.origins[ray] + distance * packet.directions[ray];
+
+            // A hit is only recorded when it is closer than those of the kinds tested before
+            if (closestInstances[ray] >= 0)
+            {
+                rays[ray].updateRayIntersection(Ray::Intersection(intersectionPoint,
+                        getInstanceNormal(closestInstances[ray], closestInstanceTriangles[ray]), distance,
+                        instances[closestInstances[ray]].materialIndex, instances[closestInstances[ray]].objectIndex));
+            }
+            else if (closestSpheres[ray] >= 0)
+            {
+                const SphereRecord& sphere = spheres[closestSpheres[ray]];
+                rays[ray].updateRayIntersection(Ray::Intersection(intersectionPoint,
+                        glm::normalize(intersectionPoint - sphere.center), distance, sphere.materialIndex,
+                        sphere.objectIndex));
+            }
+            else if (closestTriangles[ray] >= 0)
+            {
+                const TriangleInfo& info = triangleInfos[closestTriangles[ray]];
+                rays[ray].updateRayIntersection(Ray::Intersection(intersectionPoint, info.normal, distance,
+                                                                  info.materialIndex, info.objectIndex));
+            }
+        }
+    }
+
+    ///----------------------------------------------
+
+    std::size_t GeometryStore::getTriangleMemoryUsage() const
+    {
+        return trianglePackets.size() * sizeof(TrianglePacket) + triangleInfos.size() * sizeof(TriangleInfo)
+               + triangleBVH.getMemoryUsage();
+    }
+
+    ///----------------------------------------------
+
+    std::size_t GeometryStore::getSphereMemoryUsage() const
+    {
+        return spheres.size() * sizeof(SphereRecord) + sphereBVH.getMemoryUsage();
+    }
+
+    ///----------------------------------------------
+
+    std::size_t GeometryStore::getInstanceMemoryUsage() const
+    {
+        return instances.size() * sizeof(InstanceRecord) + instanceBVH.getMemoryUsage();
+    }
+
+} // namespace rayTracer
@@ -0,0 +1,686 @@
+#include <ImageWriter.h>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RAYTRACER_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace rayTracer {
+
+    namespace {
+
+        static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "the rows are read as plain floats");
+
+        /// The 8 bit values are looked up in tables indexed by the clamped value in 16 bit fixed point,
+        /// fine enough that the lookup picks the same byte as the exact curve except right at the edges
+        const int TABLE_SIZE = 1 << 16;
+
+        /// Largest number of bytes a stored deflate block can hold
+        const std::size_t MAX_STORED_BLOCK_SIZE = 65535;
+
+        /// Linear [0, 1] to 8 bit, either through the sRGB curve or linearly
+        std::vector<std::uint8_t> createByteTable(bool useSRGBCurve)
+        {
+            std::vector<std::uint8_t> table(TABLE_SIZE);
+            for (int index = 0; index < TABLE_SIZE; ++index)
+            {
+                double value = double(index) / double(TABLE_SIZE - 1);
+                if (useSRGBCurve)
+                    value = value <= 0.0031308 ? 12.92 * value : 1.055 * std::pow(value, 1.0 / 2.4) - 0.055;
+                table[index] = std::uint8_t(std::min(255.0, value * 255.0 + 0.5));
+            }
+            return table;
+        }
+
+        const std::uint8_t* getByteTable(bool useSRGBCurve)
+        {
+            static const std::vector<std::uint8_t> sRGBTable = createByteTable(true);
+            static const std::vector<std::uint8_t> linearTable = createByteTable(false);
+            return useSRGBCurve ? sRGBTable.data() : linearTable.data();
+        }
+
+        /// Exposure, tone mapping and clamping of one value, NaN ends up as 0.
+        /// Reinhard is written as 1 - 1 / (1 + x) so that infinity maps to 1.
+        float toneMap(float value, float exposure, bool useReinhard)
+        {
+            value *= exposure;
+            if (useReinhard)
+                value = 1.0f - 1.0f / (1.0f + std::max(value, 0.0f));
+            return value > 0.0f ? (value < 1.0f ? value : 1.0f) : 0.0f;
+        }
+
+        /// Rounds to nearest even like the F16C instructions. Values from 65520 up become infinity.
+        std::uint16_t floatToHalf(float value)
+        {
+            std::uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            std::uint32_t sign = (bits >> 16) & 0x8000u;
+            std::uint32_t magnitude = bits & 0x7fffffffu;
+
+            // 65536 and up, infinity and NaN, which stays a quiet NaN
+            if (magnitude >= 0x47800000u)
+                return std::uint16_t(sign | 0x7c00u | (magnitude > 0x7f800000u ? 0x200u : 0u));
+
+            // Below the smallest normal half: adding 0.5 lines the denormal mantissa up with the
+            // float mantissa and the float addition does the rounding
+            if (magnitude < 0x38800000u)
+            {
+                float magnitudeValue;
+                std::memcpy(&magnitudeValue, &magnitude, sizeof(magnitudeValue));
+                float shifted = magnitudeValue + 0.5f;
+                std::uint32_t shiftedBits;
+                std::memcpy(&shiftedBits, &shifted, sizeof(shiftedBits));
+                return std::uint16_t(sign | (shiftedBits - 0x3f000000u));
+            }
+
+            // Rebias the exponent from 127 to 15 and round the mantissa from 23 to 10 bits
+            magnitude += 0xc8000fffu + ((magnitude >> 13) & 1u);
+            return std::uint16_t(sign | (magnitude >> 13));
+        }
+
+        bool isLittleEndian()
+        {
+            std::uint16_t one = 1;
+            std::uint8_t firstByte;
+            std::memcpy(&firstByte, &one, 1);
+            return firstByte == 1;
+        }
+
+        void appendBytes(std::vector<char>& data, const void* bytes, std::size_t size)
+        {
+            const char* begin = static_cast<const char*>(bytes);
+            data.insert(data.end(), begin, begin + size);
+        }
+
+        void appendString(std::vector<char>& data, const std::string& text)
+        {
+            appendBytes(data, text.c_str(), text.size() + 1);
+        }
+
+        template <typename T>
+        void appendLittleEndian(std::vector<char>& data, T value)
+        {
+            for (std::size_t byte = 0; byte < sizeof(T); ++byte)
+                data.push_back(char((std::uint64_t(value) >> (8 * byte)) & 0xff));
+        }
+
+        void appendLittleEndian(std::vector<char>& data, float value)
+        {
+            std::uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            appendLittleEndian(data, bits);
+        }
+
+        void appendBigEndian(std::vector<char>& data, std::uint32_t value)
+        {
+            for (int byte = 3; byte >= 0; --byte)
+                data.push_back(char((value >> (8 * byte)) & 0xff));
+        }
+
+        ///----------------------------------------------
+        /// PNG
+
+        std::uint32_t updateCRC32(std::uint32_t crc, const char* bytes, std::size_t size)
+        {
+            static const std::vector<std::uint32_t> table = []() {
+                std::vector<std::uint32_t> crcTable(256);
+                for (std::uint32_t byte = 0; byte < 256; ++byte)
+                {
+                    std::uint32_t value = byte;
+                    for (int bit = 0; bit < 8; ++bit)
+                        value = (value & 1u) ? 0xedb88320u ^ (value >> 1) : value >> 1;
+                    crcTable[byte] = value;
+                }
+                return crcTable;
+            }();
+
+            crc = ~crc;
+            for (std::size_t index = 0; index < size; ++index)
+                crc = table[(crc ^ std::uint8_t(bytes[index])) & 0xffu] ^ (crc >> 8);
+            return ~crc;
+        }
+
+        void updateAdler32(std::uint32_t& a, std::uint32_t& b, const char* bytes, std::size_t size)
+        {
+            // 5552 bytes is the most that can be summed before the 32 bit sums could overflow
+            for (std::size_t begin = 0; begin < size; begin += 5552)
+            {
+                std::size_t end = std::min(size, begin + 5552);
+                for (std::size_t index = begin; index < end; ++index)
+                {
+                    a += std::uint8_t(bytes[index]);
+                    b += a;
+                }
+                a %= 65521u;
+                b %= 65521u;
+            }
+        }
+
+        void appendChunk(std::vector<char>& data, const char* type, const std::vector<char>& content)
+        {
+            appendBigEndian(data, std::uint32_t(content.size()));
+            std::size_t typeOffset = data.size();
+            appendBytes(data, type, 4);
+            appendBytes(data, content.data(), content.size());
+            appendBigEndian(data, updateCRC32(0, data.data() + typeOffset, data.size() - typeOffset));
+        }
+
+        ///----------------------------------------------
+
+        bool writeFile(const std::string& path, const std::vector<char>& data)
+        {
+            std::ofstream file(path, std::ios::binary);
+            if (!file)
+            {
+                std::cout << "Can't open " << path << " for writing" << std::endl;
+                return false;
+            }
+
+            file.write(data.data(), std::streamsize(data.size()));
+            file.close();
+            if (!file)
+            {
+                std::cout << "Failed to write " << path << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+    } // anonymous namespace
+
+    ImageWriter::ImageWriter()
+        : format(Format::PPM)
+        , width(0)
+        , height(0)
+        , numRowsEncoded(0)
+        , headerSize(0)
+        , crc(0)
+        , adlerA(1)
+        , adlerB(0)
+        , numScanlineBytesLeft(0)
+        , numBlockBytesLeft(0)
+    { }
+
+    ///----------------------------------------------
+
+    bool ImageWriter::writeImage(const std::string& path, const glm::vec3* const* rows, int width, int height,
+                                 const DisplaySettings& displaySettings)
+    {
+        ImageWriter imageWriter;
+        if (!imageWriter.start(path, width, height, displaySettings))
+            return false;
+
+        std::vector<char> data;
+        imageWriter.encodeHeader(data);
+        imageWriter.encodeRows(rows, height, data);
+        imageWriter.encodeTrailer(data);
+        return writeFile(path, data);
+    }
+
+    ///----------------------------------------------
+
+    bool ImageWriter::open(const std::string& inPath, int inWidth, int inHeight, const DisplaySettings& inDisplaySettings,
+                           int maxRowsPerWrite)
+    {
+        if (!start(inPath, inWidth, inHeight, inDisplaySettings))
+            return false;
+
+        file.close();
+        file.clear();
+        file.open(path, std::ios::binary);
+        if (!file)
+        {
+            std::cout << "Can't open " << path << " for writing" << std::endl;
+            return false;
+        }
+
+        buffer.clear();
+        encodeHeader(buffer);
+        file.write(buffer.data(), std::streamsize(buffer.size()));
+
+        // No format takes more than the 12 bytes of a PFM pixel, plus the block headers of a row and the trailer
+        buffer.reserve((std::size_t(width) * 12 + 16) * std::size_t(glm::max(1, maxRowsPerWrite)) + 64);
+        rowValues.reserve(width);
+        rowBytes.reserve(std::size_t(width) * 3 + 1);
+        rowHalfs.reserve(width);
+
+        // The table of the 8 bit values is built on first use
+        if (format == Format::PPM || format == Format::PNG)
+            getByteTable(displaySettings.useSRGBCurve);
+        return bool(file);
+    }
+
+    ///----------------------------------------------
+
+    bool ImageWriter::writeRows(const glm::vec3* const* rows, int numRows)
+    {
+        if (!file.is_open() || !file || numRowsEncoded + numRows > height)
+            return false;
+
+        // The PFM rows go from the bottom up, so the rows of every call go in front of the ones before
+        if (format == Format::PFM)
+            file.seekp(std::streamoff(getPFMRowsOffset(numRowsEncoded, numRows)));
+
+        buffer.clear();
+        encodeRows(rows, numRows, buffer);
+        file.write(buffer.data(), std::streamsize(buffer.size()));
+        return bool(file);
+    }
+
+    ///----------------------------------------------
+
+    bool ImageWriter::close()
+    {
+        if (!file.is_open())
+            return false;
+
+        buffer.clear();
+        encodeTrailer(buffer);
+        file.write(buffer.data(), std::streamsize(buffer.size()));
+        file.close();
+
+        bool written = bool(file);
+        if (!written)
+            std::cout << "Failed to write " << path << std::endl;
+        else if (numRowsEncoded < height)
+        {
+            std::cout << "Only " << numRowsEncoded << " of the " << height << " rows were written to " << path << std::endl;
+            written = false;
+        }
+        return written;
+    }
+
+    ///----------------------------------------------
+
+    bool ImageWriter::start(const std::string& inPath, int inWidth, int inHeight, const DisplaySettings& inDisplaySettings)
+    {
+        if (!getFormat(inPath, format))
+        {
+            std::cout << "Unknown image format of " << inPath << ", use .ppm, .png, .pfm or .exr" << std::endl;
+            return false;
+        }
+
+        path = inPath;
+        width = inWidth;
+        height = inHeight;
+        displaySettings = inDisplaySettings;
+        numRowsEncoded = 0;
+        headerSize = 0;
+        return true;
+    }
+
+    ///----------------------------------------------
+
+    bool ImageWriter::getFormat(const std::string& path, Format& format)
+    {
+        std::size_t dot = path.find_last_of('.');
+        std::size_t separator = path.find_last_of("/\\");
+        if (dot == std::string::npos || (separator != std::string::npos && dot < separator))
+            return false;
+
+        std::string extension = path.substr(dot + 1);
+        std::transform(extension.begin(), extension.end(), extension.begin(),
+                       [](char c) { return char(std::tolower(static_cast<unsigned char>(c))); });
+
+        if (extension == "ppm")
+            format = Format::PPM;
+        else if (extension == "png")
+            format = Format::PNG;
+        else if (extension == "pfm")
+            format = Format::PFM;
+        else if (extension == "exr")
+            format = Format::EXR;
+        else
+            return false;
+        return true;
+    }
+
+    ///----------------------------------------------
+
+    std::string ImageWriter::replaceExtension(const std::string& path, const std::string& extension)
+    {
+        std::size_t dot = path.find_last_of('.');
+        std::size_t separator = path.find_last_of("/\\");
+        if (dot == std::string::npos || (separator != std::string::npos && dot < separator))
+            return path + extension;
+
+        // A leading dot as in ".hidden" or "../" isn't an extension
+        std::size_t nameBegin = separator == std::string::npos ? 0 : separator + 1;
+        if (dot == nameBegin)
+            return path + extension;
+
+        return path.substr(0, dot) + extension;
+    }
+
+    ///----------------------------------------------
+
+    void ImageWriter::convertToBytes(const float* values, int numValues, const DisplaySettings& displaySettings,
+                                     std::uint8_t* bytes)
+    {
+        const std::uint8_t* table = getByteTable(displaySettings.useSRGBCurve);
+        bool useReinhard = displaySettings.toneMapping == ToneMapping::REINHARD;
+        float exposure = displaySettings.exposure;
+        const float tableScale = float(TABLE_SIZE - 1);
+
+        int index = 0;
+#ifdef RAYTRACER_X86_SIMD
+        // Four values at a time up to the table index, max with 0 first so that NaN becomes 0
+        const __m128 exposure4 = _mm_set1_ps(exposure);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 scale = _mm_set1_ps(tableScale);
+        const __m128 half = _mm_set1_ps(0.5f);
+        for (; index + 4 <= numValues; index += 4)
+        {
+            __m128 value = _mm_mul_ps(_mm_loadu_ps(values + index), exposure4);
+            if (useReinhard)
+                value = _mm_sub_ps(one, _mm_div_ps(one, _mm_add_ps(one, _mm_max_ps(value, zero))));
+            value = _mm_min_ps(_mm_max_ps(value, zero), one);
+
+            alignas(16) std::int32_t tableIndices[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(tableIndices),
+                            _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(value, scale), half)));
+            bytes[index] = table[tableIndices[0]];
+            bytes[index + 1] = table[tableIndices[1]];
+            bytes[index + 2] = table[tableIndices[2]];
+            bytes[index + 3] = table[tableIndices[3]];
+        }
+#endif
+        for (; index < numValues; ++index)
+            bytes[index] = table[int(toneMap(values[index], exposure, useReinhard) * tableScale + 0.5f)];
+    }
+
+    ///----------------------------------------------
+
+    void ImageWriter::convertToHalfs(const float* values, int numValues, std::uint16_t* halfs)
+    {
+        int index = 0;
+#ifdef RAYTRACER_X86_SIMD
+        // The same steps as floatToHalf on four values, with masks instead of branches
+        const __m128i signMask = _mm_set1_epi32(int(0x80000000u));
+        const __m128i infinityThreshold = _mm_set1_epi32(0x47800000);
+        const __m128i normalThreshold = _mm_set1_epi32(0x38800000);
+        const __m128i denormalMagic = _mm_set1_epi32(0x3f000000);
+        const __m128i normalBias = _mm_set1_epi32(int(0xc8000fffu));
+        const __m128i infinity = _mm_set1_epi32(0x7c00);
+        const __m128i quietNaNBit = _mm_set1_epi32(0x200);
+        for (; index + 4 <= numValues; index += 4)
+        {
+            __m128 value = _mm_loadu_ps(values + index);
+            __m128i bits = _mm_castps_si128(value);
+            __m128i sign = _mm_and_si128(bits, signMask);
+            __m128i magnitude = _mm_xor_si128(bits, sign);
+
+            __m128i isNaN = _mm_castps_si128(_mm_cmpunord_ps(value, value));
+            __m128i isFinite = _mm_cmpgt_epi32(infinityThreshold, magnitude);
+            __m128i isDenormal = _mm_cmpgt_epi32(normalThreshold, magnitude);
+
+            __m128i denormal = _mm_sub_epi32(
+                _mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(magnitude), _mm_castsi128_ps(denormalMagic))),
+                denormalMagic);
+
+            __m128i mantissaOdd = _mm_and_si128(_mm_srli_epi32(magnitude, 13), _mm_set1_epi32(1));
+            __m128i normal = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(magnitude, normalBias), mantissaOdd), 13);
+
+            __m128i finite = _mm_or_si128(_mm_and_si128(isDenormal, denormal), _mm_andnot_si128(isDenormal, normal));
+            __m128i nonFinite = _mm_or_si128(infinity, _mm_and_si128(isNaN, quietNaNBit));
+            __m128i half = _mm_or_si128(_mm_and_si128(isFinite, finite), _mm_andnot_si128(isFinite, nonFinite));
+
+            // The sign shifted down arithmetically fills the top bits, so the saturating pack keeps the low 16
+            half = _mm_or_si128(half, _mm_srai_epi32(sign, 16));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(halfs + index), _mm_packs_epi32(half, half));
+        }
+#endif
+        for (; index < numValues; ++index)
+            halfs[index] = floatToHalf(values[index]);
+    }
+
+    ///----------------------------------------------
+
+    void ImageWriter::encodeHeader(std::vector<char>& data)
+    {
+        std::size_t begin = data.size();
+        switch (format)
+        {
+            case Format::PPM:
+            {
+                std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+                appendBytes(data, header.data(), header.size());
+                break;
+            }
+            case Format::PFM:
+            {
+                // A negative scale means little endian floats
+                std::string header = "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n"
+                        + (isLittleEndian() ? "-1.0\n" : "1.0\n");
+                appendBytes(data, header.data(), header.size());
+                break;
+            }
+            case Format::PNG:
+            {
+                std::vector<char> imageHeader;
+                appendBigEndian(imageHeader, std::uint32_t(width));
+                appendBigEndian(imageHeader, std::uint32_t(height));
+                imageHeader.push_back(8); // bits per channel
+                imageHeader.push_back(2); // RGB
+                imageHeader.push_back(0); // deflate
+                imageHeader.push_back(0); // adaptive filtering
+                imageHeader.push_back(0); // not interlaced
+
+                const char signature[8] = {char(0x89), 'P', 'N', 'G', '\r', '\n', char(0x1a), '\n'};
+                appendBytes(data, signature, sizeof(signature));
+                appendChunk(data, "IHDR", imageHeader);
+
+                // The scan lines each start with filter type 0, none. They go into stored deflate blocks,
+                // compressing would cost more time than the single write saves. So the size of the zlib
+                // stream is known up front and all of it fits in one IDAT chunk.
+                numScanlineBytesLeft = (std::size_t(width) * 3 + 1) * height;
+                numBlockBytesLeft = 0;
+                std::size_t numBlocks = (numScanlineBytesLeft + MAX_STORED_BLOCK_SIZE - 1) / MAX_STORED_BLOCK_SIZE;
+                appendBigEndian(data, std::uint32_t(2 + numBlocks * 5 + numScanlineBytesLeft + 4));
+
+                std::size_t chunkBegin = data.size();
+                appendBytes(data, "IDAT", 4);
+                data.push_back(char(0x78));
+                data.push_back(char(0x01));
+                crc = updateCRC32(0, data.data() + chunkBegin, data.size() - chunkBegin);
+                adlerA = 1;
+                adlerB = 0;
+                break;
+            }
+            case Format::EXR:
+            {
+                // Uncompressed scan line image with half float channels, which have to be listed by name
+                std::vector<char> channels;
+                for (const char* channelName : {"B", "G", "R"})
+                {
+                    appendString(channels, channelName);
+                    appendLittleEndian(channels, std::int32_t(1)); // half
+                    appendLittleEndian(channels, std::uint32_t(0)); // not perceptually linear and reserved
+                    appendLittleEndian(channels, std::int32_t(1)); // x sampling
+                    appendLittleEndian(channels, std::int32_t(1)); // y sampling
+                }
+                channels.push_back(0);
+
+                std::vector<char> window;
+                appendLittleEndian(window, std::int32_t(0));
+                appendLittleEndian(window, std::int32_t(0));
+                appendLittleEndian(window, std::int32_t(width - 1));
+                appendLittleEndian(window, std::int32_t(height - 1));
+
+                std::vector<char> windowCenter;
+                appendLittleEndian(windowCenter, 0.0f);
+                appendLittleEndian(windowCenter, 0.0f);
+
+                std::vector<char> one;
+                appendLittleEndian(one, 1.0f);
+
+                auto appendAttribute = [&data](const char* name, const char* type, const std::vector<char>& value) {
+                    appendString(data, name);
+                    appendString(data, type);
+                    appendLittleEndian(data, std::int32_t(value.size()));
+                    appendBytes(data, value.data(), value.size());
+                };
+
+                appendLittleEndian(data, std::uint32_t(20000630)); // magic number
+                appendLittleEndian(data, std::uint32_t(2)); // version 2, single part scan lines
+                appendAttribute("channels", "chlist", channels);
+                appendAttribute("compression", "compression", std::vector<char>(1, 0));
+                appendAttribute("dataWindow", "box2i", window);
+                appendAttribute("displayWindow", "box2i", window);
+                appendAttribute("lineOrder", "lineOrder", std::vector<char>(1, 0)); // increasing y
+                appendAttribute("pixelAspectRatio", "float", one);
+                appendAttribute("screenWindowCenter", "v2f", windowCenter);
+                appendAttribute("screenWindowWidth", "float", one);
+                data.push_back(0);
+
+                // Every scan line is a block of its own of the same size, found through the offset table
+                std::size_t blockSize = 2 * sizeof(std::int32_t) + std::size_t(width) * 3 * sizeof(std::uint16_t);
+                std::size_t firstBlock = data.size() - begin + std::size_t(height) * sizeof(std::uint64_t);
+                for (int row = 0; row < height; ++row)
+                    appendLittleEndian(data, std::uint64_t(firstBlock + blockSize * row));
+                break;
+            }
+        }
+        headerSize = data.size() - begin;
+    }
+
+    ///----------------------------------------------
+
+    void ImageWriter::encodeRows(const glm::vec3* const* rows, int numRows, std::vector<char>& data)
+    {
+        std::size_t begin = data.size();
+        switch (format)
+        {
+            case Format::PPM:
+            {
+                std::size_t rowSize = std::size_t(width) * 3;
+                data.resize(begin + rowSize * numRows);
+                std::uint8_t* bytes = reinterpret_cast<std::uint8_t*>(data.data() + begin);
+                for (int row = 0; row < numRows; ++row)
+                    convertToBytes(&rows[row]->x, width * 3, displaySettings, bytes + row * rowSize);
+                break;
+            }
+            case Format::PFM:
+            {
+                // The rows go from the bottom up
+                std::size_t rowSize = std::size_t(width) * sizeof(glm::vec3);
+                data.resize(begin + rowSize * numRows);
+                for (int row = 0; row < numRows; ++row)
+                    std::memcpy(data.data() + begin + rowSize * (numRows - 1 - row), rows[row], rowSize);
+                break;
+            }
+            case Format::PNG:
+            {
+                std::size_t rowSize = std::size_t(width) * 3 + 1;
+                data.reserve(begin + (rowSize + 5) * numRows + 5);
+                rowBytes.resize(rowSize);
+                rowBytes[0] = 0;
+                for (int row = 0; row < numRows; ++row)
+                {
+                    convertToBytes(&rows[row]->x, width * 3, displaySettings, rowBytes.data() + 1);
+                    appendScanlineBytes(reinterpret_cast<const char*>(rowBytes.data()), rowSize, data);
+                }
+                crc = updateCRC32(crc, data.data() + begin, data.size() - begin);
+                break;
+            }
+            case Format::EXR:
+            {
+                // A scan line block holds the row, the size of its data and all values of the first
+                // channel, then the second and the third
+                const int channelIndices[3] = {2, 1, 0};
+                std::size_t lineDataSize = std::size_t(width) * 3 * sizeof(std::uint16_t);
+                std::size_t blockSize = 2 * sizeof(std::int32_t) + lineDataSize;
+                data.resize(begin + blockSize * numRows);
+
+                bool littleEndian = isLittleEndian();
+                rowValues.resize(width);
+                rowHalfs.resize(width);
+                for (int row = 0; row < numRows; ++row)
+                {
+                    char* block = data.data() + begin + blockSize * row;
+                    std::uint32_t header[2] = {std::uint32_t(numRowsEncoded + row), std::uint32_t(lineDataSize)};
+                    for (int value = 0; value < 2; ++value)
+                        for (int byte = 0; byte < 4; ++byte)
+                            block[4 * value + byte] = char((header[value] >> (8 * byte)) & 0xff);
+
+                    char* line = block + 2 * sizeof(std::int32_t);
+                    for (int channel = 0; channel < 3; ++channel)
+                    {
+                        for (int column = 0; column < width; ++column)
+                            rowValues[column] = rows[row][column][channelIndices[channel]];
+                        convertToHalfs(rowValues.data(), width, rowHalfs.data());
+
+                        char* channelBytes = line + std::size_t(channel) * width * sizeof(std::uint16_t);
+                        if (littleEndian)
+                        {
+                            std::memcpy(channelBytes, rowHalfs.data(), width * sizeof(std::uint16_t));
+                            continue;
+                        }
+                        for (int column = 0; column < width; ++column)
+                        {
+                            channelBytes[2 * column] = char(rowHalfs[column] & 0xff);
+                            channelBytes[2 * column + 1] = char(rowHalfs[column] >> 8);
+                        }
+                    }
+                }
+                break;
+            }
+        }
+        numRowsEncoded += numRows;
+    }
+
+    ///----------------------------------------------
+
+    void ImageWriter::encodeTrailer(std::vector<char>& data)
+    {
+        if (format != Format::PNG)
+            return;
+
+        // The zlib stream ends with the Adler-32 of the scan lines, which is still part of the IDAT chunk
+        std::size_t begin = data.size();
+        appendBigEndian(data, (adlerB << 16) | adlerA);
+        crc = updateCRC32(crc, data.data() + begin, data.size() - begin);
+        appendBigEndian(data, crc);
+        appendChunk(data, "IEND", std::vector<char>());
+    }
+
+    ///----------------------------------------------
+
+    void ImageWriter::appendScanlineBytes(const char* bytes, std::size_t size, std::vector<char>& data)
+    {
+        updateAdler32(adlerA, adlerB, bytes, size);
+        while (size > 0 && numScanlineBytesLeft > 0)
+        {
+            // Start the next stored block, the last one is marked as the final block
+            if (numBlockBytesLeft == 0)
+            {
+                numBlockBytesLeft = std::min(MAX_STORED_BLOCK_SIZE, numScanlineBytesLeft);
+                data.push_back(char(numBlockBytesLeft == numScanlineBytesLeft ? 1 : 0));
+                appendLittleEndian(data, std::uint16_t(numBlockBytesLeft));
+                appendLittleEndian(data, std::uint16_t(~numBlockBytesLeft));
+            }
+
+            std::size_t numBytes = std::min(size, numBlockBytesLeft);
+            appendBytes(data, bytes, numBytes);
+            bytes += numBytes;
+            size -= numBytes;
+            numBlockBytesLeft -= numBytes;
+            numScanlineBytesLeft -= numBytes;
+        }
+    }
+
+    ///----------------------------------------------
+
+    std::uint64_t ImageWriter::getPFMRowsOffset(int firstRow, int numRows) const
+    {
+        return headerSize + std::uint64_t(height - firstRow - numRows) * width * sizeof(glm::vec3);
+    }
+
+} // namespace rayTracer
@@ -0,0 +1,112 @@
+#include <MappedFile.h>
+#include <iostream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace rayTracer {
+
+    MappedFile::MappedFile()
+        : data(nullptr)
+        , size(0)
+#ifdef _WIN32
+        , fileHandle(INVALID_HANDLE_VALUE)
+        , mappingHandle(nullptr)
+#endif
+    { }
+
+    ///----------------------------------------------
+
+    MappedFile::~MappedFile()
+    {
+        close();
+    }
+
+    ///----------------------------------------------
+
+    bool MappedFile::open(const std::string& path)
+    {
+        close();
+
+#ifdef _WIN32
+        fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                 FILE_ATTRIBUTE_NORMAL, nullptr);
+        LARGE_INTEGER fileSize;
+        if (fileHandle == INVALID_HANDLE_VALUE || !GetFileSizeEx(fileHandle, &fileSize))
+        {
+            std::cout << "Can't open " << path << std::endl;
+            close();
+            return false;
+        }
+
+        size = std::size_t(fileSize.QuadPart);
+        if (size == 0)
+            return true;
+
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle)
+            data = static_cast<const char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+#else
+        int file = ::open(path.c_str(), O_RDONLY);
+        struct stat fileStatus;
+        if (file < 0 || fstat(file, &fileStatus) != 0)
+        {
+            std::cout << "Can't open " << path << std::endl;
+            if (file >= 0)
+                ::close(file);
+            return false;
+        }
+
+        // The mapping keeps the file open by itself
+        size = std::size_t(fileStatus.st_size);
+        if (size > 0)
+        {
+            void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+            if (mapping != MAP_FAILED)
+                data = static_cast<const char*>(mapping);
+        }
+        ::close(file);
+        if (size == 0)
+            return true;
+#endif
+
+        if (!data)
+        {
+            std::cout << "Can't map " << path << " into memory" << std::endl;
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    ///----------------------------------------------
+
+    void MappedFile::close()
+    {
+#ifdef _WIN32
+        if (data)
+            UnmapViewOfFile(data);
+        if (mappingHandle)
+            CloseHandle(mappingHandle);
+        if (fileHandle != INVALID_HANDLE_VALUE)
+            CloseHandle(fileHandle);
+        mappingHandle = nullptr;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (data)
+            munmap(const_cast<char*>(data), size);
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+} // namespace rayTracer
@@ -1,81 +1,208 @@
 #include "MaterialProperties.h"
+#include <RandomSampler.h>
 
 namespace rayTracer {
 
-    MaterialProperties::MaterialProperties()
-            : rho(glm::vec3(0.0f))
-            , rhoOverPi(glm::vec3(0.0f))
-    { }
+    namespace {
+
+        MaterialProperties createMaterial(MaterialType type, unsigned char flags, glm::vec3 reflectionCoefficients)
+        {
+            MaterialProperties material;
+            material.type = type;
+            material.flags = flags;
+            material.padding[0] = material.padding[1] = 0;
+            material.rho = reflectionCoefficients;
+            material.rhoOverPi = glm::one_over_pi<float>() * reflectionCoefficients;
+            material.orenNayarA = 1.0f;
+            material.orenNayarB = 0.0f;
+            material.flux = 0.0f;
+            return material;
+        }
+
+        glm::vec3 getLambertianBRDF(const MaterialProperties& material)
+        {
+            return material.rhoOverPi;
+        }
+
+        /// A + B * max(0, cos(phiIn - phiOut)) * sin(alpha) * tan(beta) with alpha the larger and beta
+        /// the smaller of the two inclinations. The cosine of the azimuth difference times the sines
+        /// of both inclinations is the dot product of the tangential parts of the directions, which
+        /// leaves that product divided by the larger of the two cosines.
+        glm::vec3 getOrenNayarBRDF(const MaterialProperties& material, glm::vec3 wIn, glm::vec3 wOut)
+        {
+            float tangentialCosine = wIn.x * wOut.x + wIn.y * wOut.y;
+            float maxCosine = glm::max(wIn.z, wOut.z);
+            float factor = tangentialCosine > 0.0f && maxCosine > 0.0f ? tangentialCosine / maxCosine : 0.0f;
+
+            return material.rhoOverPi * (material.orenNayarA + material.orenNayarB * factor);
+        }
+
+        glm::vec3 getPerfectMirrorBRDF()
+        {
+            return glm::vec3(1.0f);
+        }
+
+        glm::vec3 getEmissiveBRDF(const MaterialProperties& material)
+        {
+            return material.rho;
+        }
+
+        float getCosineHemispherePDF(glm::vec3 wIn)
+        {
+            return glm::max(wIn.z, 0.0f) * glm::one_over_pi<float>();
+        }
+
+    } // anonymous namespace
+
+    MaterialProperties MaterialProperties::createLambertian(glm::vec3 reflectionCoefficients)
+    {
+        return createMaterial(MaterialType::Lambertian, MATERIAL_DIFFUSE, reflectionCoefficients);
+    }
 
     ///----------------------------------------------
 
-    MaterialProperties::MaterialProperties(glm::vec3 reflectionCoefficients)
-            : rho(reflectionCoefficients)
+    MaterialProperties MaterialProperties::createOrenNayar(glm::vec3 reflectionCoefficients, float gaussianStandardDeviation)
     {
-        rhoOverPi = glm::one_over_pi<float>() * rho;
+        MaterialProperties material = createMaterial(MaterialType::OrenNayar, MATERIAL_DIFFUSE, reflectionCoefficients);
+
+        float sigmaPow2 = glm::pow(gaussianStandardDeviation, 2);
+        material.orenNayarA = 1.0f - (sigmaPow2 / (2 * (sigmaPow2 + 0.33f)));
+        material.orenNayarB = (0.45f * sigmaPow2) / (sigmaPow2 + 0.09f);
+        return material;
     }
 
     ///----------------------------------------------
 
-    LambertianMaterial::LambertianMaterial(glm::vec3 reflectionCoefficients)
-        : MaterialProperties(reflectionCoefficients)
-    { }
+    MaterialProperties MaterialProperties::createPerfectMirror()
+    {
+        return createMaterial(MaterialType::PerfectMirror, MATERIAL_SPECULAR, glm::vec3(0.0f));
+    }
 
     ///----------------------------------------------
 
-    glm::vec3 LambertianMaterial::getBRDF(
-            const float wInAzimuth, const float wInInclination,
-            const float wOutAzimuth, const float wOutInclination) const
+    MaterialProperties MaterialProperties::createEmissive(glm::vec3 reflectionCoefficients, float inFlux)
     {
-        return rhoOverPi;
+        MaterialProperties material = createMaterial(MaterialType::Emissive, MATERIAL_EMISSIVE, reflectionCoefficients);
+        material.flux = inFlux;
+        return material;
     }
 
     ///----------------------------------------------
 
-    OrenNayarMaterial::OrenNayarMaterial(glm::vec3 reflectionCoefficients, float gaussianStandardDeviation )
-        : MaterialProperties(reflectionCoefficients)
-        , sigma(gaussianStandardDeviation)
-    { }
+    glm::vec3 MaterialProperties::getBRDF(glm::vec3 wIn, glm::vec3 wOut) const
+    {
+        switch (type)
+        {
+            case MaterialType::Lambertian:
+                return getLambertianBRDF(*this);
+            case MaterialType::OrenNayar:
+                return getOrenNayarBRDF(*this, wIn, wOut);
+            case MaterialType::PerfectMirror:
+                return getPerfectMirrorBRDF();
+            case MaterialType::Emissive:
+                return getEmissiveBRDF(*this);
+        }
+        return glm::vec3(0.0f);
+    }
 
     ///----------------------------------------------
 
-    glm::vec3 OrenNayarMaterial::getBRDF(
-            const float wInAzimuth, const float wInInclination,
-            const float wOutAzimuth, const float wOutInclination) const
+    void MaterialProperties::getBRDFs(const glm::vec3* wIns, int count, glm::vec3 wOut, glm::vec3* brdfs) const
     {
-        float sigmaPow2 = glm::pow(sigma, 2);
+        // The type is looked at once for all the directions
+        switch (type)
+        {
+            case MaterialType::Lambertian:
+                for (int i = 0; i < count; ++i)
+                    brdfs[i] = getLambertianBRDF(*this);
+                return;
+            case MaterialType::OrenNayar:
+                for (int i = 0; i < count; ++i)
+                    brdfs[i] = getOrenNayarBRDF(*this, wIns[i], wOut);
+                return;
+            case MaterialType::PerfectMirror:
+                for (int i = 0; i < count; ++i)
+                    brdfs[i] = getPerfectMirrorBRDF();
+                return;
+            case MaterialType::Emissive:
+                for (int i = 0; i < count; ++i)
+                    brdfs[i] = getEmissiveBRDF(*this);
+                return;
+        }
+    }
 
-        float A = 1.0f - (sigmaPow2 / (2 * (sigmaPow2 + 0.33f)));
-        float B = (0.45f * sigmaPow2) / (sigmaPow2 + 0.09f);
-        float alpha = glm::max(wInAzimuth, wOutAzimuth);
-        float beta = glm::min(wInAzimuth, wOutAzimuth);
+    ///----------------------------------------------
 
-        return rhoOverPi * (A + B * glm::max(0.0f, glm::cos(wInInclination - wOutInclination)) * glm::sin(alpha) * glm::sin(beta));
+    glm::vec3 MaterialProperties::sample(glm::vec3 wOut, RandomSampler& sampler, glm::vec3& wIn, float& pdf) const
+    {
+        switch (type)
+        {
+            case MaterialType::Lambertian:
+            case MaterialType::OrenNayar:
+                // The cosine over the pdf is pi. Lambertian materials are sampled exactly, for
+                // Oren-Nayar the weight keeps its smooth factor A + B * ...
+                wIn = sampleCosineHemisphere(sampler);
+                pdf = getCosineHemispherePDF(wIn);
+                return glm::pi<float>() * getBRDF(wIn, wOut);
+            case MaterialType::PerfectMirror:
+                wIn = glm::vec3(-wOut.x, -wOut.y, wOut.z);
+                pdf = 0.0f;
+                return getPerfectMirrorBRDF();
+            case MaterialType::Emissive:
+                break;
+        }
+
+        // Light sources don't reflect
+        wIn = glm::vec3(0.0f, 0.0f, 1.0f);
+        pdf = 0.0f;
+        return glm::vec3(0.0f);
     }
 
     ///----------------------------------------------
 
-    glm::vec3 PerfectMirrorMaterial::getBRDF(
-            const float wInAzimuth, const float wInInclination,
-            const float wOutAzimuth, const float wOutInclination) const
+    float MaterialProperties::getPDF(glm::vec3 wIn, glm::vec3 /*wOut*/) const
     {
-        return glm::vec3(1.0f);
+        switch (type)
+        {
+            case MaterialType::Lambertian:
+            case MaterialType::OrenNayar:
+                return getCosineHemispherePDF(wIn);
+            case MaterialType::PerfectMirror:
+            case MaterialType::Emissive:
+                // A single direction or no reflection at all, no direction can be picked with a density
+                break;
+        }
+        return 0.0f;
     }
 
     ///----------------------------------------------
 
-    EmissiveMaterial::EmissiveMaterial(glm::vec3 reflectionCoefficients, float inFlux)
-            : MaterialProperties(reflectionCoefficients)
-            , flux(inFlux)
-    { }
+    void MaterialProperties::getPDFs(const glm::vec3* wIns, int count, glm::vec3 /*wOut*/, float* pdfs) const
+    {
+        switch (type)
+        {
+            case MaterialType::Lambertian:
+            case MaterialType::OrenNayar:
+                for (int i = 0; i < count; ++i)
+                    pdfs[i] = getCosineHemispherePDF(wIns[i]);
+                return;
+            case MaterialType::PerfectMirror:
+            case MaterialType::Emissive:
+                for (int i = 0; i < count; ++i)
+                    pdfs[i] = 0.0f;
+                return;
+        }
+    }
 
     ///----------------------------------------------
 
-    glm::vec3 EmissiveMaterial::getBRDF(
-            const float wInAzimuth, const float wInInclination,
-            const float wOutAzimuth, const float wOutInclination) const
+    glm::vec3 MaterialProperties::sampleCosineHemisphere(RandomSampler& sampler)
     {
-        return rho;
+        // Uniform on the unit disk, projected up onto the hemisphere
+        float radiusSquared = sampler.next();
+        float azimuth = 2.0f * glm::pi<float>() * sampler.next();
+        float radius = glm::sqrt(radiusSquared);
+        return glm::vec3(radius * glm::cos(azimuth), radius * glm::sin(azimuth), glm::sqrt(1.0f - radiusSquared));
     }
 
-} // namespace rayTracer
\ No newline at end of file
+} // namespace rayTracer
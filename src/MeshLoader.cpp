@@ -0,0 +1,689 @@
+#include <MeshLoader.h>
+#include <MappedFile.h>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+namespace rayTracer {
+
+    namespace {
+
+        /// The OBJ files are split into chunks of about this many bytes, ending at line ends
+        const std::size_t OBJ_CHUNK_SIZE = 1 << 20;
+
+        /// Triangles are checked in blocks of this many, one block per task
+        const int VALIDATION_BLOCK_SIZE = 1 << 16;
+
+        bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+        bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+        const char* skipSpaces(const char* p, const char* end)
+        {
+            while (p < end && isSpace(*p))
+                ++p;
+            return p;
+        }
+
+        /// Returns the start of the next line
+        const char* skipLine(const char* p, const char* end)
+        {
+            const char* newline = static_cast<const char*>(std::memchr(p, '\n', std::size_t(end - p)));
+            return newline ? newline + 1 : end;
+        }
+
+        /// Parses an integer with an optional sign. Returns p if there is none.
+        const char* parseInt(const char* p, const char* end, int& value)
+        {
+            const char* start = p;
+            bool negative = p < end && *p == '-';
+            if (p < end && (*p == '-' || *p == '+'))
+                ++p;
+
+            const char* digits = p;
+            long long result = 0;
+            for (; p < end && isDigit(*p); ++p)
+                result = std::min(result * 10 + (*p - '0'), 1LL << 40);
+            if (p == digits)
+                return start;
+
+            result = negative ? -result : result;
+            value = int(std::max(-(1LL << 31), std::min(result, (1LL << 31) - 1)));
+            return p;
+        }
+
+        /// Parses a decimal number like 3, -0.25 or 1.5e-3 without going through the C library, which
+        /// needs null terminated strings and looks up the locale for every number. Exact for up to 19
+        /// significant digits and powers of ten up to 22, otherwise off by at most a few ulps of the
+        /// double, far below the precision of the float. Returns p if there is no number.
+        const char* parseFloat(const char* p, const char* end, float& value)
+        {
+            static const double POWERS_OF_TEN[] = {
+                1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+            };
+
+            const char* start = p;
+            bool negative = p < end && *p == '-';
+            if (p < end && (*p == '-' || *p == '+'))
+                ++p;
+
+            // Only the first 19 significant digits fit in the mantissa, the rest are dropped
+            std::uint64_t mantissa = 0;
+            int numDigits = 0;
+            int exponent = 0;
+            bool hasDigits = false;
+            for (; p < end && isDigit(*p); ++p, hasDigits = true)
+            {
+                if (numDigits < 19)
+                {
+                    mantissa = mantissa * 10 + std::uint64_t(*p - '0');
+                    numDigits += mantissa != 0;
+                }
+                else
+                    ++exponent;
+            }
+            if (p < end && *p == '.')
+            {
+                for (++p; p < end && isDigit(*p); ++p, hasDigits = true)
+                {
+                    if (numDigits < 19)
+                    {
+                        mantissa = mantissa * 10 + std::uint64_t(*p - '0');
+                        numDigits += mantissa != 0;
+                        --exponent;
+                    }
+                }
+            }
+            if (!hasDigits)
+                return start;
+
+            if (p < end && (*p == 'e' || *p == 'E'))
+            {
+                int exponentPart;
+                const char* next = parseInt(p + 1, end, exponentPart);
+                if (next != p + 1)
+                {
+                    exponent += exponentPart;
+                    p = next;
+                }
+            }
+
+            double result = double(mantissa);
+            if (exponent != 0 && mantissa != 0)
+            {
+                int magnitude = std::abs(exponent);
+                double scale = magnitude <= 22 ? POWERS_OF_TEN[magnitude] : std::pow(10.0, double(magnitude));
+                result = exponent < 0 ? result / scale : result * scale;
+            }
+            value = float(negative ? -result : result);
+            return p;
+        }
+
+        ///----------------------------------------------
+        /// OBJ
+
+        /// What one chunk of an OBJ file holds. Negative indices count back from the last vertex
+        /// defined so far, which also depends on the chunks before. They are stored relative to the
+        /// first vertex of the chunk until the chunks are put together.
+        struct OBJChunk
+        {
+            std::vector<glm::vec3> vertices;
+            std::vector<glm::ivec3> triangles;
+            std::vector<std::size_t> relativeIndices; // triangle * 3 + corner
+        };
+
+        /// Parses the vertex references of a face line, which can also hold texture coordinate and
+        /// normal indices as in 1/2/3 or 1//3. Polygons become fans around their first corner.
+        const char* parseOBJFace(const char* p, const char* end, OBJChunk& chunk)
+        {
+            int firstCorner = 0, previousCorner = 0;
+            bool firstIsRelative = false, previousIsRelative = false;
+            for (int corner = 0; ; ++corner)
+            {
+                p = skipSpaces(p, end);
+                int index;
+                const char* next = parseInt(p, end, index);
+                if (next == p)
+                    break;
+                p = next;
+                while (p < end && !isSpace(*p) && *p != '\n')
+                    ++p;
+
+                // Index 0 doesn't exist in OBJ, -1 makes the triangles using it get dropped
+                bool isRelative = index < 0;
+                int vertex = isRelative ? int(chunk.vertices.size()) + index : index - 1;
+
+                if (corner >= 2)
+                {
+                    std::size_t position = chunk.triangles.size() * 3;
+                    chunk.triangles.emplace_back(firstCorner, previousCorner, vertex);
+                    if (firstIsRelative)
+                        chunk.relativeIndices.push_back(position);
+                    if (previousIsRelative)
+                        chunk.relativeIndices.push_back(position + 1);
+                    if (isRelative)
+                        chunk.relativeIndices.push_back(position + 2);
+                }
+                if (corner == 0)
+                {
+                    firstCorner = vertex;
+                    firstIsRelative = isRelative;
+                }
+                previousCorner = vertex;
+                previousIsRelative = isRelative;
+            }
+            return p;
+        }
+
+        void parseOBJChunk(const char* p, const char* end, OBJChunk& chunk)
+        {
+            // A rough guess of how much a chunk holds saves most of the reallocations
+            std::size_t numBytes = std::size_t(end - p);
+            chunk.vertices.reserve(numBytes / 64);
+            chunk.triangles.reserve(numBytes / 32);
+
+            while (p < end)
+            {
+                p = skipSpaces(p, end);
+                if (end - p >= 2 && p[0] == 'v' && isSpace(p[1]))
+                {
+                    // Missing coordinates stay 0 so that the vertex still counts for the indices
+                    glm::vec3 vertex(0.0f);
+                    p += 2;
+                    for (int axis = 0; axis < 3; ++axis)
+                        p = parseFloat(skipSpaces(p, end), end, vertex[axis]);
+                    chunk.vertices.push_back(vertex);
+                }
+                else if (end - p >= 2 && p[0] == 'f' && isSpace(p[1]))
+                {
+                    p = parseOBJFace(p + 2, end, chunk);
+                }
+                p = skipLine(p, end);
+            }
+        }
+
+        ///----------------------------------------------
+        /// PLY
+
+        enum class PLYType {
+            INT8,
+            UINT8,
+            INT16,
+            UINT16,
+            INT32,
+            UINT32,
+            FLOAT32,
+            FLOAT64
+        };
+
+        struct PLYProperty
+        {
+            std::string name;
+            PLYType type; // of the items for lists
+            bool isList;
+            PLYType countType;
+        };
+
+        struct PLYElement
+        {
+            std::string name;
+            std::size_t count;
+            std::vector<PLYProperty> properties;
+        };
+
+        bool parsePLYType(const std::string& name, PLYType& type)
+        {
+            if (name == "char" || name == "int8")
+                type = PLYType::INT8;
+            else if (name == "uchar" || name == "uint8")
+                type = PLYType::UINT8;
+            else if (name == "short" || name == "int16")
+                type = PLYType::INT16;
+            else if (name == "ushort" || name == "uint16")
+                type = PLYType::UINT16;
+            else if (name == "int" || name == "int32")
+                type = PLYType::INT32;
+            else if (name == "uint" || name == "uint32")
+                type = PLYType::UINT32;
+            else if (name == "float" || name == "float32")
+                type = PLYType::FLOAT32;
+            else if (name == "double" || name == "float64")
+                type = PLYType::FLOAT64;
+            else
+                return false;
+            return true;
+        }
+
+        std::size_t getPLYTypeSize(PLYType type)
+        {
+            switch (type)
+            {
+                case PLYType::INT8:
+                case PLYType::UINT8:
+                    return 1;
+                case PLYType::INT16:
+                case PLYType::UINT16:
+                    return 2;
+                case PLYType::INT32:
+                case PLYType::UINT32:
+                case PLYType::FLOAT32:
+                    return 4;
+                case PLYType::FLOAT64:
+                    return 8;
+            }
+            return 0;
+        }
+
+        /// Reads one value of the type, swapping the bytes if the file's byte order isn't the machine's
+        double readPLYValue(const char* p, PLYType type, bool swapBytes)
+        {
+            char bytes[8];
+            std::size_t size = getPLYTypeSize(type);
+            for (std::size_t byte = 0; byte < size; ++byte)
+                bytes[byte] = swapBytes ? p[size - 1 - byte] : p[byte];
+
+            switch (type)
+            {
+                case PLYType::INT8: { std::int8_t value; std::memcpy(&value, bytes, size); return value; }
+                case PLYType::UINT8: { std::uint8_t value; std::memcpy(&value, bytes, size); return value; }
+                case PLYType::INT16: { std::int16_t value; std::memcpy(&value, bytes, size); return value; }
+                case PLYType::UINT16: { std::uint16_t value; std::memcpy(&value, bytes, size); return value; }
+                case PLYType::INT32: { std::int32_t value; std::memcpy(&value, bytes, size); return value; }
+                case PLYType::UINT32: { std::uint32_t value; std::memcpy(&value, bytes, size); return value; }
+                case PLYType::FLOAT32: { float value; std::memcpy(&value, bytes, size); return value; }
+                case PLYType::FLOAT64: { double value; std::memcpy(&value, bytes, size); return value; }
+            }
+            return 0.0;
+        }
+
+        /// Size of an element's record, 0 if it has lists and the records differ in size
+        std::size_t getPLYRecordSize(const PLYElement& element)
+        {
+            std::size_t size = 0;
+            for (const PLYProperty& property : element.properties)
+            {
+                if (property.isList)
+                    return 0;
+                size += getPLYTypeSize(property.type);
+            }
+            return size;
+        }
+
+        /// Walks the records of an element with lists one by one. The list of the given property, if any,
+        /// is split into a triangle fan. Returns false if the file ends early.
+        bool readPLYRecords(const char* data, std::size_t size, std::size_t& offset, const PLYElement& element,
+                            int indexProperty, bool swapBytes, std::vector<glm::ivec3>& triangles)
+        {
+            for (std::size_t record = 0; record < element.count; ++record)
+            {
+                for (int property = 0; property < int(element.properties.size()); ++property)
+                {
+                    const PLYProperty& plyProperty = element.properties[property];
+                    std::size_t itemSize = getPLYTypeSize(plyProperty.type);
+                    if (!plyProperty.isList)
+                    {
+                        offset += itemSize;
+                        continue;
+                    }
+
+                    std::size_t countSize = getPLYTypeSize(plyProperty.countType);
+                    if (offset + countSize > size)
+                        return false;
+                    double count = readPLYValue(data + offset, plyProperty.countType, swapBytes);
+                    offset += countSize;
+                    std::size_t numItems = count > 0.0 ? std::size_t(count) : 0;
+                    if (offset + numItems * itemSize > size)
+                        return false;
+
+                    if (property == indexProperty)
+                    {
+                        int first = int(readPLYValue(data + offset, plyProperty.type, swapBytes));
+                        for (std::size_t corner = 2; corner < numItems; ++corner)
+                        {
+                            triangles.emplace_back(
+                                first,
+                                int(readPLYValue(data + offset + (corner - 1) * itemSize, plyProperty.type, swapBytes)),
+                                int(readPLYValue(data + offset + corner * itemSize, plyProperty.type, swapBytes)));
+                        }
+                    }
+                    offset += numItems * itemSize;
+                }
+                if (offset > size)
+                    return false;
+            }
+            return true;
+        }
+
+        ///----------------------------------------------
+
+        /// Removes the triangles that use a vertex that doesn't exist or that have no area, whose
+        /// normal can't be calculated
+        void dropInvalidTriangles(MeshLoader::Mesh& mesh)
+        {
+            std::vector<glm::ivec3>& triangles = mesh.triangleIndices;
+            int numTriangles = int(triangles.size());
+            int numVertices = int(mesh.vertices.size());
+            int numBlocks = (numTriangles + VALIDATION_BLOCK_SIZE - 1) / VALIDATION_BLOCK_SIZE;
+            std::vector<int> numValid(numBlocks);
+
+            // Every block moves its valid triangles to its front first
+#pragma omp parallel for schedule(dynamic)
+            for (int block = 0; block < numBlocks; ++block)
+            {
+                int begin = block * VALIDATION_BLOCK_SIZE;
+                int end = std::min(begin + VALIDATION_BLOCK_SIZE, numTriangles);
+                int numKept = begin;
+                for (int triangle = begin; triangle < end; ++triangle)
+                {
+                    glm::ivec3 indices = triangles[triangle];
+                    if (glm::any(glm::lessThan(indices, glm::ivec3(0)))
+                        || glm::any(glm::greaterThanEqual(indices, glm::ivec3(numVertices))))
+                        continue;
+
+                    glm::vec3 normal = glm::cross(mesh.vertices[indices.y] - mesh.vertices[indices.x],
+                                                  mesh.vertices[indices.z] - mesh.vertices[indices.x]);
+                    if (!(glm::dot(normal, normal) > 0.0f) || std::isinf(glm::dot(normal, normal)))
+                        continue;
+                    triangles[numKept++] = indices;
+                }
+                numValid[block] = numKept - begin;
+            }
+
+            int numKept = 0;
+            for (int block = 0; block < numBlocks; ++block)
+            {
+                int begin = block * VALIDATION_BLOCK_SIZE;
+                if (numKept != begin)
+                    std::copy(triangles.begin() + begin, triangles.begin() + begin + numValid[block],
+                              triangles.begin() + numKept);
+                numKept += numValid[block];
+            }
+
+            if (numKept < numTriangles)
+                std::cout << "Dropped " << numTriangles - numKept << " triangles with invalid indices or no area" << std::endl;
+            triangles.resize(numKept);
+        }
+
+        bool isLittleEndian()
+        {
+            std::uint16_t one = 1;
+            std::uint8_t firstByte;
+            std::memcpy(&firstByte, &one, 1);
+            return firstByte == 1;
+        }
+
+    } // anonymous namespace
+
+    bool MeshLoader::load(const std::string& path, Mesh& mesh)
+    {
+        std::string extension = path.substr(std::min(path.size(), path.find_last_of('.') + 1));
+        std::transform(extension.begin(), extension.end(), extension.begin(),
+                       [](char c) { return char(std::tolower(static_cast<unsigned char>(c))); });
+        if (extension != "obj" && extension != "ply")
+        {
+            std::cout << "Unknown mesh format of " << path << ", use .obj or .ply" << std::endl;
+            return false;
+        }
+
+        MappedFile file;
+        if (!file.open(path))
+            return false;
+
+        bool parsed = extension == "obj" ? parseOBJ(file.getData(), file.getSize(), mesh)
+                                         : parsePLY(file.getData(), file.getSize(), mesh);
+        if (!parsed)
+        {
+            std::cout << "Failed to load the mesh " << path << std::endl;
+            return false;
+        }
+        if (mesh.triangleIndices.empty())
+        {
+            std::cout << "The mesh " << path << " has no triangles" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    ///----------------------------------------------
+
+    bool MeshLoader::parseOBJ(const char* data, std::size_t size, Mesh& mesh)
+    {
+        // The chunks end at line ends, every thread takes a chunk at a time
+        std::vector<const char*> chunkBegins;
+        const char* end = data + size;
+        for (const char* p = data; p < end; )
+        {
+            chunkBegins.push_back(p);
+            p = std::size_t(end - p) > OBJ_CHUNK_SIZE ? skipLine(p + OBJ_CHUNK_SIZE, end) : end;
+        }
+        int numChunks = int(chunkBegins.size());
+        chunkBegins.push_back(end);
+
+        std::vector<OBJChunk> chunks(numChunks);
+#pragma omp parallel for schedule(dynamic)
+        for (int chunk = 0; chunk < numChunks; ++chunk)
+            parseOBJChunk(chunkBegins[chunk], chunkBegins[chunk + 1], chunks[chunk]);
+
+        // Where the vertices and triangles of every chunk go in the mesh
+        std::vector<std::size_t> firstVertex(numChunks + 1, 0);
+        std::vector<std::size_t> firstTriangle(numChunks + 1, 0);
+        for (int chunk = 0; chunk < numChunks; ++chunk)
+        {
+            firstVertex[chunk + 1] = firstVertex[chunk] + chunks[chunk].vertices.size();
+            firstTriangle[chunk + 1] = firstTriangle[chunk] + chunks[chunk].triangles.size();
+        }
+        mesh.vertices.resize(firstVertex[numChunks]);
+        mesh.triangleIndices.resize(firstTriangle[numChunks]);
+
+#pragma omp parallel for schedule(dynamic)
+        for (int chunk = 0; chunk < numChunks; ++chunk)
+        {
+            OBJChunk& objChunk = chunks[chunk];
+            for (std::size_t position : objChunk.relativeIndices)
+                objChunk.triangles[position / 3][int(position % 3)] += int(firstVertex[chunk]);
+
+            std::copy(objChunk.vertices.begin(), objChunk.vertices.end(), mesh.vertices.begin() + firstVertex[chunk]);
+            std::copy(objChunk.triangles.begin(), objChunk.triangles.end(),
+                      mesh.triangleIndices.begin() + firstTriangle[chunk]);
+            objChunk = OBJChunk();
+        }
+
+        dropInvalidTriangles(mesh);
+        return true;
+    }
+
+    ///----------------------------------------------
+
+    bool MeshLoader::parsePLY(const char* data, std::size_t size, Mesh& mesh)
+    {
+        // The header is text, the only part read line by line
+        const char* end = data + size;
+        const char* headerEnd = nullptr;
+        for (const char* line = data; line < end; line = skipLine(line, end))
+        {
+            if (std::size_t(end - line) >= 10 && std::memcmp(line, "end_header", 10) == 0)
+            {
+                headerEnd = skipLine(line, end);
+                break;
+            }
+        }
+        if (size < 4 || std::memcmp(data, "ply", 3) != 0 || !headerEnd)
+        {
+            std::cout << "Not a PLY file" << std::endl;
+            return false;
+        }
+
+        std::istringstream header(std::string(data, headerEnd));
+        std::string line;
+        std::vector<PLYElement> elements;
+        bool fileIsLittleEndian = true;
+        while (std::getline(header, line))
+        {
+            std::istringstream words(line);
+            std::string keyword;
+            words >> keyword;
+            if (keyword == "format")
+            {
+                std::string format;
+                words >> format;
+                if (format != "binary_little_endian" && format != "binary_big_endian")
+                {
+                    std::cout << "Only binary PLY files are supported, not " << format << std::endl;
+                    return false;
+                }
+                fileIsLittleEndian = format == "binary_little_endian";
+            }
+            else if (keyword == "element")
+            {
+                PLYElement element;
+                words >> element.name >> element.count;
+                elements.push_back(element);
+            }
+            else if (keyword == "property" && !elements.empty())
+            {
+                PLYProperty property;
+                std::string typeName;
+                words >> typeName;
+                property.isList = typeName == "list";
+                property.countType = PLYType::UINT8;
+                if (property.isList)
+                {
+                    std::string countTypeName;
+                    words >> countTypeName >> typeName;
+                    if (!parsePLYType(countTypeName, property.countType))
+                        return false;
+                }
+                words >> property.name;
+                if (!parsePLYType(typeName, property.type))
+                {
+                    std::cout << "Unknown PLY property type " << typeName << std::endl;
+                    return false;
+                }
+                elements.back().properties.push_back(property);
+            }
+        }
+
+        bool swapBytes = fileIsLittleEndian != isLittleEndian();
+        std::size_t offset = std::size_t(headerEnd - data);
+        for (const PLYElement& element : elements)
+        {
+            std::size_t recordSize = getPLYRecordSize(element);
+            if (element.name == "vertex")
+            {
+                // Fixed size records, read in parallel
+                int axisProperty[3] = {-1, -1, -1};
+                std::size_t axisOffset[3] = {0, 0, 0};
+                std::size_t propertyOffset = 0;
+                for (int property = 0; property < int(element.properties.size()); ++property)
+                {
+                    const std::string& name = element.properties[property].name;
+                    int axis = name == "x" ? 0 : name == "y" ? 1 : name == "z" ? 2 : -1;
+                    if (axis >= 0)
+                    {
+                        axisProperty[axis] = property;
+                        axisOffset[axis] = propertyOffset;
+                    }
+                    propertyOffset += getPLYTypeSize(element.properties[property].type);
+                }
+                if (recordSize == 0 || axisProperty[0] < 0 || axisProperty[1] < 0 || axisProperty[2] < 0
+                    || offset + element.count * recordSize > size)
+                {
+                    std::cout << "The PLY vertices need x, y and z and no lists" << std::endl;
+                    return false;
+                }
+
+                int numVertices = int(element.count);
+                std::size_t firstVertex = mesh.vertices.size();
+                mesh.vertices.resize(firstVertex + numVertices);
+#pragma omp parallel for
+                for (int vertex = 0; vertex < numVertices; ++vertex)
+                {
+                    const char* record = data + offset + std::size_t(vertex) * recordSize;
+                    for (int axis = 0; axis < 3; ++axis)
+                        mesh.vertices[firstVertex + vertex][axis] = float(readPLYValue(
+                                record + axisOffset[axis], element.properties[axisProperty[axis]].type, swapBytes));
+                }
+                offset += element.count * recordSize;
+                continue;
+            }
+
+            int indexProperty = -1;
+            if (element.name == "face")
+            {
+                for (int property = 0; property < int(element.properties.size()); ++property)
+                {
+                    const PLYProperty& plyProperty = element.properties[property];
+                    if (plyProperty.isList && (plyProperty.name == "vertex_indices" || plyProperty.name == "vertex_index"))
+                        indexProperty = property;
+                }
+            }
+
+            if (indexProperty < 0)
+            {
+                // Skip the element
+                if (recordSize > 0)
+                    offset += element.count * recordSize;
+                else if (!readPLYRecords(data, size, offset, element, -1, swapBytes, mesh.triangleIndices))
+                    return false;
+                if (offset > size)
+                    return false;
+                continue;
+            }
+
+            // When every face is a triangle and the index list is the only list, all records have the
+            // same size and are read in parallel. Otherwise they are walked one by one.
+            const PLYProperty& indexList = element.properties[indexProperty];
+            std::size_t countSize = getPLYTypeSize(indexList.countType);
+            std::size_t indexSize = getPLYTypeSize(indexList.type);
+            std::size_t countOffset = 0, triangleSize = 0;
+            int numLists = 0;
+            for (int property = 0; property < int(element.properties.size()); ++property)
+            {
+                const PLYProperty& plyProperty = element.properties[property];
+                if (property == indexProperty)
+                    countOffset = triangleSize;
+                numLists += plyProperty.isList ? 1 : 0;
+                triangleSize += plyProperty.isList ? countSize + 3 * indexSize : getPLYTypeSize(plyProperty.type);
+            }
+
+            int numFaces = int(element.count);
+            int numNonTriangles = numLists == 1 && offset + element.count * triangleSize <= size ? 0 : 1;
+            if (numNonTriangles == 0)
+            {
+#pragma omp parallel for reduction(+:numNonTriangles)
+                for (int face = 0; face < numFaces; ++face)
+                {
+                    const char* count = data + offset + std::size_t(face) * triangleSize + countOffset;
+                    numNonTriangles += readPLYValue(count, indexList.countType, swapBytes) == 3.0 ? 0 : 1;
+                }
+            }
+
+            if (numNonTriangles > 0)
+            {
+                if (!readPLYRecords(data, size, offset, element, indexProperty, swapBytes, mesh.triangleIndices))
+                    return false;
+                continue;
+            }
+
+            std::size_t firstTriangle = mesh.triangleIndices.size();
+            mesh.triangleIndices.resize(firstTriangle + numFaces);
+#pragma omp parallel for
+            for (int face = 0; face < numFaces; ++face)
+            {
+                const char* indices = data + offset + std::size_t(face) * triangleSize + countOffset + countSize;
+                for (int corner = 0; corner < 3; ++corner)
+                    mesh.triangleIndices[firstTriangle + face][corner] =
+                            int(readPLYValue(indices + corner * indexSize, indexList.type, swapBytes));
+            }
+            offset += element.count * triangleSize;
+        }
+
+        dropInvalidTriangles(mesh);
+        return true;
+    }
+
+} // namespace rayTracer
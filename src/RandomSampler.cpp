@@ -0,0 +1,66 @@
+#include <RandomSampler.h>
+
+namespace rayTracer {
+
+    namespace {
+
+        /// The PCG hash of one 32 bit value
+        std::uint32_t pcgHash(std::uint32_t value)
+        {
+            std::uint32_t state = value * 747796405u + 2891336453u;
+            std::uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+            return (word >> 22u) ^ word;
+        }
+
+        /// The 4D PCG hash by Jarzynski and Olano, every bit of the result depends on all four inputs.
+        /// Only the first component is used.
+        std::uint32_t pcg4dHash(std::uint32_t x, std::uint32_t y, std::uint32_t z, std::uint32_t w)
+        {
+            x = x * 1664525u + 1013904223u;
+            y = y * 1664525u + 1013904223u;
+            z = z * 1664525u + 1013904223u;
+            w = w * 1664525u + 1013904223u;
+
+            x += y * w; y += z * x; z += x * y; w += y * z;
+
+            x ^= x >> 16u; y ^= y >> 16u; z ^= z >> 16u; w ^= w >> 16u;
+
+            x += y * w; y += z * x; z += x * y; w += y * z;
+            return x;
+        }
+
+    } // anonymous namespace
+
+    RandomSampler::RandomSampler()
+        : pixelKey(0), sample(0), bounce(0), dimension(0)
+    { }
+
+    ///----------------------------------------------
+
+    RandomSampler::RandomSampler(std::uint32_t pixel, std::uint32_t inSample, std::uint32_t seed)
+        : pixelKey(pixel ^ pcgHash(seed))
+        , sample(inSample)
+        , bounce(0)
+        , dimension(0)
+    { }
+
+    ///----------------------------------------------
+
+    float RandomSampler::next()
+    {
+        // The top 24 bits fill the mantissa exactly, so the result never rounds up to 1
+        std::uint32_t bits = pcg4dHash(pixelKey, sample, bounce, dimension++);
+        return float(bits >> 8) * (1.0f / 16777216.0f);
+    }
+
+    ///----------------------------------------------
+
+    RandomSampler RandomSampler::nextBounce() const
+    {
+        RandomSampler sampler = *this;
+        ++sampler.bounce;
+        sampler.dimension = 0;
+        return sampler;
+    }
+
+} // namespace rayTracer
@@ -1,163 +1,80 @@
 #include <Ray.h>
 #include <MaterialProperties.h>
-#include <gtx/rotate_vector.hpp>
-#include <gtx/norm.hpp>
 
 namespace rayTracer {
 
-    namespace {
-        void convertToSphericalCoords(const glm::vec3 direction, float &azimuth, float &inclination)
-        {
-            glm::vec3 normalizedDir = glm::normalize(direction);
-            azimuth = glm::atan(normalizedDir.y / normalizedDir.x);
-            inclination = glm::atan(glm::sqrt(glm::pow(normalizedDir.x, 2) + glm::pow(normalizedDir.y, 2)) / normalizedDir.z);
-        }
-    } // anonymous namespace
-
-    Ray::Ray(glm::vec3 inStartPoint, glm::vec3 inDirection)
-    : startPoint(inStartPoint), direction(glm::normalize(inDirection)), rayIntersection(nullptr)
+    Ray::Ray()
+    : startPoint(0.0f), direction(0.0f, 0.0f, 1.0f), intersected(false)
     { }
 
     ///----------------------------------------------
 
-    float Ray::lengthSquared() const
-    {
-        if (!rayIntersection)
-            return -1;
-
-        return glm::length2(rayIntersection->intersectionPoint - startPoint);
-    }
-
-    ///----------------------------------------------
-
-    bool Ray::foundCloserRayIntersection(float newDistanceToOrigin)
-    {
-        return (!rayIntersection || rayIntersection->distanceToRayOrigin > newDistanceToOrigin );
-    }
+    Ray::Ray(glm::vec3 inStartPoint, glm::vec3 inDirection)
+    : startPoint(inStartPoint), direction(glm::normalize(inDirection)), intersected(false)
+    { }
 
     ///----------------------------------------------
 
-    void Ray::updateRayIntersection(std::shared_ptr<Intersection> newRayIntersection)
+    void Ray::updateRayIntersection(const Intersection& newRayIntersection)
     {
         rayIntersection = newRayIntersection;
+        intersected = true;
     }
 
     ///----------------------------------------------
 
-    std::shared_ptr<Ray> Ray::generateReflectedRay(std::mt19937* randGenerator,
-                                                   std::uniform_real_distribution<float>* randDistribution) const
+    Ray Ray::generateReflectedRay(const MaterialProperties& material, RandomSampler& sampler,
+                                  glm::vec3& weight, float& pdf) const
     {
-        if (!rayIntersection)
-            return nullptr;
-
         // Offset to add to the reflected ray's start position to make sure we don't
         // start inside the intersected object
-        glm::vec3 offset = 0.00001f * rayIntersection->normal;
-        glm::vec3 reflectedStartPosition = rayIntersection->intersectionPoint + offset;
-
-        glm::vec3 reflectedDir = glm::vec3(0.0f);
-
-        if (std::dynamic_pointer_cast<PerfectMirrorMaterial>(rayIntersection->material))
-        {
-            // Create perfect reflected ray
-            reflectedDir = glm::reflect(direction, rayIntersection->normal);
-        }
-        else
-        {
-            // Create a random reflected ray
-            reflectedDir = generateRandomReflectedRayDirection(randGenerator, randDistribution);
-        }
-
-        return std::make_shared<Ray>(reflectedStartPosition, reflectedDir);
-    }
+        glm::vec3 offset = 0.00001f * rayIntersection.normal;
+        glm::vec3 reflectedStartPosition = rayIntersection.intersectionPoint + offset;
 
-    ///----------------------------------------------
+        // The material picks the direction in the shading frame
+        const ShadingFrame& frame = rayIntersection.frame;
+        glm::vec3 reflectedDirLocal;
+        weight = material.sample(frame.toLocal(-direction), sampler, reflectedDirLocal, pdf);
 
-    glm::vec3 Ray::generateRandomReflectedRayDirection(
-            std::mt19937* randGenerator,
-            std::uniform_real_distribution<float>* randDistribution) const
-    {
-        // Uniform distribution over a hemisphere
-        float randAzimuth = (*randDistribution)(*randGenerator);
-        float randInclination = (*randDistribution)(*randGenerator);
-
-        float inclination = glm::acos(glm::sqrt(randInclination));
-        float azimuth = (2.f * glm::pi<float>() * randAzimuth);
-
-        // Calculate tangent vector
-        glm::vec3 tangent = direction - glm::dot(direction, rayIntersection->normal) * rayIntersection->normal;
-
-        // Create the randomized direction
-        glm::vec3 reflectedDir = rayIntersection->normal;
-        reflectedDir = glm::normalize(glm::rotate(
-                reflectedDir,
-                inclination,
-                tangent));
-        reflectedDir = glm::normalize(glm::rotate(
-                reflectedDir,
-                azimuth,
-                rayIntersection->normal));
-
-        return reflectedDir;
+        return Ray(reflectedStartPosition, frame.toWorld(reflectedDirLocal));
     }
 
     ///----------------------------------------------
 
-    std::shared_ptr<Ray> Ray::generateRefractedRay() const
+    bool Ray::generateRefractedRay(Ray& /*refractedRay*/) const
     {
-        if(!rayIntersection)
-            return nullptr;
+        if(!intersected)
+            return false;
 
         // TODO: Implement
 
-        return nullptr;
+        return false;
     }
 
     ///----------------------------------------------
 
-    std::shared_ptr<Ray> Ray::generateShadowRay(glm::vec3 pointOnLightSource) const
+    Ray Ray::generateShadowRay(glm::vec3 pointOnLightSource) const
     {
-        glm::vec3 offset = 0.00001f * rayIntersection->normal;
-        glm::vec3 shadowRayStartPosition = rayIntersection->intersectionPoint + offset;
+        glm::vec3 offset = 0.00001f * rayIntersection.normal;
+        glm::vec3 shadowRayStartPosition = rayIntersection.intersectionPoint + offset;
         glm::vec3 shadowRayDirection = pointOnLightSource - shadowRayStartPosition;
 
-        return std::make_shared<Ray>(shadowRayStartPosition, shadowRayDirection);
-    }
-
-    ///----------------------------------------------
-
-    glm::vec3 Ray::getValueOfBRDF(std::shared_ptr<Ray> reflectedRay) const
-    {
-        // Convert to local space
-        glm::mat4 worldToLocal = rayIntersection->getWorldToLocalMatrix(direction);
-        glm::vec3 wInLocal = glm::vec3(worldToLocal * glm::vec4(direction, 1.0f));
-        glm::vec3 wOutLocal = glm::vec3(worldToLocal * glm::vec4(reflectedRay->getDirection(), 1.0f));
-
-        // Convert to hemispherical coordinates
-        float wInAzimuth, wInInclination, wOutAzimuth, wOutInclination;
-        convertToSphericalCoords(wInLocal, wInAzimuth, wInInclination);
-        convertToSphericalCoords(wOutLocal, wOutAzimuth, wOutInclination);
-
-        return rayIntersection->material->getBRDF(wInAzimuth, wInInclination, wOutAzimuth, wOutInclination);
+        return Ray(shadowRayStartPosition, shadowRayDirection);
     }
 
     ///----------------------------------------------
 
-    bool Ray::hitsDiffuseObject() const
+    void Ray::getValuesOfBRDF(const MaterialProperties& material, const glm::vec3* directions, int count,
+                              glm::vec3* values, float* pdfs) const
     {
-        return !(std::dynamic_pointer_cast<PerfectMirrorMaterial>(rayIntersection->material)
-                 || std::dynamic_pointer_cast<EmissiveMaterial>(rayIntersection->material));
-
-    }
-
-    ///----------------------------------------------
-
-    bool Ray::hitsEmissiveObject() const
-    {
-        if (std::dynamic_pointer_cast<EmissiveMaterial>(rayIntersection->material))
-            return true;
-
-        return false;
+        // The local directions go where the values end up, the material evaluates them in place
+        const ShadingFrame& frame = rayIntersection.frame;
+        for (int i = 0; i < count; ++i)
+            values[i] = frame.toLocal(directions[i]);
+
+        glm::vec3 wOut = frame.toLocal(-direction);
+        material.getPDFs(values, count, wOut, pdfs);
+        material.getBRDFs(values, count, wOut, values);
     }
 
-} // namespace rayTracer
\ No newline at end of file
+} // namespace rayTracer
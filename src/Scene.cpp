@@ -1,16 +1,105 @@
 #include <Scene.h>
+#include <AllocationCounter.h>
+#include <CheckpointWriter.h>
+#include <SceneCache.h>
 #include <SceneObject.h>
 #include <MaterialProperties.h>
 #include <Ray.h>
+#include <WavefrontIntegrator.h>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <gtx/norm.hpp>
 #include <gtx/string_cast.hpp>
 #include <iostream>
 #include <iomanip>
+#include <limits>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace rayTracer {
 
     namespace {
 
+        int getMaxThreads() {
+#ifdef _OPENMP
+            return omp_get_max_threads();
+#else
+            return 1;
+#endif
+        }
+
+        int getThreadIndex() {
+#ifdef _OPENMP
+            return omp_get_thread_num();
+#else
+            return 0;
+#endif
+        }
+
+        /// Running mean and variance of the samples of one pixel, per color channel with Welford's algorithm
+        struct PixelEstimate
+        {
+            PixelEstimate() : numSamples(0), sum(0.0f), mean(0.0f), m2(0.0f) { }
+
+            void addSample(glm::vec3 sample)
+            {
+                ++numSamples;
+                sum += sample;
+
+                glm::vec3 delta = sample - mean;
+                mean += delta / float(numSamples);
+                m2 += delta * (sample - mean);
+            }
+
+            /// The plain sum is divided here so that the pixels come out the same as without the estimate
+            glm::vec3 getMean() const { return sum / float(glm::max(numSamples, 1)); }
+
+            /// Squared standard error of the mean averaged over the channels, infinite with fewer than two samples
+            float getSquaredStandardError() const
+            {
+                if (numSamples < 2)
+                    return std::numeric_limits<float>::infinity();
+                glm::vec3 variance = m2 / float(numSamples - 1);
+                return (variance.r + variance.g + variance.b) / (3.0f * float(numSamples));
+            }
+
+            int numSamples;
+            glm::vec3 sum;
+            glm::vec3 mean;
+            glm::vec3 m2;
+        };
+
+        /// Returns true if the block of pixels should get another sample. Without adaptive sampling every
+        /// pixel gets numSamples, otherwise that's the minimum and the noisy blocks get more. The error is
+        /// pooled over the block, deciding per pixel stops too early on pixels that happen to look smooth
+        /// and darkens the image.
+        bool needsMoreSamples(const PixelEstimate* estimates, int numPixels, int numSamples, const RenderSettings& settings)
+        {
+            int numSamplesTaken = estimates[0].numSamples;
+            if (numSamplesTaken < numSamples)
+                return true;
+            if (!settings.useAdaptiveSampling || numSamplesTaken >= settings.maxSubSamplesPerPixel)
+                return false;
+
+            float sumSquaredErrors = 0.0f;
+            for (int pixel = 0; pixel < numPixels; ++pixel)
+                sumSquaredErrors += estimates[pixel].getSquaredStandardError();
+            return sumSquaredErrors > float(numPixels) * settings.adaptiveErrorThreshold * settings.adaptiveErrorThreshold;
+        }
+
+        void displayProgress(int percentageDone) {
+            std::cout << "[" << std::setw(3) << percentageDone << "%] ";
+            if (percentageDone == 0)
+                std::cout << "Starting off";
+            else if (percentageDone == 50)
+                std::cout << "Halfway there!";
+            else if (percentageDone == 100)
+                std::cout << "Done!";
+            std::cout << std::endl;
+        }
+
         void displayTimeTaken(int timeInMilliSeconds) {
             int timeInMinutes = (timeInMilliSeconds / 1000) / 60;
             float restSeconds = (float(timeInMilliSeconds) / 1000.0f) - float(timeInMinutes) * 60;
@@ -21,23 +110,69 @@ namespace rayTracer {
             std::cout << restSeconds << "s " << std::endl;
         }
 
+        void displayTraversalStatistics(const BVH::TraversalStatistics& statistics, bool usedAccelerationStructure) {
+            double numRays = double(std::max(statistics.numRays, 1LL));
+            std::cout << "Rays traced: " << statistics.numRays
+                      << (usedAccelerationStructure ? " (BVH)" : " (linear scan)")
+                      << ", nodes visited per ray: " << double(statistics.numNodesVisited) / numRays
+                      << ", primitives tested per ray: " << double(statistics.numPrimitivesTested) / numRays
+                      << std::endl;
+        }
+
+        void displaySampleStatistics(const Camera& camera) {
+            int numPixels = camera.getPixelWidth() * camera.getPixelHeight();
+            long long numSamples = 0;
+            int maxSamples = 0;
+            for (int i = 0; i < camera.getPixelHeight(); i++) {
+                for (int j = 0; j < camera.getPixelWidth(); j++) {
+                    numSamples += camera.getPixelSampleCount(i, j);
+                    maxSamples = std::max(maxSamples, camera.getPixelSampleCount(i, j));
+                }
+            }
+            std::cout << "Samples per pixel: " << double(numSamples) / double(std::max(numPixels, 1))
+                      << " on average, at most " << maxSamples << std::endl;
+        }
+
+        void displayGeometryStatistics(const GeometryStore& geometry) {
+            int numTriangles = geometry.getNumTriangles();
+            int numSpheres = geometry.getNumSpheres();
+            std::cout << "Geometry: " << numTriangles << " triangles ("
+                      << double(geometry.getTriangleMemoryUsage()) / double(std::max(numTriangles, 1)) << " bytes each), "
+                      << numSpheres << " spheres ("
+                      << double(geometry.getSphereMemoryUsage()) / double(std::max(numSpheres, 1)) << " bytes each)"
+                      << std::endl;
+
+            int numInstances = geometry.getNumInstances();
+            if (numInstances > 0)
+            {
+                std::cout << "Instances: " << numInstances << " of " << geometry.getNumMeshes() << " meshes ("
+                          << double(geometry.getInstanceMemoryUsage()) / double(numInstances) << " bytes each)"
+                          << std::endl;
+            }
+        }
+
+        /// Multiple importance sampling weight of a sample from a strategy that takes numSamples
+        /// samples with the given pdf, against one taking otherNumSamples with otherPdf
+        float powerHeuristic(float numSamples, float pdf, float otherNumSamples, float otherPdf)
+        {
+            float weighted = numSamples * pdf;
+            float otherWeighted = otherNumSamples * otherPdf;
+            return weighted * weighted / (weighted * weighted + otherWeighted * otherWeighted);
+        }
+
     } // anonymous namespace
 
     Scene::Scene()
-        : renderSettings(RenderSettings())
-    {
-        std::random_device rd;
-        gen = new std::mt19937(rd());
-        dis = new std::uniform_real_distribution<float>(0, 1);
-    }
+        : geometryIsDirty(true)
+        , geometryIsReleased(false)
+        , renderSettings(RenderSettings())
+        , numAllocationsWhileTracing(0)
+        , checkpointWriter(outputThread)
+    { }
 
     ///----------------------------------------------
 
-    Scene::~Scene()
-    {
-        delete gen;
-        delete dis;
-    }
+    Scene::~Scene() = default;
 
     ///----------------------------------------------
 
@@ -50,83 +185,773 @@ namespace rayTracer {
         }
             
         std::shared_ptr<Camera> camera = sceneCameras.at(cameraName);
-        int pixelWidth = camera->getPixelWidth();
-        int pixelHeight = camera->getPixelHeight();
 
         renderSettings = settings;
-
-        // For randomness in the ray generation
-        std::random_device rd;
-        std::mt19937 genHalf(rd());
-        std::uniform_real_distribution<float> disHalf(-0.5, 0.5);
+        compileGeometry();
 
         // For calculating time taken
         auto startTime = std::chrono::high_resolution_clock::now();
 
-        // Calculate the pixel values by sending out rays into the scene
+        // Combinations that aren't supported fall back to the simpler mode. The wavefront integrator
+        // renders rows instead of tiles so its shards always split the samples.
+        renderSettings.packetSize = glm::clamp(renderSettings.packetSize, 1, 8);
+        renderSettings.numShards = renderSettings.useProgressiveRendering ? 1 : glm::max(1, renderSettings.numShards);
+        renderSettings.shardIndex = glm::clamp(renderSettings.shardIndex, 0, renderSettings.numShards - 1);
+        renderSettings.shardBySamples = renderSettings.shardBySamples || renderSettings.useWavefrontIntegrator;
+        bool isSharded = renderSettings.numShards > 1;
+        renderSettings.useAdaptiveSampling = renderSettings.useAdaptiveSampling
+                && !renderSettings.useProgressiveRendering && !renderSettings.useWavefrontIntegrator
+                && !(isSharded && renderSettings.shardBySamples);
+        renderSettings.useStreamingOutput = renderSettings.useStreamingOutput && !renderSettings.useProgressiveRendering
+                && !renderSettings.useWavefrontIntegrator && !isSharded;
+
+        // Streamed images never have the whole frame in memory. Otherwise the pixels that aren't
+        // rendered, like those of the other shards, are left empty.
+        if (!renderSettings.useStreamingOutput)
+            camera->clearPixels();
+
+        int firstSample = 0;
+        int numSamples = renderSettings.numSubSamplesPerPixel;
+        if (isSharded && renderSettings.shardBySamples)
+        {
+            firstSample = renderSettings.numSubSamplesPerPixel * renderSettings.shardIndex / renderSettings.numShards;
+            numSamples = renderSettings.numSubSamplesPerPixel * (renderSettings.shardIndex + 1) / renderSettings.numShards
+                    - firstSample;
+        }
+
+        // Everything the render needs is set up before the allocations are counted, a pass is one sample
+        prepareRendering(*camera, renderSettings.useProgressiveRendering ? 1 : numSamples);
+        int firstPass = renderSettings.useProgressiveRendering ? prepareProgressive(*camera) : 0;
+
+        BVH::TraversalStatistics statistics;
+        long long numAllocationsBefore = AllocationCounter::getNumAllocations();
+        if (renderSettings.useProgressiveRendering)
+            renderProgressive(*camera, firstPass, statistics);
+        else if (numSamples <= 0)
+            std::cout << "Shard " << renderSettings.shardIndex << " has no samples to render" << std::endl;
+        else if (renderSettings.useWavefrontIntegrator)
+            renderWavefront(*camera, firstSample, numSamples, true, statistics);
+        else if (renderSettings.useStreamingOutput)
+            renderStreaming(*camera, firstSample, numSamples, statistics);
+        else
+            renderTiles(*camera, firstSample, numSamples, true, statistics);
+
+        numAllocationsWhileTracing = AllocationCounter::getNumAllocations() - numAllocationsBefore;
+        wavefrontIntegrator.reset();
+
+        // A shard only writes its part, the image is put together by Camera::mergePartialResults
+        if (isSharded)
+        {
+            camera->writePartialResult(Camera::getPartialResultPath(renderSettings.outputPath, renderSettings.shardIndex,
+                                                                    renderSettings.numShards));
+        }
+        else if (!renderSettings.useStreamingOutput)
+        {
+            // Generate the image from the pixel values
+            camera->generateImage(renderSettings.outputPath, renderSettings.displaySettings);
+            if (renderSettings.useAdaptiveSampling)
+                camera->generateSampleCountImage(Camera::getSampleCountImagePath(renderSettings.outputPath));
+        }
+
+        // Calculate time taken
+        auto endTime = std::chrono::high_resolution_clock::now();
+        displayTimeTaken(int(std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count()));
+        displayTraversalStatistics(statistics, renderSettings.useAccelerationStructure);
+        if (renderSettings.useAdaptiveSampling && !renderSettings.useStreamingOutput)
+            displaySampleStatistics(*camera);
+        std::cout << "Heap allocations while tracing: " << numAllocationsWhileTracing << std::endl;
+    }
+
+    ///----------------------------------------------
+
+    void Scene::prepareRendering(Camera& camera, int numSamples)
+    {
+        // Bands and passes never have more tiles than the whole image
+        bool isShardedByTiles = renderSettings.numShards > 1 && !renderSettings.shardBySamples;
+        tileScheduler.reset(camera.getPixelWidth(), camera.getPixelHeight(), getTileSize(), getMaxThreads(),
+                            isShardedByTiles ? renderSettings.shardIndex : 0,
+                            isShardedByTiles ? renderSettings.numShards : 1);
+
+        int tileSize = getTileSize();
+        tileBuffers.resize(getMaxThreads());
+        for (TileBuffer& tileBuffer : tileBuffers)
+        {
+            tileBuffer.pixels.resize(tileSize * tileSize);
+            tileBuffer.sampleCounts.resize(tileSize * tileSize);
+        }
+
+        if (renderSettings.useWavefrontIntegrator)
+        {
+            int rowsPerBatch = glm::min(getWavefrontRowsPerBatch(camera, numSamples), camera.getPixelHeight());
+            wavefrontIntegrator.reset(new WavefrontIntegrator(*this, rowsPerBatch * camera.getPixelWidth()
+                                                              * glm::max(1, numSamples)));
+        }
+
+        // The streamed image is written a band of tile rows at a time
+        if (renderSettings.useStreamingOutput)
+        {
+            int pixelWidth = camera.getPixelWidth();
+            streamingOutput.written = streamingOutput.imageWriter.open(renderSettings.outputPath, pixelWidth,
+                    camera.getPixelHeight(), renderSettings.displaySettings, tileSize);
+            for (int band = 0; band < 2; ++band)
+            {
+                streamingOutput.bands[band].pixels.resize(std::size_t(pixelWidth) * tileSize);
+                streamingOutput.bands[band].sampleCounts.resize(std::size_t(pixelWidth) * tileSize);
+                streamingOutput.bandRows[band].resize(tileSize);
+                for (int row = 0; row < tileSize; ++row)
+                    streamingOutput.bandRows[band][row] = &streamingOutput.bands[band].pixels[std::size_t(row) * pixelWidth];
+            }
+        }
+
+        if (renderSettings.useStreamingOutput || renderSettings.checkpointEveryXPasses > 0)
+            outputThread.start();
+    }
+
+    ///----------------------------------------------
+
+    int Scene::getWavefrontRowsPerBatch(const Camera& camera, int numSamples) const
+    {
+        int pathsPerRow = camera.getPixelWidth() * glm::max(1, numSamples);
+        return glm::max(1, renderSettings.wavefrontPathsPerBatch / pathsPerRow);
+    }
+
+    ///----------------------------------------------
+
+    int Scene::prepareProgressive(Camera& camera)
+    {
+        // Continue from the pass after the last one that was checkpointed
+        std::string checkpointPath = Camera::getCheckpointPath(renderSettings.outputPath);
+        int firstPass = 0;
+        camera.clearAccumulation();
+        if (renderSettings.resumeFromCheckpoint && camera.loadAccumulation(checkpointPath, renderSettings.randomSeed))
+        {
+            firstPass = camera.getNumAccumulatedPasses();
+            std::cout << "Resuming after pass " << firstPass << std::endl;
+        }
+
+        // The checkpoint data and the buffer of the writer that it is swapped with stay the same size
+        if (renderSettings.checkpointEveryXPasses > 0)
+        {
+            camera.serializeAccumulation(renderSettings.randomSeed, checkpointData);
+            checkpointWriter.prepare(checkpointPath, checkpointData.size());
+        }
+        return firstPass;
+    }
+
+    ///----------------------------------------------
+
+    void Scene::renderProgressive(Camera& camera, int firstPass, BVH::TraversalStatistics& statistics)
+    {
+        // Without any limit set the render stops at the usual number of samples
+        int maxPasses = renderSettings.maxPasses;
+        if (maxPasses <= 0 && renderSettings.maxRenderTimeSeconds <= 0.0f && renderSettings.convergenceThreshold <= 0.0f)
+            maxPasses = glm::max(1, renderSettings.numSubSamplesPerPixel);
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+        for (int pass = firstPass; maxPasses <= 0 || pass < maxPasses; ++pass)
+        {
+            // Every pass adds one sample to each pixel, the pass number picks the random numbers
+            if (renderSettings.useWavefrontIntegrator)
+                renderWavefront(camera, pass, 1, false, statistics);
+            else
+                renderTiles(camera, pass, 1, false, statistics);
+            camera.accumulatePass();
+
+            int numPasses = pass + 1;
+            float secondsTaken = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - startTime).count();
+            float relativeError = camera.estimateRelativeError();
+            std::cout << "Pass " << numPasses << ": " << secondsTaken << "s, estimated relative error " << relativeError
+                      << std::endl;
+
+            bool reachedPasses = maxPasses > 0 && numPasses >= maxPasses;
+            bool reachedTime = renderSettings.maxRenderTimeSeconds > 0.0f && secondsTaken >= renderSettings.maxRenderTimeSeconds;
+            bool converged = relativeError < renderSettings.convergenceThreshold;
+            bool isLastPass = reachedPasses || reachedTime || converged;
+
+            // The last pass is always checkpointed so that a finished render can be continued with more
+            // passes. The checkpoints are written while the next passes render.
+            if (renderSettings.checkpointEveryXPasses > 0
+                && (isLastPass || numPasses % renderSettings.checkpointEveryXPasses == 0))
+            {
+                camera.serializeAccumulation(renderSettings.randomSeed, checkpointData);
+                checkpointWriter.write(checkpointData);
+            }
+
+            if (isLastPass)
+                break;
+
+            // The final image is written by render()
+            if (renderSettings.outputImageEveryXPasses > 0 && numPasses % renderSettings.outputImageEveryXPasses == 0)
+                camera.generateImage(renderSettings.outputPath, renderSettings.displaySettings);
+        }
+
+        // The last checkpoint is complete when the render returns
+        checkpointWriter.wait();
+    }
+
+    ///----------------------------------------------
+
+    void Scene::renderTiles(Camera& camera, int firstSample, int numSamples, bool showProgress,
+                            BVH::TraversalStatistics& statistics)
+    {
+        renderTileRows(camera, 0, camera.getPixelHeight(), firstSample, numSamples, showProgress, nullptr, statistics);
+    }
+
+    ///----------------------------------------------
+
+    void Scene::renderStreaming(Camera& camera, int firstSample, int numSamples, BVH::TraversalStatistics& statistics)
+    {
+        // The file and the bands were set up by prepareRendering()
+        if (!streamingOutput.written)
+            return;
+
+        // The image is rendered a band of tile rows at a time. A band is written on the output thread
+        // while the next one renders, so there are only ever two bands in memory.
+        int pixelHeight = camera.getPixelHeight();
+        int bandHeight = getTileSize();
+        int lastPercentageOutputted = -1;
+        for (int firstRow = 0, band = 0; firstRow < pixelHeight; firstRow += bandHeight, band = 1 - band)
+        {
+            int lastRow = glm::min(firstRow + bandHeight, pixelHeight);
+            renderTileRows(camera, firstRow, lastRow, firstSample, numSamples, false, &streamingOutput.bands[band],
+                           statistics);
+
+            // Waits for the other band to be written first
+            int numRows = lastRow - firstRow;
+            outputThread.run([this, band, numRows]() {
+                streamingOutput.written = streamingOutput.imageWriter.writeRows(streamingOutput.bandRows[band].data(),
+                                                                                numRows) && streamingOutput.written;
+            });
+
+            // Print out progress every x% done
+            int percentageDone = int(float(lastRow) / float(pixelHeight) * 100);
+            if (percentageDone % renderSettings.outputProgressEveryXPercent == 0
+                && percentageDone != lastPercentageOutputted)
+            {
+                displayProgress(percentageDone);
+                lastPercentageOutputted = percentageDone;
+            }
+        }
+
+        outputThread.wait();
+        if (!streamingOutput.imageWriter.close() || !streamingOutput.written)
+            std::cout << "The streamed image " << renderSettings.outputPath << " is incomplete" << std::endl;
+    }
+
+    ///----------------------------------------------
+
+    void Scene::renderTileRows(Camera& camera, int firstRow, int lastRow, int firstSample, int numSamples,
+                               bool showProgress, TileBuffer* rowsBuffer, BVH::TraversalStatistics& statistics)
+    {
+        int tileSize = getTileSize();
+        int pixelWidth = camera.getPixelWidth();
+
+        // Shards that split the image take every numShards'th tile
+        bool isShardedByTiles = renderSettings.numShards > 1 && !renderSettings.shardBySamples;
+        tileScheduler.reset(pixelWidth, lastRow - firstRow, tileSize, getMaxThreads(),
+                            isShardedByTiles ? renderSettings.shardIndex : 0,
+                            isShardedByTiles ? renderSettings.numShards : 1);
+        int numTiles = tileScheduler.getNumTiles();
+        std::atomic<int> numTilesDone(0);
         int lastPercentageOutputted = -1;
-        for (int i = 0; i < pixelHeight; i++)
+
+        // One parallel region for the whole image, the threads keep pulling tiles until none are left
+        long long numRays = 0, numNodesVisited = 0, numPrimitivesTested = 0;
+#pragma omp parallel reduction(+:numRays, numNodesVisited, numPrimitivesTested)
         {
-#pragma omp parallel for
-            for (int j = 0; j < pixelWidth; j++) {
-                glm::vec3 finalColor = glm::vec3(0.0f);
-                for (int subSample = 0; subSample < renderSettings.numSubSamplesPerPixel; ++subSample)
+            BVH::TraversalStatistics threadStatistics;
+            TileBuffer& tileBuffer = tileBuffers[getThreadIndex()];
+
+            TileScheduler::Tile tile;
+            while (tileScheduler.nextTile(getThreadIndex(), tile))
+            {
+                // The scheduler counts the rows from the first one
+                tile.firstRow += firstRow;
+                tile.lastRow += firstRow;
+                renderTile(camera, tile, firstSample, numSamples, tileBuffer, threadStatistics);
+
+                // The tiles don't overlap so they are copied to the image without any locking
+                int tileWidth = tile.lastColumn - tile.firstColumn;
+                for (int i = tile.firstRow; i < tile.lastRow; i++)
                 {
-                    std::shared_ptr<Ray> newRay = camera->createCameraRay(j, pixelHeight - i - 1, disHalf(genHalf), disHalf(genHalf));
-                    finalColor += traceRay(newRay);
+                    for (int j = tile.firstColumn; j < tile.lastColumn; j++)
+                    {
+                        int index = (i - tile.firstRow) * tileWidth + j - tile.firstColumn;
+                        if (rowsBuffer)
+                        {
+                            std::size_t rowsIndex = std::size_t(i - firstRow) * pixelWidth + j;
+                            rowsBuffer->pixels[rowsIndex] = tileBuffer.pixels[index];
+                            rowsBuffer->sampleCounts[rowsIndex] = tileBuffer.sampleCounts[index];
+                            continue;
+                        }
+                        camera.setPixelValue(i, j, tileBuffer.pixels[index]);
+                        camera.setPixelSampleCount(i, j, tileBuffer.sampleCounts[index]);
+                    }
                 }
 
-                camera->setPixelValue(i, j, finalColor / float(renderSettings.numSubSamplesPerPixel));
+                int percentageDone = int(float(++numTilesDone) / float(numTiles) * 100);
+                if (showProgress && percentageDone % renderSettings.outputProgressEveryXPercent == 0)
+                {
+#pragma omp critical
+                    {
+                        if (percentageDone > lastPercentageOutputted)
+                        {
+                            displayProgress(percentageDone);
+                            lastPercentageOutputted = percentageDone;
+                        }
+                    }
+                }
             }
 
+            numRays += threadStatistics.numRays;
+            numNodesVisited += threadStatistics.numNodesVisited;
+            numPrimitivesTested += threadStatistics.numPrimitivesTested;
+        }
+        statistics.numRays += numRays;
+        statistics.numNodesVisited += numNodesVisited;
+        statistics.numPrimitivesTested += numPrimitivesTested;
+    }
+
+    ///----------------------------------------------
+
+    void Scene::renderWavefront(Camera& camera, int firstSample, int numSamples, bool showProgress,
+                                BVH::TraversalStatistics& statistics)
+    {
+        // Every step renders as many rows as fit in one batch of paths, the integrator was set up by prepareRendering()
+        int pixelHeight = camera.getPixelHeight();
+        int rowsPerStep = getWavefrontRowsPerBatch(camera, numSamples);
+
+        int lastPercentageOutputted = -1;
+        for (int i = 0; i < pixelHeight; i += rowsPerStep)
+        {
+            // Parallelises over the paths of the batch internally
+            int rowsDone = glm::min(i + rowsPerStep, pixelHeight);
+            wavefrontIntegrator->renderRows(camera, i, rowsDone, firstSample, numSamples, statistics);
+
             // Print out progress every x% done
-            int percentageDone = int(float(i + 1) / float(pixelHeight) * 100);
-            if (percentageDone % renderSettings.outputProgressEveryXPercent == 0 
+            int percentageDone = int(float(rowsDone) / float(pixelHeight) * 100);
+            if (showProgress && percentageDone % renderSettings.outputProgressEveryXPercent == 0
                 && percentageDone != lastPercentageOutputted)
             {
-                std::cout << "[" << std::setw(3) << percentageDone << "%] ";
+                displayProgress(percentageDone);
                 lastPercentageOutputted = percentageDone;
-                if (percentageDone == 0)
-                    std::cout << "Starting off";
-                else if (percentageDone == 50)
-                    std::cout << "Halfway there!";
-                else if (percentageDone == 100)
-                    std::cout << "Done!";
-                std::cout << std::endl;
             }
         }
+    }
 
-        // Generate the image from the pixel values
-        camera->generateImage();
+    ///----------------------------------------------
 
-        // Calculate time taken
-        auto endTime = std::chrono::high_resolution_clock::now();
-        displayTimeTaken(int(std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime).count()));
+    int Scene::getTileSize() const
+    {
+        // The tiles are made up of whole pixel blocks
+        int tileSize = glm::max(1, renderSettings.tileSize);
+        return (tileSize + renderSettings.packetSize - 1) / renderSettings.packetSize * renderSettings.packetSize;
+    }
+
+    ///----------------------------------------------
+
+    void Scene::renderTile(Camera& camera, const TileScheduler::Tile& tile, int firstSample, int numSamples,
+                           TileBuffer& tileBuffer, BVH::TraversalStatistics& statistics)
+    {
+        for (int i = tile.firstRow; i < tile.lastRow; i += renderSettings.packetSize)
+        {
+            for (int j = tile.firstColumn; j < tile.lastColumn; j += renderSettings.packetSize)
+                renderPixelBlock(camera, tile, i, j, firstSample, numSamples, tileBuffer, statistics);
+        }
+    }
+
+    ///----------------------------------------------
+
+    void Scene::renderPixelBlock(Camera& camera, const TileScheduler::Tile& tile, int firstRow, int firstColumn,
+                                 int firstSample, int numSamples, TileBuffer& tileBuffer,
+                                 BVH::TraversalStatistics& statistics)
+    {
+        int pixelHeight = camera.getPixelHeight();
+        int lastRow = glm::min(firstRow + renderSettings.packetSize, tile.lastRow);
+        int lastColumn = glm::min(firstColumn + renderSettings.packetSize, tile.lastColumn);
+
+        PixelEstimate estimates[RayPacket::MAX_SIZE];
+        Ray rays[RayPacket::MAX_SIZE];
+        RandomSampler samplers[RayPacket::MAX_SIZE];
+        int numPixels = (lastRow - firstRow) * (lastColumn - firstColumn);
+        for (int subSample = firstSample; needsMoreSamples(estimates, numPixels, numSamples, renderSettings); ++subSample)
+        {
+            RayPacket packet;
+            for (int i = firstRow; i < lastRow; i++)
+            {
+                for (int j = firstColumn; j < lastColumn; j++)
+                {
+                    // The random numbers only depend on the pixel and the sample, not on the thread
+                    RandomSampler& sampler = samplers[packet.size];
+                    sampler = RandomSampler(camera.getFramePixelIndex(i, j), subSample, renderSettings.randomSeed);
+                    rays[packet.size] = camera.createCameraRay(j, pixelHeight - i - 1,
+                            sampler.next() - 0.5f, sampler.next() - 0.5f);
+                    packet.addRay(rays[packet.size].getStartPoint(), rays[packet.size].getDirection());
+                }
+            }
+
+            if (!renderSettings.usePacketTracing)
+            {
+                for (int ray = 0; ray < packet.size; ++ray)
+                    estimates[ray].addSample(clampSample(traceRay(rays[ray], samplers[ray], 0.0f, statistics)));
+                continue;
+            }
+
+            // Only the camera rays travel together, everything after the first
+            // bounce goes in different directions and is traced ray by ray
+            packet.finalize();
+            findClosestIntersections(packet, rays, statistics);
+            for (int ray = 0; ray < packet.size; ++ray)
+            {
+                glm::vec3 color = glm::vec3(0.0f);
+                if (rays[ray].hasIntersection())
+                    color = shadeIntersection(rays[ray], samplers[ray], 0.0f, statistics);
+                estimates[ray].addSample(clampSample(color));
+            }
+        }
+
+        int tileWidth = tile.lastColumn - tile.firstColumn;
+        int ray = 0;
+        for (int i = firstRow; i < lastRow; i++)
+        {
+            for (int j = firstColumn; j < lastColumn; j++, ray++)
+            {
+                int index = (i - tile.firstRow) * tileWidth + j - tile.firstColumn;
+                tileBuffer.pixels[index] = estimates[ray].getMean();
+                tileBuffer.sampleCounts[index] = estimates[ray].numSamples;
+            }
+        }
     }
 
-    void Scene::addSphere(float radius, glm::vec3 centerPosition, MaterialPtr material, bool emissive) {
-        std::shared_ptr<Sphere> newSphere = std::make_shared<Sphere>(radius, centerPosition, material);
+    ///----------------------------------------------
+
+    void Scene::compileGeometry()
+    {
+        if (!geometryIsDirty)
+            return;
+
+        if (sceneCache)
+        {
+            std::cout << "Objects added after loading a scene cache are not rendered" << std::endl;
+            geometryIsDirty = false;
+            return;
+        }
+
+        // The triangles of the objects are only in the store after the first time
+        if (geometryIsReleased)
+        {
+            std::cout << "Objects added after the first render are not rendered" << std::endl;
+            geometryIsDirty = false;
+            return;
+        }
+
+        geometry.clear();
+        for (int object = 0; object < int(sceneObjects.size()); ++object)
+            sceneObjects[object]->addToGeometryStore(geometry, object);
+
+        geometry.build();
+        geometryIsDirty = false;
+        for (const std::shared_ptr<SceneObject>& object : sceneObjects)
+            object->releaseGeometry();
+        geometryIsReleased = true;
+        displayGeometryStatistics(geometry);
+
+        lightIndices.assign(sceneObjects.size(), -1);
+        for (int light = 0; light < int(emissiveObjectIndices.size()); ++light)
+            lightIndices[emissiveObjectIndices[light]] = light;
+        buildLightSelection();
+    }
+
+    ///----------------------------------------------
+
+    void Scene::buildLightSelection()
+    {
+        // Each light source is picked in proportion to the power it emits
+        std::vector<float> lightPowers;
+        for (int index : emissiveObjectIndices)
+            lightPowers.push_back(sceneObjects[index]->radiance() * sceneObjects[index]->area());
+        lightSelection = AliasTable(lightPowers);
+    }
+
+    ///----------------------------------------------
+
+    int Scene::addMaterial(const MaterialProperties& material)
+    {
+        materials.push_back(material);
+        return int(materials.size()) - 1;
+    }
+
+    ///----------------------------------------------
+
+    void Scene::addSphere(float radius, glm::vec3 centerPosition, int material, bool emissive) {
+        std::shared_ptr<Sphere> newSphere = std::make_shared<Sphere>(radius, centerPosition, material, materials[material]);
         sceneObjects.push_back(newSphere);
+        geometryIsDirty = true;
         if (emissive)
             emissiveObjectIndices.push_back(int(sceneObjects.size()) - 1);
     }
 
     ///----------------------------------------------
 
-    void Scene::addBox(glm::mat4x4 transform, MaterialPtr material, bool emissive ) {
-        std::shared_ptr<VertexObject> newBox = VertexObject::createBox(transform, material);
+    void Scene::addBox(glm::mat4x4 transform, int material, bool emissive ) {
+        std::shared_ptr<VertexObject> newBox = VertexObject::createBox(transform, material, materials[material]);
         sceneObjects.push_back(newBox);
+        geometryIsDirty = true;
         if (emissive)
             emissiveObjectIndices.push_back(int(sceneObjects.size()) - 1);
     }
 
     ///----------------------------------------------
 
-    void Scene::addPlane(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, MaterialPtr material, bool emissive) {
-        std::shared_ptr<VertexObject> newPlane = VertexObject::createPlane(p0, p1, p2, p3, material);
+    void Scene::addPlane(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, int material, bool emissive) {
+        std::shared_ptr<VertexObject> newPlane = VertexObject::createPlane(p0, p1, p2, p3, material, materials[material]);
         sceneObjects.push_back(newPlane);
+        geometryIsDirty = true;
+        if (emissive)
+            emissiveObjectIndices.push_back(int(sceneObjects.size()) - 1);
+    }
+
+    ///----------------------------------------------
+
+    void Scene::addInstance(std::shared_ptr<const SharedMesh> mesh, glm::mat4x4 transform, int material, bool emissive) {
+        std::shared_ptr<MeshInstance> newInstance = std::make_shared<MeshInstance>(std::move(mesh), transform, material,
+                                                                                   materials[material]);
+        sceneObjects.push_back(newInstance);
+        geometryIsDirty = true;
+        if (emissive)
+            emissiveObjectIndices.push_back(int(sceneObjects.size()) - 1);
+    }
+
+    ///----------------------------------------------
+
+    bool Scene::addMesh(const std::string& path, glm::mat4x4 transform, int material, bool emissive) {
+        std::shared_ptr<VertexObject> newMesh = VertexObject::createFromFile(path, transform, material, materials[material]);
+        if (!newMesh)
+            return false;
+        sceneObjects.push_back(newMesh);
+        geometryIsDirty = true;
         if (emissive)
             emissiveObjectIndices.push_back(int(sceneObjects.size()) - 1);
+        return true;
+    }
+
+    ///----------------------------------------------
+
+    bool Scene::saveCache(const std::string& path)
+    {
+        compileGeometry();
+
+        // The light sources are sampled as objects, they are stored as spheres or lists of triangles
+        std::vector<SceneCache::LightRecord> lights;
+        std::vector<glm::vec3> lightVertices;
+        for (int index : emissiveObjectIndices)
+        {
+            const SceneObject* object = sceneObjects[index].get();
+            SceneCache::LightRecord light;
+            light.objectIndex = index;
+            light.materialIndex = object->getMaterialIndex();
+            light.firstVertex = int(lightVertices.size());
+            light.radius = 0.0f;
+            light.center = glm::vec3(0.0f);
+            if (const Sphere* sphere = dynamic_cast<const Sphere*>(object))
+            {
+                light.radius = sphere->getRadius();
+                light.center = sphere->getCenterPosition();
+            }
+            else if (const VertexObject* vertexObject = dynamic_cast<const VertexObject*>(object))
+            {
+                for (glm::ivec3 triangle : vertexObject->getTriangleIndices())
+                {
+                    for (int corner = 0; corner < 3; ++corner)
+                        lightVertices.push_back(vertexObject->getVertices()[triangle[corner]]);
+                }
+            }
+            else if (const MeshInstance* instance = dynamic_cast<const MeshInstance*>(object))
+            {
+                const SharedMesh& mesh = instance->getMesh();
+                for (glm::ivec3 triangle : mesh.getTriangleIndices())
+                {
+                    for (int corner = 0; corner < 3; ++corner)
+                        lightVertices.push_back(glm::vec3(instance->getTransform()
+                                                          * glm::vec4(mesh.getVertices()[triangle[corner]], 1.0f)));
+                }
+            }
+            light.numVertices = int(lightVertices.size()) - light.firstVertex;
+            lights.push_back(light);
+        }
+
+        // The arrays of the meshes of the instances go one after the other
+        GeometryStore::CompiledData compiledData = geometry.getCompiledData();
+        std::vector<SceneCache::MeshRecord> meshRecords;
+        std::vector<BVH::Node> meshNodes;
+        std::vector<int> meshOrder;
+        CacheAlignedVector<TrianglePacket> meshPackets;
+        CacheAlignedVector<GeometryStore::TriangleInfo> meshInfos;
+        for (const GeometryStore* mesh : compiledData.meshes)
+        {
+            GeometryStore::CompiledData meshData = mesh->getCompiledData();
+            SceneCache::MeshRecord record;
+            record.numTriangles = meshData.numTriangles;
+            record.firstNode = int(meshNodes.size());
+            record.numNodes = int(meshData.triangleNodes.size());
+            record.firstOrder = int(meshOrder.size());
+            record.numOrder = int(meshData.triangleOrder.size());
+            record.firstPacket = int(meshPackets.size());
+            record.numPackets = int(meshData.trianglePackets.size());
+            meshRecords.push_back(record);
+
+            meshNodes.insert(meshNodes.end(), meshData.triangleNodes.begin(), meshData.triangleNodes.end());
+            meshOrder.insert(meshOrder.end(), meshData.triangleOrder.begin(), meshData.triangleOrder.end());
+            meshPackets.insert(meshPackets.end(), meshData.trianglePackets.begin(), meshData.trianglePackets.end());
+            meshInfos.insert(meshInfos.end(), meshData.triangleInfos.begin(), meshData.triangleInfos.end());
+        }
+
+        SceneCache cache;
+        cache.setSection(SceneCache::MATERIALS, materials);
+        cache.setSection(SceneCache::LIGHTS, lights);
+        cache.setSection(SceneCache::LIGHT_VERTICES, lightVertices);
+        cache.setSection(SceneCache::TRIANGLE_NODES, compiledData.triangleNodes);
+        cache.setSection(SceneCache::TRIANGLE_ORDER, compiledData.triangleOrder);
+        cache.setSection(SceneCache::TRIANGLE_PACKETS, compiledData.trianglePackets);
+        cache.setSection(SceneCache::TRIANGLE_INFOS, compiledData.triangleInfos);
+        cache.setSection(SceneCache::SPHERE_NODES, compiledData.sphereNodes);
+        cache.setSection(SceneCache::SPHERE_ORDER, compiledData.sphereOrder);
+        cache.setSection(SceneCache::SPHERES, compiledData.spheres);
+        cache.setSection(SceneCache::INSTANCE_NODES, compiledData.instanceNodes);
+        cache.setSection(SceneCache::INSTANCE_ORDER, compiledData.instanceOrder);
+        cache.setSection(SceneCache::INSTANCES, compiledData.instances);
+        cache.setSection(SceneCache::MESHES, meshRecords);
+        cache.setSection(SceneCache::MESH_NODES, meshNodes);
+        cache.setSection(SceneCache::MESH_ORDER, meshOrder);
+        cache.setSection(SceneCache::MESH_PACKETS, meshPackets);
+        cache.setSection(SceneCache::MESH_INFOS, meshInfos);
+        cache.setNumTriangles(compiledData.numTriangles);
+        return cache.write(path);
+    }
+
+    ///----------------------------------------------
+
+    bool Scene::loadCache(const std::string& path)
+    {
+        std::shared_ptr<SceneCache> cache = std::make_shared<SceneCache>();
+        if (!cache->open(path))
+            return false;
+
+        // Nothing in the scene changes until the whole cache has been checked
+        ArrayView<MaterialProperties> cachedMaterials = cache->getSection<MaterialProperties>(SceneCache::MATERIALS);
+        std::vector<std::shared_ptr<SceneObject>> lights;
+        std::vector<int> objectLightIndices;
+        ArrayView<glm::vec3> lightVertices = cache->getSection<glm::vec3>(SceneCache::LIGHT_VERTICES);
+        std::size_t maxNumObjects = std::size_t(cache->getNumTriangles())
+                                    + cache->getSection<GeometryStore::SphereRecord>(SceneCache::SPHERES).size()
+                                    + cache->getSection<GeometryStore::InstanceRecord>(SceneCache::INSTANCES).size();
+        for (const SceneCache::LightRecord& light : cache->getSection<SceneCache::LightRecord>(SceneCache::LIGHTS))
+        {
+            if (light.objectIndex < 0 || std::size_t(light.objectIndex) >= maxNumObjects
+                || light.materialIndex < 0 || light.materialIndex >= int(cachedMaterials.size())
+                || light.firstVertex < 0 || light.numVertices < 0 || light.numVertices % 3 != 0
+                || std::size_t(light.firstVertex) + std::size_t(light.numVertices) > lightVertices.size())
+            {
+                std::cout << "The scene cache " << path << " is damaged" << std::endl;
+                return false;
+            }
+
+            // The geometry refers to the light by the index it had in the saved scene
+            if (light.objectIndex >= int(objectLightIndices.size()))
+                objectLightIndices.resize(light.objectIndex + 1, -1);
+            objectLightIndices[light.objectIndex] = int(lights.size());
+
+            const MaterialProperties& material = cachedMaterials[light.materialIndex];
+            if (light.numVertices == 0)
+            {
+                lights.push_back(std::make_shared<Sphere>(light.radius, light.center, light.materialIndex, material));
+            }
+            else
+            {
+                std::vector<glm::vec3> vertices(lightVertices.begin() + light.firstVertex,
+                                                lightVertices.begin() + light.firstVertex + light.numVertices);
+                std::vector<glm::ivec3> triangleIndices;
+                for (int vertex = 0; vertex < light.numVertices; vertex += 3)
+                    triangleIndices.emplace_back(vertex, vertex + 1, vertex + 2);
+                lights.push_back(std::make_shared<VertexObject>(std::move(vertices), std::move(triangleIndices),
+                                                                light.materialIndex, material));
+            }
+        }
+
+        // The meshes of the instances, each pointing into the MESH_ sections
+        ArrayView<BVH::Node> meshNodes = cache->getSection<BVH::Node>(SceneCache::MESH_NODES);
+        ArrayView<int> meshOrder = cache->getSection<int>(SceneCache::MESH_ORDER);
+        ArrayView<TrianglePacket> meshPackets = cache->getSection<TrianglePacket>(SceneCache::MESH_PACKETS);
+        ArrayView<GeometryStore::TriangleInfo> meshInfos =
+                cache->getSection<GeometryStore::TriangleInfo>(SceneCache::MESH_INFOS);
+        std::vector<std::unique_ptr<GeometryStore>> meshes;
+        std::vector<const GeometryStore*> meshPointers;
+        for (const SceneCache::MeshRecord& record : cache->getSection<SceneCache::MeshRecord>(SceneCache::MESHES))
+        {
+            std::size_t numInfos = std::size_t(record.numPackets) * TrianglePacket::WIDTH;
+            if (record.firstNode < 0 || record.numNodes < 0 || record.firstOrder < 0 || record.numOrder < 0
+                || record.firstPacket < 0 || record.numPackets < 0
+                || std::size_t(record.firstNode) + std::size_t(record.numNodes) > meshNodes.size()
+                || std::size_t(record.firstOrder) + std::size_t(record.numOrder) > meshOrder.size()
+                || std::size_t(record.firstPacket) + std::size_t(record.numPackets) > meshPackets.size()
+                || std::size_t(record.firstPacket) * TrianglePacket::WIDTH + numInfos > meshInfos.size())
+            {
+                std::cout << "The scene cache " << path << " is damaged" << std::endl;
+                return false;
+            }
+
+            GeometryStore::CompiledData meshData = GeometryStore::CompiledData();
+            meshData.numTriangles = record.numTriangles;
+            meshData.triangleNodes = ArrayView<BVH::Node>(meshNodes.data() + record.firstNode, record.numNodes);
+            meshData.triangleOrder = ArrayView<int>(meshOrder.data() + record.firstOrder, record.numOrder);
+            meshData.trianglePackets = ArrayView<TrianglePacket>(meshPackets.data() + record.firstPacket,
+                                                                 record.numPackets);
+            meshData.triangleInfos = ArrayView<GeometryStore::TriangleInfo>(
+                    meshInfos.data() + std::size_t(record.firstPacket) * TrianglePacket::WIDTH, numInfos);
+            meshes.emplace_back(new GeometryStore());
+            meshes.back()->useCompiledData(meshData);
+            meshPointers.push_back(meshes.back().get());
+        }
+
+        ArrayView<GeometryStore::InstanceRecord> instances =
+                cache->getSection<GeometryStore::InstanceRecord>(SceneCache::INSTANCES);
+        for (const GeometryStore::InstanceRecord& instance : instances)
+        {
+            if (instance.meshIndex < 0 || instance.meshIndex >= int(meshPointers.size()))
+            {
+                std::cout << "The scene cache " << path << " is damaged" << std::endl;
+                return false;
+            }
+        }
+
+        materials.assign(cachedMaterials.begin(), cachedMaterials.end());
+        sceneObjects = lights;
+        emissiveObjectIndices.clear();
+        for (int light = 0; light < int(lights.size()); ++light)
+            emissiveObjectIndices.push_back(light);
+        lightIndices.swap(objectLightIndices);
+        buildLightSelection();
+
+        GeometryStore::CompiledData compiledData;
+        compiledData.numTriangles = cache->getNumTriangles();
+        compiledData.triangleNodes = cache->getSection<BVH::Node>(SceneCache::TRIANGLE_NODES);
+        compiledData.triangleOrder = cache->getSection<int>(SceneCache::TRIANGLE_ORDER);
+        compiledData.trianglePackets = cache->getSection<TrianglePacket>(SceneCache::TRIANGLE_PACKETS);
+        compiledData.triangleInfos = cache->getSection<GeometryStore::TriangleInfo>(SceneCache::TRIANGLE_INFOS);
+        compiledData.sphereNodes = cache->getSection<BVH::Node>(SceneCache::SPHERE_NODES);
+        compiledData.sphereOrder = cache->getSection<int>(SceneCache::SPHERE_ORDER);
+        compiledData.spheres = cache->getSection<GeometryStore::SphereRecord>(SceneCache::SPHERES);
+        compiledData.instanceNodes = cache->getSection<BVH::Node>(SceneCache::INSTANCE_NODES);
+        compiledData.instanceOrder = cache->getSection<int>(SceneCache::INSTANCE_ORDER);
+        compiledData.instances = instances;
+        compiledData.meshes = meshPointers;
+        geometry.useCompiledData(compiledData);
+        cachedMeshes.swap(meshes);
+
+        sceneCache = cache;
+        geometryIsDirty = false;
+        displayGeometryStatistics(geometry);
+        return true;
     }
 
     ///----------------------------------------------
@@ -142,9 +967,9 @@ namespace rayTracer {
         std::shared_ptr<Scene> defaultScene = std::make_shared<Scene>();
 
         // Create cornell box
-        MaterialPtr diffuseRed = std::make_shared<LambertianMaterial>(glm::vec3(1.f, 0.f,0.f));
-        MaterialPtr diffuseWhite = std::make_shared<LambertianMaterial>(glm::vec3(1.f, 1.f,1.f));
-        MaterialPtr diffuseGreen = std::make_shared<LambertianMaterial>(glm::vec3(0.f, 1.f,0.f));
+        int diffuseRed = defaultScene->addMaterial(MaterialProperties::createLambertian(glm::vec3(1.f, 0.f,0.f)));
+        int diffuseWhite = defaultScene->addMaterial(MaterialProperties::createLambertian(glm::vec3(1.f, 1.f,1.f)));
+        int diffuseGreen = defaultScene->addMaterial(MaterialProperties::createLambertian(glm::vec3(0.f, 1.f,0.f)));
 
         glm::vec3 p0 = glm::vec3(-1.5f, -1.f, -1.f);
         glm::vec3 p1 = glm::vec3(1.5f, -1.f, -1.f);
@@ -163,8 +988,7 @@ namespace rayTracer {
         defaultScene->addPlane(p0, p4, p5, p1, diffuseWhite); // Floor
 
         // Add objects inside cornell box
-        MaterialPtr diffuseMagenta = std::make_shared<LambertianMaterial>(glm::vec3(1.f, 0.f,1.f));
-        MaterialPtr diffuseCyan = std::make_shared<LambertianMaterial>(glm::vec3(0.f, 1.f,1.f));
+        int diffuseMagenta = defaultScene->addMaterial(MaterialProperties::createLambertian(glm::vec3(1.f, 0.f,1.f)));
 
         glm::mat4x4 boxTransform = glm::mat4x4(1.0f);
         boxTransform = glm::translate(boxTransform, glm::vec3(-0.8, -0.3, -0.3));
@@ -172,11 +996,11 @@ namespace rayTracer {
         boxTransform = glm::scale(boxTransform, glm::vec3(0.8,1.3,0.8));
         defaultScene->addBox(boxTransform, diffuseMagenta);
 
-        MaterialPtr mirror = std::make_shared<PerfectMirrorMaterial>();
+        int mirror = defaultScene->addMaterial(MaterialProperties::createPerfectMirror());
         defaultScene->addSphere(0.3f, glm::vec3(0.4f, -0.5f, 0.0f), mirror);
 
         // Add a light source
-        MaterialPtr emissiveWhite = std::make_shared<EmissiveMaterial>(glm::vec3(1.f, 1.f, 1.f), 30.f);
+        int emissiveWhite = defaultScene->addMaterial(MaterialProperties::createEmissive(glm::vec3(1.f, 1.f, 1.f), 30.f));
         glm::vec3 lightP1 = glm::vec3(0.35f, 0.99f, -0.35f);
         glm::vec3 lightP2 = glm::vec3(-0.35f, 0.99f, -0.35f);
         glm::vec3 lightP3 = glm::vec3(0.35f, 0.99f, 0.35f);
@@ -188,107 +1012,223 @@ namespace rayTracer {
 
     ///----------------------------------------------
 
-    glm::vec3 Scene::traceRay(std::shared_ptr<Ray> ray) const
+    const MaterialProperties& Scene::getMaterial(const Ray& ray) const
+    {
+        return materials[ray.getIntersection().materialIndex];
+    }
+
+    ///----------------------------------------------
+
+    glm::vec3 Scene::traceRay(Ray& ray, RandomSampler& sampler, float pdf, BVH::TraversalStatistics& statistics) const
     {
         // Something's gone wrong, we can't find any intersections within the scene..
-        if (!findClosestIntersection(ray))
+        if (!findClosestIntersection(ray, statistics))
             return glm::vec3(0.0f);
 
+        return shadeIntersection(ray, sampler, pdf, statistics);
+    }
+
+    ///----------------------------------------------
+
+    glm::vec3 Scene::shadeIntersection(const Ray& ray, RandomSampler& sampler, float pdf,
+                                       BVH::TraversalStatistics& statistics) const
+    {
+        // Light sources only emit
+        const MaterialProperties& material = getMaterial(ray);
+        if (material.isEmissive())
+            return getEmittedLight(ray, pdf);
+
         // For gathering all the indirect lighting in the scene
         glm::vec3 indirectLight = glm::vec3(0.0f);
 
-        // Generate a reflected ray
-        std::shared_ptr<Ray> reflectedRay = ray->generateReflectedRay(gen, dis);
+        // Generate a reflected ray, drawn from the material
+        glm::vec3 reflectedWeight;
+        float reflectedPdf;
+        Ray reflectedRay = ray.generateReflectedRay(material, sampler, reflectedWeight, reflectedPdf);
 
         // Send out the reflected ray if we hit the randomized threshold or if the object
-        // we have hit is not a diffuse object or a light source
-        float randomNum = (*dis)(*gen);
-        if (ray->hitsEmissiveObject())
-            indirectLight = ray->getValueOfBRDF(reflectedRay);
-        else if (!ray->hitsDiffuseObject() || randomNum < renderSettings.russianRouletteCoefficient)
-            indirectLight += traceRay(reflectedRay) * ray->getValueOfBRDF(reflectedRay);;
+        // we have hit is not a diffuse object. What it brings back is divided by the
+        // chance of sending it.
+        float randomNum = sampler.next();
+        if (!material.isDiffuse() || randomNum < renderSettings.russianRouletteCoefficient)
+        {
+            // The next bounce draws its own numbers, the direct lighting below continues with this one's
+            RandomSampler nextSampler = sampler.nextBounce();
+            float continuation = material.isDiffuse() ? renderSettings.russianRouletteCoefficient : 1.0f;
+            indirectLight = traceRay(reflectedRay, nextSampler, reflectedPdf, statistics) * reflectedWeight / continuation;
+        }
 
         // Calculate direct lighting using shadow rays
         glm::vec3 directLight = glm::vec3(0.0f);
-        if (ray->hitsDiffuseObject())
-            directLight = calculateDirectLighting(ray);
+        if (material.isDiffuse())
+            directLight = calculateDirectLighting(ray, sampler, statistics);
+
+        return indirectLight + directLight;
+    }
+
+    ///----------------------------------------------
 
-        return glm::clamp(indirectLight + directLight, 0.0f, 1.0f);
+    glm::vec3 Scene::clampSample(glm::vec3 sample) const
+    {
+        if (renderSettings.maxSampleValue <= 0.0f)
+            return sample;
+        return glm::min(sample, glm::vec3(renderSettings.maxSampleValue));
     }
 
     ///----------------------------------------------
 
-    bool Scene::findClosestIntersection(std::shared_ptr<Ray> currentRay) const {
-        bool intersection = false;
-        for(auto& sceneObject : sceneObjects){
-            if(sceneObject->intersect(currentRay) && !intersection)
-                intersection = true;
+    glm::vec3 Scene::getEmittedLight(const Ray& ray, float pdf) const
+    {
+        const Ray::Intersection& intersection = ray.getIntersection();
+        int light = intersection.objectIndex < int(lightIndices.size()) ? lightIndices[intersection.objectIndex] : -1;
+        float cosAlpha = glm::dot(-1.f * ray.getDirection(), intersection.normal);
+        if (light < 0 || cosAlpha <= 0.0f)
+            return glm::vec3(0.0f);
+
+        // The pdf the shadow rays would have found the same point with, over solid angle
+        const SceneObject& lightSource = *sceneObjects[emissiveObjectIndices[light]];
+        float weight = 1.0f;
+        if (pdf > 0.0f)
+        {
+            float d2 = intersection.distanceToRayOrigin * intersection.distanceToRayOrigin;
+            float pointPdf = lightSource.getPdfOfPoint(ray.getStartPoint(), intersection.intersectionPoint,
+                                                       intersection.normal);
+            float lightPdf = lightSelection.getProbability(light) * pointPdf * d2 / cosAlpha;
+            weight = powerHeuristic(renderSettings.russianRouletteCoefficient, pdf,
+                                    float(renderSettings.numShadowRays), lightPdf);
         }
-        return intersection;
+
+        return glm::vec3(lightSource.radiance() * weight);
+    }
+
+    ///----------------------------------------------
+
+    bool Scene::findClosestIntersection(Ray& currentRay, BVH::TraversalStatistics& statistics) const {
+        ++statistics.numRays;
+        return geometry.intersect(currentRay, renderSettings.useAccelerationStructure, statistics);
+    }
+
+    ///----------------------------------------------
+
+    void Scene::findClosestIntersections(RayPacket& packet, Ray* rays,
+                                         BVH::TraversalStatistics& statistics) const
+    {
+        statistics.numRays += packet.size;
+        geometry.intersectPacket(packet, rays, renderSettings.useAccelerationStructure, statistics);
     }
 
     ///----------------------------------------------
 
-    glm::vec3 Scene::calculateDirectLighting(const std::shared_ptr<Ray> ray) const
+    bool Scene::occluded(glm::vec3 origin, glm::vec3 direction, float tMax, BVH::TraversalStatistics& statistics) const
+    {
+        ++statistics.numRays;
+        return geometry.occluded(origin, direction, tMax, renderSettings.useAccelerationStructure, statistics);
+    }
+
+    ///----------------------------------------------
+
+    glm::vec3 Scene::calculateDirectLighting(const Ray& ray, RandomSampler& sampler, BVH::TraversalStatistics& statistics) const
     {
         glm::vec3 allLightsContributions = glm::vec3(0.0);
-        for (int index : emissiveObjectIndices)
+        if (lightSelection.empty())
+            return allLightsContributions;
+
+        // Shadow rays from the point of intersection to random points on the light sources, set up in batches
+        ShadowConnection connections[SHADOW_RAY_BATCH_SIZE];
+        for (int first = 0; first < renderSettings.numShadowRays; first += SHADOW_RAY_BATCH_SIZE)
         {
-            glm::vec3 singleLightContribution = glm::vec3(0.0);
-            std::shared_ptr<SceneObject> emissiveObject = sceneObjects[index];
+            int count = glm::min(renderSettings.numShadowRays - first, int(SHADOW_RAY_BATCH_SIZE));
+            int numConnections = connectToLights(ray, count, sampler, connections);
 
-            for (int i = 0; i < renderSettings.numShadowRays; i++)
+            // If anything lies between the point and the light source that ray is in shadow
+            for (int i = 0; i < numConnections; ++i)
             {
-                // Generate a shadow ray from the point of intersection to a random point on the light source
-                glm::vec3 randomPointOnEmissiveObject = emissiveObject->getRandomPointOnObject(ray, gen, dis);
-                std::shared_ptr<Ray> shadowRay = ray->generateShadowRay(randomPointOnEmissiveObject);
-
-                singleLightContribution += getShadowRayContribution(ray, shadowRay);
+                const ShadowConnection& connection = connections[i];
+                if (!occluded(connection.origin, connection.direction, connection.distance, statistics))
+                    allLightsContributions += connection.contribution;
             }
-
-            singleLightContribution *= (emissiveObject->radiance() * emissiveObject->area()) / float(renderSettings.numShadowRays);
-            allLightsContributions += singleLightContribution;
         }
 
-        return glm::clamp(allLightsContributions, 0.0f, 1.0f);
+        return allLightsContributions;
     }
 
     ///----------------------------------------------
 
-    glm::vec3 Scene::getShadowRayContribution(const std::shared_ptr<Ray> originalRay, std::shared_ptr<Ray> shadowRay) const
+    bool Scene::createShadowConnection(const Ray& originalRay, glm::vec3 pointOnLightSource,
+                                       glm::vec3 lightSourceNormal, float pointPdf,
+                                       ShadowConnection& connection) const
     {
-        // Get normalized shadow ray direction
-        glm::vec3 shadowRayDirection = glm::normalize(shadowRay->getDirection());
+        Ray shadowRay = originalRay.generateShadowRay(pointOnLightSource);
+        glm::vec3 shadowRayDirection = shadowRay.getDirection();
 
         // Calculate angle between the shadow ray and the normal of the surface. If the angle is
-        // more than 90 degrees the light should not be able to hit the surface, return black.
-        float cosBeta = glm::dot(shadowRayDirection, originalRay->getIntersection()->normal);
+        // more than 90 degrees the light should not be able to hit the surface.
+        float cosBeta = glm::dot(shadowRayDirection, originalRay.getIntersection().normal);
         if (cosBeta < 0.0f)
-            return glm::vec3(0.0f);
-
-        // If we can't find any intersections (something gone wrong) or if the closest intersection
-        // isn't on an emissive object, we are in shadow, return black.
-        if (!findClosestIntersection(shadowRay) || !shadowRay->hitsEmissiveObject())
-        {
-            return glm::vec3(0.0f);
-        }
+            return false;
 
-        // Calculate the angle between the shadow ray (inverted) and the intersection on the emissive
-        // object. If the angle is more than 90 degrees, we hit the light from behind, so return black.
-        float cosAlpha = glm::dot(-1.f * shadowRayDirection, shadowRay->getIntersection()->normal);
-        if (cosAlpha < 0.0f)
-            return glm::vec3(0.0f);
+        // Calculate the angle between the shadow ray (inverted) and the normal of the light source.
+        // If the angle is more than 90 degrees, we hit the light from behind.
+        float cosAlpha = glm::dot(-1.f * shadowRayDirection, lightSourceNormal);
+        if (cosAlpha <= 0.0f)
+            return false;
 
         // Calculate the geometric term G(), how much contribution the shadow ray should give
-        float d2 = shadowRay->lengthSquared();
+        float d2 = glm::length2(pointOnLightSource - shadowRay.getStartPoint());
         float geometricTerm = cosAlpha * cosBeta / d2;
 
-        // Calculate brdf
-        glm::vec3 brdf = originalRay->getValueOfBRDF(shadowRay);
-
-        return geometricTerm * brdf;
+        // The distance is shortened slightly so the light source itself doesn't count as a blocker
+        connection.origin = shadowRay.getStartPoint();
+        connection.direction = shadowRayDirection;
+        connection.distance = glm::sqrt(d2) * (1.0f - 1e-4f);
+        connection.lightPdf = pointPdf * d2 / cosAlpha;
+        connection.contribution = glm::vec3(geometricTerm);
+        return true;
     }
 
-} // namespace rayTracer
+    ///----------------------------------------------
 
+    int Scene::connectToLights(const Ray& originalRay, int count, RandomSampler& sampler,
+                               ShadowConnection* connections) const
+    {
+        int numConnections = 0;
+        glm::vec3 directions[SHADOW_RAY_BATCH_SIZE];
+        for (int i = 0; i < count; ++i)
+        {
+            // Pick a light source, then a point on it
+            float bucketU = sampler.next();
+            float choiceU = sampler.next();
+            int light = lightSelection.sample(bucketU, choiceU);
+            float selectionProbability = lightSelection.getProbability(light);
+            const SceneObject& lightSource = *sceneObjects[emissiveObjectIndices[light]];
+            SceneObject::SurfacePoint pointOnLightSource = lightSource.getRandomPointOnObject(originalRay, sampler);
 
+            ShadowConnection& connection = connections[numConnections];
+            if (createShadowConnection(originalRay, pointOnLightSource.position, pointOnLightSource.normal,
+                                       pointOnLightSource.pdf, connection))
+            {
+                connection.lightPdf *= selectionProbability;
+                connection.contribution *= lightSource.radiance()
+                                           / (pointOnLightSource.pdf * selectionProbability
+                                              * float(renderSettings.numShadowRays));
+                directions[numConnections] = connection.direction;
+                ++numConnections;
+            }
+        }
+
+        // Calculate the brdf of all of them at once, together with the pdfs the reflected ray would
+        // have been drawn with. That ray is only sent with the russian roulette probability.
+        glm::vec3 brdfs[SHADOW_RAY_BATCH_SIZE];
+        float pdfs[SHADOW_RAY_BATCH_SIZE];
+        originalRay.getValuesOfBRDF(getMaterial(originalRay), directions, numConnections, brdfs, pdfs);
+        for (int i = 0; i < numConnections; ++i)
+        {
+            float weight = powerHeuristic(float(renderSettings.numShadowRays), connections[i].lightPdf,
+                                          renderSettings.russianRouletteCoefficient, pdfs[i]);
+            connections[i].contribution *= brdfs[i] * weight;
+        }
+
+        return numConnections;
+    }
+
+} // namespace rayTracer
@@ -0,0 +1,169 @@
+#include <SceneCache.h>
+#include <AlignedAllocator.h>
+#include <GeometryStore.h>
+#include <MaterialProperties.h>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace rayTracer {
+
+    namespace {
+        const char MAGIC[8] = {'E', 'L', 'T', 'S', 'C', 'E', 'N', 'E'};
+
+        /// Reads back as another number on a machine with the other byte order
+        const std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+        std::uint64_t alignToCacheLine(std::uint64_t offset)
+        {
+            return (offset + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+        }
+
+        // The records are written as they are in memory. Padding the compiler adds would go into
+        // the file uninitialised, so every record is exactly as large as its members.
+        static_assert(sizeof(MaterialProperties) == 4 + 2 * sizeof(glm::vec3) + 3 * sizeof(float),
+                      "MaterialProperties has implicit padding");
+        static_assert(sizeof(SceneCache::LightRecord) == 4 * sizeof(int) + sizeof(float) + sizeof(glm::vec3),
+                      "LightRecord has implicit padding");
+        static_assert(sizeof(BVH::Node) == 2 * sizeof(glm::vec3) + 2 * sizeof(int), "BVH::Node has implicit padding");
+        static_assert(sizeof(TrianglePacket) == 10 * TrianglePacket::WIDTH * sizeof(float),
+                      "TrianglePacket has implicit padding");
+        static_assert(sizeof(GeometryStore::TriangleInfo) == sizeof(glm::vec3) + 2 * sizeof(int),
+                      "TriangleInfo has implicit padding");
+        static_assert(sizeof(GeometryStore::SphereRecord) == sizeof(glm::vec3) + sizeof(float) + 4 * sizeof(int),
+                      "SphereRecord has implicit padding");
+        static_assert(sizeof(GeometryStore::InstanceRecord) == sizeof(glm::mat4x3) + 4 * sizeof(int),
+                      "InstanceRecord has implicit padding");
+        static_assert(sizeof(SceneCache::MeshRecord) == 7 * sizeof(int), "MeshRecord has implicit padding");
+    } // anonymous namespace
+
+    SceneCache::SceneCache()
+        : numTriangles(0)
+    {
+        for (int section = 0; section < NUM_SECTIONS; ++section)
+        {
+            sections[section] = nullptr;
+            sectionSizes[section] = 0;
+        }
+    }
+
+    ///----------------------------------------------
+
+    std::uint32_t SceneCache::getRecordSize(Section section)
+    {
+        switch (section)
+        {
+            case MATERIALS: return sizeof(MaterialProperties);
+            case LIGHTS: return sizeof(LightRecord);
+            case LIGHT_VERTICES: return sizeof(glm::vec3);
+            case TRIANGLE_NODES:
+            case SPHERE_NODES:
+            case INSTANCE_NODES:
+            case MESH_NODES: return sizeof(BVH::Node);
+            case TRIANGLE_ORDER:
+            case SPHERE_ORDER:
+            case INSTANCE_ORDER:
+            case MESH_ORDER: return sizeof(int);
+            case TRIANGLE_PACKETS:
+            case MESH_PACKETS: return sizeof(TrianglePacket);
+            case TRIANGLE_INFOS:
+            case MESH_INFOS: return sizeof(GeometryStore::TriangleInfo);
+            case SPHERES: return sizeof(GeometryStore::SphereRecord);
+            case INSTANCES: return sizeof(GeometryStore::InstanceRecord);
+            case MESHES: return sizeof(MeshRecord);
+            case NUM_SECTIONS: break;
+        }
+        return 0;
+    }
+
+    ///----------------------------------------------
+
+    bool SceneCache::write(const std::string& path) const
+    {
+        // Zeroed so that the padding between the fields is written as zeros too
+        Header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.byteOrderMark = BYTE_ORDER_MARK;
+        header.numTriangles = numTriangles;
+
+        std::uint64_t offset = alignToCacheLine(sizeof(Header));
+        for (int section = 0; section < NUM_SECTIONS; ++section)
+        {
+            header.recordSizes[section] = getRecordSize(Section(section));
+            header.sectionOffsets[section] = offset;
+            header.sectionSizes[section] = sectionSizes[section];
+            offset = alignToCacheLine(offset + sectionSizes[section]);
+        }
+
+        std::ofstream output(path, std::ios::binary);
+        if (!output)
+        {
+            std::cout << "Can't write the scene cache " << path << std::endl;
+            return false;
+        }
+
+        const char padding[CACHE_LINE_SIZE] = {};
+        output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        std::uint64_t position = sizeof(header);
+        for (int section = 0; section < NUM_SECTIONS; ++section)
+        {
+            output.write(padding, std::streamsize(header.sectionOffsets[section] - position));
+            output.write(static_cast<const char*>(sections[section]), std::streamsize(sectionSizes[section]));
+            position = header.sectionOffsets[section] + sectionSizes[section];
+        }
+
+        if (!output.flush())
+        {
+            std::cout << "Can't write the scene cache " << path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    ///----------------------------------------------
+
+    bool SceneCache::open(const std::string& path)
+    {
+        if (!file.open(path))
+            return false;
+
+        // The size of the rest of the header depends on the version
+        Header header;
+        std::size_t versionSize = sizeof(header.magic) + sizeof(header.version) + sizeof(header.byteOrderMark);
+        if (file.getSize() < versionSize || std::memcmp(file.getData(), MAGIC, sizeof(MAGIC)) != 0)
+        {
+            std::cout << path << " is not a scene cache" << std::endl;
+            return false;
+        }
+        std::memcpy(&header, file.getData(), versionSize);
+        if (header.version != VERSION || header.byteOrderMark != BYTE_ORDER_MARK || file.getSize() < sizeof(Header))
+        {
+            std::cout << "The scene cache " << path << " was written by another version or on another kind of"
+                      << " machine, it has to be saved again" << std::endl;
+            return false;
+        }
+        std::memcpy(&header, file.getData(), sizeof(Header));
+
+        for (int section = 0; section < NUM_SECTIONS; ++section)
+        {
+            std::uint32_t recordSize = getRecordSize(Section(section));
+            std::uint64_t offset = header.sectionOffsets[section];
+            std::uint64_t size = header.sectionSizes[section];
+            if (header.recordSizes[section] != recordSize || size % recordSize != 0 || offset % CACHE_LINE_SIZE != 0
+                || offset > file.getSize() || size > file.getSize() - offset)
+            {
+                std::cout << "The scene cache " << path << " is damaged or was written by another build" << std::endl;
+                return false;
+            }
+
+            sections[section] = file.getData() + offset;
+            sectionSizes[section] = size;
+        }
+
+        numTriangles = header.numTriangles;
+        return true;
+    }
+
+} // namespace rayTracer
@@ -1,18 +1,108 @@
 #include <SceneObject.h>
+#include <GeometryStore.h>
 #include <Ray.h>
+#include <ShadingFrame.h>
+#include <algorithm>
 #include <cmath>
 #include <MaterialProperties.h>
+#include <MeshLoader.h>
 
 namespace rayTracer {
 
-    const float EPSILON = 1e-6f;
+    // Padding added to bounding boxes so that flat objects still have a volume
+    const float BOUNDING_BOX_PADDING = 1e-4f;
+
+    namespace {
+
+        /// A box from -0.5 to 0.5 along every axis
+        void getUnitBox(std::vector<glm::vec3>& boxVertices, std::vector<glm::ivec3>& boxTriangleIndices)
+        {
+            // Set vertices
+            boxVertices.reserve(8);
+            boxVertices.emplace_back(-0.5f, 0.5f, 0.5f);
+            boxVertices.emplace_back(0.5f, 0.5f, 0.5f);
+            boxVertices.emplace_back(-0.5f, -0.5f, 0.5f);
+            boxVertices.emplace_back(0.5f, -0.5f, 0.5f);
+            boxVertices.emplace_back(-0.5f, 0.5f, -0.5f);
+            boxVertices.emplace_back(0.5f, 0.5f, -0.5f);
+            boxVertices.emplace_back(-0.5f, -0.5f, -0.5f);
+            boxVertices.emplace_back(0.5f, -0.5f, -0.5f);
+
+            // Set triangle indices
+            boxTriangleIndices.reserve(12);
+            boxTriangleIndices.emplace_back(0,2,1);
+            boxTriangleIndices.emplace_back(1,2,3);
+            boxTriangleIndices.emplace_back(1,3,5);
+            boxTriangleIndices.emplace_back(3,7,5);
+            boxTriangleIndices.emplace_back(4,5,7);
+            boxTriangleIndices.emplace_back(4,7,6);
+            boxTriangleIndices.emplace_back(0,4,6);
+            boxTriangleIndices.emplace_back(0,6,2);
+            boxTriangleIndices.emplace_back(0,1,4);
+            boxTriangleIndices.emplace_back(1,5,4);
+            boxTriangleIndices.emplace_back(2,6,3);
+            boxTriangleIndices.emplace_back(3,6,7);
+        }
+
+        /// Picks a triangle in proportion to its area and a uniformly distributed point on it, so
+        /// every point of the surface is as likely
+        SceneObject::SurfacePoint getRandomPointOnTriangles(const std::vector<glm::vec3>& vertices,
+                                                            const std::vector<glm::ivec3>& triangleIndices,
+                                                            const AliasTable& triangleSelection,
+                                                            RandomSampler& sampler)
+        {
+            float bucketU = sampler.next();
+            float choiceU = sampler.next();
+            int triangle = triangleSelection.sample(bucketU, choiceU);
+
+            // Square root mapping of two numbers to barycentric coordinates, uniform over the
+            // triangle without rejecting or folding points
+            float r1 = std::sqrt(sampler.next());
+            float r2 = sampler.next();
+
+            glm::vec3 v0 = vertices[triangleIndices[triangle].x];
+            glm::vec3 v1 = vertices[triangleIndices[triangle].y];
+            glm::vec3 v2 = vertices[triangleIndices[triangle].z];
+
+            SceneObject::SurfacePoint point;
+            point.position = (1.0f - r1) * v0 + (r1 * (1.0f - r2)) * v1 + (r1 * r2) * v2;
+            point.normal = glm::normalize(glm::cross(v1 - v0, v2 - v0));
+            return point;
+        }
+
+        /// Area of the triangles after the transform, summed in double as a float sum stops
+        /// growing after millions of small triangles. The area of every triangle is also stored in
+        /// triangleAreas if it is given.
+        double calculateTriangleAreas(const std::vector<glm::vec3>& vertices,
+                                      const std::vector<glm::ivec3>& triangleIndices, const glm::mat4x4& transform,
+                                      std::vector<float>* triangleAreas)
+        {
+            if (triangleAreas)
+                triangleAreas->resize(triangleIndices.size());
+
+            double totalArea = 0;
+            for (std::size_t triangle = 0; triangle < triangleIndices.size(); ++triangle)
+            {
+                glm::ivec3 indices = triangleIndices[triangle];
+                glm::vec3 v0 = glm::vec3(transform * glm::vec4(vertices[indices.x], 1.0f));
+                glm::vec3 v1 = glm::vec3(transform * glm::vec4(vertices[indices.y], 1.0f));
+                glm::vec3 v2 = glm::vec3(transform * glm::vec4(vertices[indices.z], 1.0f));
+                float area = glm::length(glm::cross(v0 - v1, v2 - v1)) / 2.0f;
+                if (triangleAreas)
+                    (*triangleAreas)[triangle] = area;
+                totalArea += area;
+            }
+            return totalArea;
+        }
+
+    } // anonymous namespace
 
     /**********************************/
     /***         SceneObject        ***/
     /**********************************/
 
-    SceneObject::SceneObject(MaterialPtr inMaterial)
-    : material(inMaterial)
+    SceneObject::SceneObject(int inMaterialIndex)
+    : materialIndex(inMaterialIndex)
     , surfaceArea(0.0f)
     , emittedRadiance(0.0f)
     {
@@ -20,11 +110,11 @@ namespace rayTracer {
 
     ///----------------------------------------------
 
-    void SceneObject::calculateRadiance()
+    void SceneObject::calculateRadiance(const MaterialProperties& material)
     {
-        if (auto emissiveMaterial = std::dynamic_pointer_cast<EmissiveMaterial>(material))
+        if (material.isEmissive())
         {
-            emittedRadiance = emissiveMaterial->getFlux() / (surfaceArea * glm::pi<float>());
+            emittedRadiance = material.flux / (surfaceArea * glm::pi<float>());
         }
     }
 
@@ -32,83 +122,110 @@ namespace rayTracer {
     /***     SceneObject Sphere     ***/
     /**********************************/
 
-    Sphere::Sphere(float inRadius, glm::vec3 inCenterPosition, MaterialPtr material)
-    : SceneObject(material)
+    Sphere::Sphere(float inRadius, glm::vec3 inCenterPosition, int materialIndex, const MaterialProperties& material)
+    : SceneObject(materialIndex)
     , radius(inRadius)
     , centerPosition(inCenterPosition)
     {
         calculateArea();
-        calculateRadiance();
+        calculateRadiance(material);
+        calculateBoundingBox();
     }
 
     ///----------------------------------------------
 
-    bool Sphere::intersect(std::shared_ptr<Ray> currentRay)
+    void Sphere::addToGeometryStore(GeometryStore& geometryStore, int objectIndex) const
     {
-        glm::vec3 dirRayOriginToCenter = currentRay->getStartPoint() - centerPosition; //L
-        float a = glm::dot(currentRay->getDirection(), currentRay->getDirection());
-        float b = 2.f * glm::dot(currentRay->getDirection(), dirRayOriginToCenter);
-        float c = glm::dot(dirRayOriginToCenter, dirRayOriginToCenter) - radius * radius;
-
-        float d0, d1;
-        if (!solveQuadratic(a, b, c, d0, d1)) return false;
-
-        if (d0 > d1) std::swap(d0, d1);
+        geometryStore.addSphere(centerPosition, radius, objectIndex, materialIndex);
+    }
 
-        if (d0 < 0) {
-            d0 = d1;
-            if (d0 < 0) return false;
-        }
+    ///----------------------------------------------
 
-        // We have an intersection
-        if(currentRay->foundCloserRayIntersection(d0)){
-            glm::vec3 intersectionPoint = currentRay->getStartPoint() + d0 * currentRay->getDirection();
-            glm::vec3 intersectionNormal = glm::normalize(intersectionPoint - centerPosition);
+    void Sphere::calculateArea()
+    {
+        surfaceArea = 4.0f * glm::pi<float>() * float(glm::pow(radius, 2));
+    }
 
-            std::shared_ptr<Ray::Intersection> newIntersection = std::make_shared<Ray::Intersection>(
-                    intersectionPoint, intersectionNormal, d0, material);
+    ///----------------------------------------------
 
-            currentRay->updateRayIntersection(newIntersection);
-        }
-        return true;
+    void Sphere::calculateBoundingBox()
+    {
+        boundingBox = BoundingBox(centerPosition - glm::vec3(radius), centerPosition + glm::vec3(radius));
+        boundingBox.pad(BOUNDING_BOX_PADDING);
     }
 
     ///----------------------------------------------
 
-    bool Sphere::solveQuadratic(const float &a, const float &b, const float &c, float &x0, float &x1)
+    SceneObject::SurfacePoint Sphere::getRandomPointOnObject(
+            const Ray& ray, RandomSampler& sampler) const
     {
-        float discriminant = b * b - 4.0f * a * c;
-        if (discriminant < 0) return false;
-        else if (glm::abs(discriminant) < EPSILON) x0 = x1 = -0.5f * b / a;
-        else {
-            float q = (b > 0) ?
-                      -0.5f * (b + glm::sqrt(discriminant)) :
-                      -0.5f * (b - glm::sqrt(discriminant));
-            x0 = q / a;
-            x1 = c / q;
+        glm::vec3 shadingPoint = ray.getIntersection().intersectionPoint;
+        glm::vec3 toCenter = centerPosition - shadingPoint;
+        float distance2 = glm::dot(toCenter, toCenter);
+        float u1 = sampler.next();
+        float u2 = sampler.next();
+        float phi = 2.0f * glm::pi<float>() * u2;
+
+        // From inside the sphere every point is visible, they are picked uniformly over the surface
+        SurfacePoint point;
+        if (distance2 <= radius * radius)
+        {
+            float z = 1.0f - 2.0f * u1;
+            float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+            point.normal = glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+            point.position = centerPosition + radius * point.normal;
+            point.pdf = 1.0f / surfaceArea;
+            return point;
         }
-        if (x0 > x1) std::swap(x0, x1);
 
-        return true;
+        // From outside a direction is picked uniformly in the cone the sphere fills as seen from
+        // the point, so only the visible cap is ever hit. One minus the cosines is computed
+        // without cancelling for spheres far away.
+        float distance = std::sqrt(distance2);
+        float oneMinusCosThetaMax = getOneMinusCosThetaMax(distance2);
+        float oneMinusCosTheta = u1 * oneMinusCosThetaMax;
+        float cosTheta = 1.0f - oneMinusCosTheta;
+        float sin2Theta = oneMinusCosTheta * (2.0f - oneMinusCosTheta);
+        float sinTheta = std::sqrt(sin2Theta);
+        glm::vec3 direction = ShadingFrame(toCenter / distance).toWorld(
+                glm::vec3(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta));
+
+        // Where the direction first hits the sphere, and the cosine there between the normal and
+        // the way back. It is kept above zero at the silhouette so the pdf can be divided by.
+        float halfChord = std::sqrt(std::max(0.0f, radius * radius - distance2 * sin2Theta));
+        float distanceToPoint = distance * cosTheta - halfChord;
+        float cosAlpha = std::max(halfChord / radius, 1e-6f);
+
+        point.normal = glm::normalize(shadingPoint + distanceToPoint * direction - centerPosition);
+        point.position = centerPosition + radius * point.normal;
+        point.pdf = cosAlpha / (2.0f * glm::pi<float>() * oneMinusCosThetaMax * distanceToPoint * distanceToPoint);
+        return point;
     }
 
     ///----------------------------------------------
 
-    void Sphere::calculateArea()
+    float Sphere::getPdfOfPoint(glm::vec3 from, glm::vec3 position, glm::vec3 normal) const
     {
-        surfaceArea = 4.0f * glm::pi<float>() * float(glm::pow(radius, 2));
+        glm::vec3 toCenter = centerPosition - from;
+        float distance2 = glm::dot(toCenter, toCenter);
+        if (distance2 <= radius * radius)
+            return 1.0f / surfaceArea;
+
+        // The pdf of the direction over the cone turned into one over the area of the visible cap
+        glm::vec3 toFrom = from - position;
+        float distanceToPoint2 = glm::dot(toFrom, toFrom);
+        float cosAlpha = glm::dot(toFrom, normal) / std::sqrt(distanceToPoint2);
+        if (cosAlpha <= 0.0f)
+            return 0.0f;
+        return cosAlpha / (2.0f * glm::pi<float>() * getOneMinusCosThetaMax(distance2) * distanceToPoint2);
     }
 
     ///----------------------------------------------
 
-    glm::vec3 Sphere::getRandomPointOnObject(
-            std::shared_ptr<Ray> ray,
-            std::mt19937* randGenerator,
-            std::uniform_real_distribution<float>* randDistribution) const
+    float Sphere::getOneMinusCosThetaMax(float distance2) const
     {
-        // Grab a new random direction that is on the same hemisphere as the ray coming in.
-        glm::vec3 newDir = ray->generateRandomReflectedRayDirection(randGenerator, randDistribution);
-        return centerPosition + glm::normalize(newDir) * radius;
+        float sin2ThetaMax = radius * radius / distance2;
+        return sin2ThetaMax / (1.0f + std::sqrt(std::max(0.0f, 1.0f - sin2ThetaMax)));
     }
 
     /**********************************/
@@ -116,23 +233,27 @@ namespace rayTracer {
     /**********************************/
 
     VertexObject::VertexObject( std::vector<glm::vec3>& inVertices,
-            std::vector<glm::ivec3>& inTriangleIndices, MaterialPtr material)
-    : SceneObject(material)
-    , vertices(inVertices)
-    , triangleIndices(inTriangleIndices)
-    {
-        // Set triangle normals
-        triangleNormals.reserve(triangleIndices.size());
-        for (int triangle = 0; triangle < triangleIndices.size(); ++triangle)
-            triangleNormals.push_back(calculateTriangleNormal(triangle));
+            std::vector<glm::ivec3>& inTriangleIndices, int materialIndex, const MaterialProperties& material)
+    : VertexObject(std::vector<glm::vec3>(inVertices), std::vector<glm::ivec3>(inTriangleIndices),
+                   materialIndex, material)
+    { }
 
-        calculateArea();
-        calculateRadiance();
+    ///----------------------------------------------
+
+    VertexObject::VertexObject( std::vector<glm::vec3>&& inVertices,
+            std::vector<glm::ivec3>&& inTriangleIndices, int materialIndex, const MaterialProperties& material)
+    : SceneObject(materialIndex)
+    , vertices(std::move(inVertices))
+    , triangleIndices(std::move(inTriangleIndices))
+    {
+        calculateArea(material);
+        calculateRadiance(material);
+        calculateBoundingBox();
     }
 
     ///----------------------------------------------
 
-    glm::vec3 VertexObject::calculateTriangleNormal(int index)
+    glm::vec3 VertexObject::calculateTriangleNormal(int index) const
     {
         glm::vec3 edge1 = vertices[triangleIndices[index][1]] - vertices[triangleIndices[index][0]];
         glm::vec3 edge2 = vertices[triangleIndices[index][2]] - vertices[triangleIndices[index][0]];
@@ -141,47 +262,26 @@ namespace rayTracer {
 
     ///----------------------------------------------
 
-    std::shared_ptr<VertexObject> VertexObject::createBox(glm::mat4x4 transform, MaterialPtr material)
+    std::shared_ptr<VertexObject> VertexObject::createBox(glm::mat4x4 transform,
+                                                          int materialIndex, const MaterialProperties& material)
     {
-        // Set vertices
         std::vector<glm::vec3> boxVertices;
-        boxVertices.reserve(8);
-        boxVertices.emplace_back(-0.5f, 0.5f, 0.5f);
-        boxVertices.emplace_back(0.5f, 0.5f, 0.5f);
-        boxVertices.emplace_back(-0.5f, -0.5f, 0.5f);
-        boxVertices.emplace_back(0.5f, -0.5f, 0.5f);
-        boxVertices.emplace_back(-0.5f, 0.5f, -0.5f);
-        boxVertices.emplace_back(0.5f, 0.5f, -0.5f);
-        boxVertices.emplace_back(-0.5f, -0.5f, -0.5f);
-        boxVertices.emplace_back(0.5f, -0.5f, -0.5f);
+        std::vector<glm::ivec3> boxTriangleIndices;
+        getUnitBox(boxVertices, boxTriangleIndices);
 
         for (auto& vertex : boxVertices){
             vertex = glm::vec3(transform * glm::vec4(vertex, 1.0f));
         }
 
-        // Set triangle indices
-        std::vector<glm::ivec3> boxTriangleIndices;
-        boxTriangleIndices.reserve(12);
-        boxTriangleIndices.emplace_back(0,2,1);
-        boxTriangleIndices.emplace_back(1,2,3);
-        boxTriangleIndices.emplace_back(1,3,5);
-        boxTriangleIndices.emplace_back(3,7,5);
-        boxTriangleIndices.emplace_back(4,5,7);
-        boxTriangleIndices.emplace_back(4,7,6);
-        boxTriangleIndices.emplace_back(0,4,6);
-        boxTriangleIndices.emplace_back(0,6,2);
-        boxTriangleIndices.emplace_back(0,1,4);
-        boxTriangleIndices.emplace_back(1,5,4);
-        boxTriangleIndices.emplace_back(2,6,3);
-        boxTriangleIndices.emplace_back(3,6,7);
-
-        return std::make_shared<VertexObject>(boxVertices, boxTriangleIndices, material);
+        return std::make_shared<VertexObject>(std::move(boxVertices), std::move(boxTriangleIndices),
+                                              materialIndex, material);
     }
 
     ///----------------------------------------------
 
     std::shared_ptr<VertexObject> VertexObject::createPlane(
-            glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, MaterialPtr material)
+            glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3,
+            int materialIndex, const MaterialProperties& material)
     {
         // Set vertices
         std::vector<glm::vec3> planeVertices;
@@ -197,110 +297,194 @@ namespace rayTracer {
         planeTriangleIndices.emplace_back(0, 1, 2);
         planeTriangleIndices.emplace_back(2, 3, 0);
 
-        return std::make_shared<VertexObject>(planeVertices, planeTriangleIndices, material);
+        return std::make_shared<VertexObject>(std::move(planeVertices), std::move(planeTriangleIndices),
+                                              materialIndex, material);
     }
 
     ///----------------------------------------------
 
-    bool VertexObject::intersectTriangle(std::shared_ptr<Ray> currentRay, int triangleIndex)
+    std::shared_ptr<VertexObject> VertexObject::createFromFile(const std::string& path, glm::mat4x4 transform,
+                                                               int materialIndex, const MaterialProperties& material)
     {
-        glm::vec3 edge1 = vertices[triangleIndices[triangleIndex][1]] - vertices[triangleIndices[triangleIndex][0]];
-        glm::vec3 edge2 = vertices[triangleIndices[triangleIndex][2]] - vertices[triangleIndices[triangleIndex][0]];
+        MeshLoader::Mesh mesh;
+        if (!MeshLoader::load(path, mesh))
+            return nullptr;
 
-        glm::vec3 T = currentRay->getStartPoint() - vertices[triangleIndices[triangleIndex][0]];
-        glm::vec3 direction = currentRay->getDirection();
-        glm::vec3 P = glm::cross(direction, edge2);
-        glm::vec3 Q = glm::cross(T, edge1);
+        int numVertices = int(mesh.vertices.size());
+#pragma omp parallel for if (numVertices > 65536)
+        for (int vertex = 0; vertex < numVertices; ++vertex)
+            mesh.vertices[vertex] = glm::vec3(transform * glm::vec4(mesh.vertices[vertex], 1.0f));
 
-        float a = glm::dot(P, edge1);
+        return std::make_shared<VertexObject>(std::move(mesh.vertices), std::move(mesh.triangleIndices),
+                                              materialIndex, material);
+    }
 
-        // Avoid division by 0
-        if (std::fabs(a) < EPSILON) return false;
+    ///----------------------------------------------
 
-        float f = 1.0f / a;
-        float u = glm::dot(P, T) * f;
-        float v = glm::dot(Q, direction) * f;
+    void VertexObject::addToGeometryStore(GeometryStore& geometryStore, int objectIndex) const
+    {
+        for (int triangle = 0; triangle < int(triangleIndices.size()); ++triangle)
+        {
+            geometryStore.addTriangle(vertices[triangleIndices[triangle].x],
+                                      vertices[triangleIndices[triangle].y],
+                                      vertices[triangleIndices[triangle].z],
+                                      calculateTriangleNormal(triangle), objectIndex, materialIndex);
+        }
+    }
 
-        if (u + v > 1.0f || u < 0.0f || v < 0.0f) return false;
+    ///----------------------------------------------
 
-        float t = glm::dot(Q, edge2) * f;
+    void VertexObject::releaseGeometry()
+    {
+        // Only the light sources have a table, they keep their triangles to pick points on
+        if (!triangleSelection.empty())
+            return;
 
-        if(t > EPSILON && currentRay->foundCloserRayIntersection(t)){
-            // We have an intersection
-            glm::vec3 intersectionPoint = currentRay->getStartPoint() + t * currentRay->getDirection();
-            glm::vec3 intersectionNormal = triangleNormals[triangleIndex];
+        std::vector<glm::vec3>().swap(vertices);
+        std::vector<glm::ivec3>().swap(triangleIndices);
+    }
 
-            std::shared_ptr<Ray::Intersection> newIntersection = std::make_shared<Ray::Intersection>(
-                    intersectionPoint, intersectionNormal, t, material);
+    ///----------------------------------------------
 
-            currentRay->updateRayIntersection(newIntersection);
-            return true;
+    void VertexObject::calculateArea(const MaterialProperties& material)
+    {
+        // Light sources pick their triangles by area, the others only need the total
+        if (material.isEmissive())
+        {
+            std::vector<float> triangleAreas;
+            surfaceArea = float(calculateTriangleAreas(vertices, triangleIndices, glm::mat4x4(1.0f), &triangleAreas));
+            triangleSelection = AliasTable(triangleAreas);
         }
+        else
+            surfaceArea = float(calculateTriangleAreas(vertices, triangleIndices, glm::mat4x4(1.0f), nullptr));
+    }
 
-        return false;
+    ///----------------------------------------------
+
+    void VertexObject::calculateBoundingBox()
+    {
+        boundingBox = BoundingBox();
+        for (const glm::vec3& vertex : vertices)
+            boundingBox.expand(vertex);
+        boundingBox.pad(BOUNDING_BOX_PADDING);
     }
 
     ///----------------------------------------------
 
-    bool VertexObject::intersect(std::shared_ptr<Ray> currentRay)
+    SceneObject::SurfacePoint VertexObject::getRandomPointOnObject(
+            const Ray& /*ray*/, RandomSampler& sampler) const
     {
-        bool intersection = false;
-        for(int triangle = 0; triangle < triangleIndices.size(); ++triangle){
-            if(intersectTriangle(currentRay, triangle) && !intersection)
-                intersection = true;
+        SurfacePoint point = getRandomPointOnTriangles(vertices, triangleIndices, triangleSelection, sampler);
+        point.pdf = 1.0f / surfaceArea;
+        return point;
+    }
+
+    /**********************************/
+    /***         SharedMesh         ***/
+    /**********************************/
+
+    SharedMesh::SharedMesh(std::vector<glm::vec3>&& inVertices, std::vector<glm::ivec3>&& inTriangleIndices)
+    : vertices(std::move(inVertices))
+    , triangleIndices(std::move(inTriangleIndices))
+    {
+        // The instances decide the object and the material
+        for (glm::ivec3 indices : triangleIndices)
+        {
+            glm::vec3 v0 = vertices[indices.x], v1 = vertices[indices.y], v2 = vertices[indices.z];
+            geometry.addTriangle(v0, v1, v2, glm::normalize(glm::cross(v1 - v0, v2 - v0)), -1, -1);
         }
+        geometry.build();
 
-        return intersection;
+        surfaceArea = float(calculateTriangleAreas(vertices, triangleIndices, glm::mat4x4(1.0f), nullptr));
     }
 
     ///----------------------------------------------
 
-    void VertexObject::calculateArea()
+    std::shared_ptr<SharedMesh> SharedMesh::createBox()
     {
-        float totalArea = 0;
-        for(glm::ivec3 indices : triangleIndices){
-            glm::vec3 edge1 = vertices[indices.x] - vertices[indices.y];
-            glm::vec3 edge2 = vertices[indices.z] - vertices[indices.y];
+        std::vector<glm::vec3> boxVertices;
+        std::vector<glm::ivec3> boxTriangleIndices;
+        getUnitBox(boxVertices, boxTriangleIndices);
+        return std::make_shared<SharedMesh>(std::move(boxVertices), std::move(boxTriangleIndices));
+    }
 
-            totalArea += (glm::length(glm::cross(edge1, edge2)) / 2.0f);
-        }
+    ///----------------------------------------------
+
+    std::shared_ptr<SharedMesh> SharedMesh::createFromFile(const std::string& path)
+    {
+        MeshLoader::Mesh mesh;
+        if (!MeshLoader::load(path, mesh))
+            return nullptr;
+        return std::make_shared<SharedMesh>(std::move(mesh.vertices), std::move(mesh.triangleIndices));
+    }
+
+    /**********************************/
+    /***  SceneObject MeshInstance  ***/
+    /**********************************/
 
-        surfaceArea = totalArea;
+    MeshInstance::MeshInstance(std::shared_ptr<const SharedMesh> inMesh, glm::mat4x4 inTransform,
+                               int materialIndex, const MaterialProperties& material)
+    : SceneObject(materialIndex)
+    , mesh(std::move(inMesh))
+    , transform(inTransform)
+    , normalTransform(glm::transpose(glm::inverse(glm::mat3(inTransform))))
+    {
+        calculateArea(material);
+        calculateRadiance(material);
+        calculateBoundingBox();
+    }
+
+    ///----------------------------------------------
+
+    void MeshInstance::addToGeometryStore(GeometryStore& geometryStore, int objectIndex) const
+    {
+        geometryStore.addInstance(mesh->getGeometry(), transform, objectIndex, materialIndex);
     }
 
     ///----------------------------------------------
 
-    glm::vec3 VertexObject::getRandomPointOnObject(
-            std::shared_ptr<Ray> ray,
-            std::mt19937* randGenerator,
-            std::uniform_real_distribution<float>* randDistribution) const
+    void MeshInstance::calculateArea(const MaterialProperties& material)
     {
-        // Get the negative direction so we have it point out of the object
-        glm::vec3 direction = glm::normalize(-1.0f * ray->getDirection());
-
-        // Retrieve a random triangle that has a normal that points in the right direction
-        // (which will in a lot of the cases mean that it should be visible from the inDirection)
-        int randomTriangleIndex = int((*randDistribution)(*randGenerator) * (triangleIndices.size() - 1));
-//        auto angle = glm::pi<float>();
-//        while (angle > glm::half_pi<float>())
-//        {
-//            randomTriangleIndex = int((*randDistribution)(*randGenerator) * triangleIndices.size());
-//            angle = glm::acos(glm::dot(direction, triangleNormals[randomTriangleIndex]));
-//        }
-
-        // Get random point on triangle (uniform pdf(u,v) = 1/area)
-        float u = 1, v = 1;
-        while (u + v > 1.0f)
+        // Going over every triangle of every instance would cost as much as not sharing the mesh. Only
+        // the lights need the exact area, the rest is scaled from the mesh, exact for rotations and
+        // uniform scales. The lights also pick their triangles by their area in the scene.
+        if (material.isEmissive())
         {
-            u = (*randDistribution)(*randGenerator);
-            v = (*randDistribution)(*randGenerator);
+            std::vector<float> triangleAreas;
+            surfaceArea = float(calculateTriangleAreas(mesh->getVertices(), mesh->getTriangleIndices(), transform,
+                                                       &triangleAreas));
+            triangleSelection = AliasTable(triangleAreas);
         }
+        else
+            surfaceArea = mesh->area() * std::pow(std::abs(glm::determinant(glm::mat3(transform))), 2.0f / 3.0f);
+    }
+
+    ///----------------------------------------------
+
+    void MeshInstance::calculateBoundingBox()
+    {
+        BoundingBox meshBounds = mesh->getGeometry().getBounds();
+        boundingBox = BoundingBox();
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            glm::vec3 point((corner & 1) ? meshBounds.max.x : meshBounds.min.x,
+                            (corner & 2) ? meshBounds.max.y : meshBounds.min.y,
+                            (corner & 4) ? meshBounds.max.z : meshBounds.min.z);
+            boundingBox.expand(glm::vec3(transform * glm::vec4(point, 1.0f)));
+        }
+    }
 
-        glm::vec3 v0 = vertices[triangleIndices[randomTriangleIndex].x];
-        glm::vec3 v1 = vertices[triangleIndices[randomTriangleIndex].y];
-        glm::vec3 v2 = vertices[triangleIndices[randomTriangleIndex].z];
+    ///----------------------------------------------
 
-        return (1.0f - u - v) * v0 + u * v1 + v * v2;
+    SceneObject::SurfacePoint MeshInstance::getRandomPointOnObject(
+            const Ray& /*ray*/, RandomSampler& sampler) const
+    {
+        SurfacePoint point = getRandomPointOnTriangles(mesh->getVertices(), mesh->getTriangleIndices(),
+                                                       triangleSelection, sampler);
+        point.position = glm::vec3(transform * glm::vec4(point.position, 1.0f));
+        point.normal = glm::normalize(normalTransform * point.normal);
+        point.pdf = 1.0f / surfaceArea;
+        return point;
     }
 
 } // namespace rayTracer
\ No newline at end of file
@@ -0,0 +1,169 @@
+#include <TileScheduler.h>
+#include <algorithm>
+
+namespace rayTracer {
+
+    namespace {
+
+        /// Interleaves the bits of x and y so that tiles close on the image get close codes
+        std::uint32_t mortonCode(std::uint32_t x, std::uint32_t y)
+        {
+            std::uint32_t code = 0;
+            for (int bit = 0; bit < 16; ++bit)
+            {
+                code |= ((x >> bit) & 1u) << (2 * bit);
+                code |= ((y >> bit) & 1u) << (2 * bit + 1);
+            }
+            return code;
+        }
+
+        std::uint32_t rangeBegin(std::uint64_t range) { return std::uint32_t(range >> 32); }
+        std::uint32_t rangeEnd(std::uint64_t range) { return std::uint32_t(range); }
+
+    } // anonymous namespace
+
+    TileScheduler::TileScheduler()
+        : lastArguments()
+    { }
+
+    ///----------------------------------------------
+
+    TileScheduler::TileScheduler(int pixelWidth, int pixelHeight, int tileSize, int numThreads, int shardIndex, int numShards)
+        : lastArguments()
+    {
+        reset(pixelWidth, pixelHeight, tileSize, numThreads, shardIndex, numShards);
+    }
+
+    ///----------------------------------------------
+
+    void TileScheduler::reset(int pixelWidth, int pixelHeight, int tileSize, int numThreads, int shardIndex, int numShards)
+    {
+        // The ranges hold atomics, which can't be moved, so a new vector of them is swapped in
+        bool threadsChanged = int(workRanges.size()) != std::max(1, numThreads);
+        if (threadsChanged)
+            CacheAlignedVector<WorkRange>(std::max(1, numThreads)).swap(workRanges);
+
+        // Passes and bands of the same size get the same tiles, which only have to be handed out again
+        int arguments[] = { pixelWidth, pixelHeight, tileSize, shardIndex, numShards };
+        if (!threadsChanged && std::equal(arguments, arguments + 5, lastArguments))
+        {
+            splitTiles();
+            return;
+        }
+        std::copy(arguments, arguments + 5, lastArguments);
+
+        tileSize = std::max(1, tileSize);
+        int tilesX = (pixelWidth + tileSize - 1) / tileSize;
+        int tilesY = (pixelHeight + tileSize - 1) / tileSize;
+
+        orderedTiles.clear();
+        orderedTiles.reserve(tilesX * tilesY);
+        for (int y = 0; y < tilesY; ++y)
+        {
+            for (int x = 0; x < tilesX; ++x)
+            {
+                Tile tile;
+                tile.firstRow = y * tileSize;
+                tile.firstColumn = x * tileSize;
+                tile.lastRow = std::min(tile.firstRow + tileSize, pixelHeight);
+                tile.lastColumn = std::min(tile.firstColumn + tileSize, pixelWidth);
+                orderedTiles.push_back(std::make_pair(mortonCode(x, y), tile));
+            }
+        }
+        std::sort(orderedTiles.begin(), orderedTiles.end(),
+                  [](const std::pair<std::uint32_t, Tile>& a, const std::pair<std::uint32_t, Tile>& b) {
+                      return a.first < b.first;
+                  });
+
+        // Taking the shard's tiles round robin along the curve spreads them evenly over the image
+        numShards = std::max(1, numShards);
+        tiles.clear();
+        tiles.reserve(orderedTiles.size() / numShards + 1);
+        for (int tile = shardIndex; tile < int(orderedTiles.size()); tile += numShards)
+            tiles.push_back(orderedTiles[tile].second);
+
+        splitTiles();
+    }
+
+    ///----------------------------------------------
+
+    void TileScheduler::splitTiles()
+    {
+        // Split the tiles into equal contiguous ranges, one per thread
+        int numRanges = int(workRanges.size());
+        int numTiles = int(tiles.size());
+        for (int thread = 0; thread < numRanges; ++thread)
+        {
+            std::uint32_t begin = std::uint32_t(std::int64_t(numTiles) * thread / numRanges);
+            std::uint32_t end = std::uint32_t(std::int64_t(numTiles) * (thread + 1) / numRanges);
+            workRanges[thread].range.store(packRange(begin, end));
+        }
+    }
+
+    ///----------------------------------------------
+
+    bool TileScheduler::nextTile(int thread, Tile& tile)
+    {
+        int tileIndex;
+        if (!takeTile(thread, tileIndex) && !stealTiles(thread, tileIndex))
+            return false;
+
+        tile = tiles[tileIndex];
+        return true;
+    }
+
+    ///----------------------------------------------
+
+    bool TileScheduler::takeTile(int thread, int& tileIndex)
+    {
+        if (thread >= int(workRanges.size()))
+            return false;
+
+        std::atomic<std::uint64_t>& ownRange = workRanges[thread].range;
+        std::uint64_t range = ownRange.load();
+        while (rangeBegin(range) < rangeEnd(range))
+        {
+            // Thieves only ever move the end, so this fails only if one of them got in between
+            if (ownRange.compare_exchange_weak(range, packRange(rangeBegin(range) + 1, rangeEnd(range))))
+            {
+                tileIndex = int(rangeBegin(range));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    ///----------------------------------------------
+
+    bool TileScheduler::stealTiles(int thread, int& tileIndex)
+    {
+        int numRanges = int(workRanges.size());
+        for (int offset = 1; offset <= numRanges; ++offset)
+        {
+            int victim = (thread + offset) % numRanges;
+            if (victim == thread)
+                continue;
+
+            std::atomic<std::uint64_t>& victimRange = workRanges[victim].range;
+            std::uint64_t range = victimRange.load();
+            while (rangeBegin(range) < rangeEnd(range))
+            {
+                // A thread without a range of its own has nowhere to keep extra tiles and only takes one
+                std::uint32_t remaining = rangeEnd(range) - rangeBegin(range);
+                std::uint32_t numStolen = thread < numRanges ? (remaining + 1) / 2 : 1;
+                std::uint32_t stolenBegin = rangeEnd(range) - numStolen;
+                if (!victimRange.compare_exchange_weak(range, packRange(rangeBegin(range), stolenBegin)))
+                    continue;
+
+                // Keep the rest of the stolen tiles in this thread's range where others can steal them in turn.
+                // Only the owner adds to its range and only once it's empty, so a plain store is enough.
+                if (thread < numRanges)
+                    workRanges[thread].range.store(packRange(stolenBegin + 1, rangeEnd(range)));
+                tileIndex = int(stolenBegin);
+                return true;
+            }
+        }
+        return false;
+    }
+
+} // namespace rayTracer
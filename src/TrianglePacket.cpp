@@ -0,0 +1,413 @@
+#include <TrianglePacket.h>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RAYTRACER_X86_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define RAYTRACER_TARGET_AVX2
+#else
+#define RAYTRACER_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace rayTracer {
+
+    namespace {
+        // Has to be the same as the epsilon used when intersecting triangles one by one
+        const float EPSILON = 1e-6f;
+
+        // NOTE: the kernels below must do exactly the same floating point operations in
+        // the same order as glm::cross/glm::dot in the scalar version, otherwise the
+        // results would differ in the last bit from testing the triangles one by one.
+
+        /// Möller–Trumbore test of a single lane, true on a hit with a distance in (EPSILON, tMax)
+        inline bool hitsLaneScalar(const TrianglePacket& packet, int lane, glm::vec3 origin, glm::vec3 direction,
+                                   float tMax, float& t)
+        {
+            glm::vec3 v0(packet.v0[0][lane], packet.v0[1][lane], packet.v0[2][lane]);
+            glm::vec3 edge1(packet.edge1[0][lane], packet.edge1[1][lane], packet.edge1[2][lane]);
+            glm::vec3 edge2(packet.edge2[0][lane], packet.edge2[1][lane], packet.edge2[2][lane]);
+
+            glm::vec3 T = origin - v0;
+            glm::vec3 P = glm::cross(direction, edge2);
+            glm::vec3 Q = glm::cross(T, edge1);
+
+            float a = glm::dot(P, edge1);
+
+            // Avoid division by 0
+            if (std::fabs(a) < EPSILON) return false;
+
+            float f = 1.0f / a;
+            float u = glm::dot(P, T) * f;
+            float v = glm::dot(Q, direction) * f;
+
+            if (u + v > 1.0f || u < 0.0f || v < 0.0f) return false;
+
+            t = glm::dot(Q, edge2) * f;
+            return t > EPSILON && t < tMax;
+        }
+
+        int intersectScalar(const TrianglePacket& packet, int firstLane, int count,
+                            glm::vec3 origin, glm::vec3 direction, float tMax, float& t)
+        {
+            int hitLane = -1;
+            for (int lane = firstLane; lane < firstLane + count; ++lane)
+            {
+                float laneT;
+                if (hitsLaneScalar(packet, lane, origin, direction, tMax, laneT))
+                {
+                    tMax = laneT;
+                    hitLane = lane;
+                }
+            }
+
+            if (hitLane >= 0)
+                t = tMax;
+            return hitLane;
+        }
+
+        bool occludedScalar(const TrianglePacket& packet, int firstLane, int count,
+                            glm::vec3 origin, glm::vec3 direction, float tMax)
+        {
+            float t;
+            for (int lane = firstLane; lane < firstLane + count; ++lane)
+            {
+                if (hitsLaneScalar(packet, lane, origin, direction, tMax, t))
+                    return true;
+            }
+            return false;
+        }
+
+#ifdef RAYTRACER_X86_SIMD
+
+        /// Tests the four lanes starting at 'base', only lanes in [base + firstValid, base + lastValid)
+        /// can be hits. Returns the mask of the lanes hit in (EPSILON, tMax) and their distances.
+        inline __m128 hitMaskSSE(const TrianglePacket& packet, int base, int firstValid, int lastValid,
+                                 glm::vec3 origin, glm::vec3 direction, float tMax, __m128& laneT)
+        {
+            const __m128 epsilon = _mm_set1_ps(EPSILON);
+            const __m128 one = _mm_set1_ps(1.0f);
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 signBit = _mm_set1_ps(-0.0f);
+            const __m128 laneIndices = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+            const __m128 dx = _mm_set1_ps(direction.x), dy = _mm_set1_ps(direction.y), dz = _mm_set1_ps(direction.z);
+
+            __m128 e1x = _mm_loadu_ps(&packet.edge1[0][base]);
+            __m128 e1y = _mm_loadu_ps(&packet.edge1[1][base]);
+            __m128 e1z = _mm_loadu_ps(&packet.edge1[2][base]);
+            __m128 e2x = _mm_loadu_ps(&packet.edge2[0][base]);
+            __m128 e2y = _mm_loadu_ps(&packet.edge2[1][base]);
+            __m128 e2z = _mm_loadu_ps(&packet.edge2[2][base]);
+
+            __m128 tx = _mm_sub_ps(_mm_set1_ps(origin.x), _mm_loadu_ps(&packet.v0[0][base]));
+            __m128 ty = _mm_sub_ps(_mm_set1_ps(origin.y), _mm_loadu_ps(&packet.v0[1][base]));
+            __m128 tz = _mm_sub_ps(_mm_set1_ps(origin.z), _mm_loadu_ps(&packet.v0[2][base]));
+
+            // P = cross(direction, edge2)
+            __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(e2y, dz));
+            __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(e2z, dx));
+            __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(e2x, dy));
+
+            // Q = cross(T, edge1)
+            __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(e1y, tz));
+            __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(e1z, tx));
+            __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(e1x, ty));
+
+            __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, e1x), _mm_mul_ps(py, e1y)), _mm_mul_ps(pz, e1z));
+            __m128 f = _mm_div_ps(one, a);
+            __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px, tx), _mm_mul_ps(py, ty)), _mm_mul_ps(pz, tz)), f);
+            __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(qx, dx), _mm_mul_ps(qy, dy)), _mm_mul_ps(qz, dz)), f);
+            laneT = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(qx, e2x), _mm_mul_ps(qy, e2y)), _mm_mul_ps(qz, e2z)), f);
+
+            // The negated comparisons let NaNs through just like the scalar early outs do
+            __m128 valid = _mm_and_ps(_mm_cmpnlt_ps(laneIndices, _mm_set1_ps(float(firstValid))),
+                                      _mm_cmplt_ps(laneIndices, _mm_set1_ps(float(lastValid))));
+            valid = _mm_and_ps(valid, _mm_cmpnlt_ps(_mm_andnot_ps(signBit, a), epsilon));
+            valid = _mm_and_ps(valid, _mm_cmpngt_ps(_mm_add_ps(u, v), one));
+            valid = _mm_and_ps(valid, _mm_cmpnlt_ps(u, zero));
+            valid = _mm_and_ps(valid, _mm_cmpnlt_ps(v, zero));
+            valid = _mm_and_ps(valid, _mm_cmpgt_ps(laneT, epsilon));
+            valid = _mm_and_ps(valid, _mm_cmplt_ps(laneT, _mm_set1_ps(tMax)));
+            return valid;
+        }
+
+        // Loads are four lanes wide, starting at the first lane, so at most one load
+        // can reach past the end of the packet's arrays. Stay inside by backing up.
+        inline int sseLoadBase(int start)
+        {
+            return start + 4 <= TrianglePacket::WIDTH ? start : TrianglePacket::WIDTH - 4;
+        }
+
+        int intersectSSE(const TrianglePacket& packet, int firstLane, int count,
+                         glm::vec3 origin, glm::vec3 direction, float tMax, float& t)
+        {
+            const __m128 infinity = _mm_set1_ps(std::numeric_limits<float>::infinity());
+
+            int lastLane = firstLane + count;
+            int hitLane = -1;
+            for (int start = firstLane; start < lastLane; start += 4)
+            {
+                int base = sseLoadBase(start);
+                __m128 laneT;
+                __m128 valid = hitMaskSSE(packet, base, start - base, lastLane - base, origin, direction, tMax, laneT);
+                if (_mm_movemask_ps(valid) == 0)
+                    continue;
+
+                // Horizontal min over the valid lanes, the first lane holding it wins ties
+                __m128 candidates = _mm_or_ps(_mm_and_ps(valid, laneT), _mm_andnot_ps(valid, infinity));
+                __m128 minimum = _mm_min_ps(candidates, _mm_shuffle_ps(candidates, candidates, _MM_SHUFFLE(2, 3, 0, 1)));
+                minimum = _mm_min_ps(minimum, _mm_shuffle_ps(minimum, minimum, _MM_SHUFFLE(1, 0, 3, 2)));
+                int closestMask = _mm_movemask_ps(_mm_and_ps(valid, _mm_cmpeq_ps(candidates, minimum)));
+
+                int lane = 0;
+                while (!(closestMask & (1 << lane)))
+                    ++lane;
+                hitLane = base + lane;
+                tMax = _mm_cvtss_f32(minimum);
+            }
+
+            if (hitLane >= 0)
+                t = tMax;
+            return hitLane;
+        }
+
+        bool occludedSSE(const TrianglePacket& packet, int firstLane, int count,
+                         glm::vec3 origin, glm::vec3 direction, float tMax)
+        {
+            int lastLane = firstLane + count;
+            for (int start = firstLane; start < lastLane; start += 4)
+            {
+                int base = sseLoadBase(start);
+                __m128 laneT;
+                if (_mm_movemask_ps(hitMaskSSE(packet, base, start - base, lastLane - base, origin, direction, tMax, laneT)))
+                    return true;
+            }
+            return false;
+        }
+
+        ///----------------------------------------------
+
+        /// Tests all eight lanes, only lanes in [firstLane, firstLane + count) can be hits. Returns
+        /// the mask of the lanes hit in (EPSILON, tMax) and their distances.
+        RAYTRACER_TARGET_AVX2
+        inline __m256 hitMaskAVX2(const TrianglePacket& packet, int firstLane, int count,
+                                  glm::vec3 origin, glm::vec3 direction, float tMax, __m256& laneT)
+        {
+            const __m256 epsilon = _mm256_set1_ps(EPSILON);
+            const __m256 one = _mm256_set1_ps(1.0f);
+            const __m256 zero = _mm256_setzero_ps();
+            const __m256 signBit = _mm256_set1_ps(-0.0f);
+            const __m256 laneIndices = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+
+            const __m256 dx = _mm256_set1_ps(direction.x);
+            const __m256 dy = _mm256_set1_ps(direction.y);
+            const __m256 dz = _mm256_set1_ps(direction.z);
+
+            __m256 e1x = _mm256_loadu_ps(packet.edge1[0]);
+            __m256 e1y = _mm256_loadu_ps(packet.edge1[1]);
+            __m256 e1z = _mm256_loadu_ps(packet.edge1[2]);
+            __m256 e2x = _mm256_loadu_ps(packet.edge2[0]);
+            __m256 e2y = _mm256_loadu_ps(packet.edge2[1]);
+            __m256 e2z = _mm256_loadu_ps(packet.edge2[2]);
+
+            __m256 tx = _mm256_sub_ps(_mm256_set1_ps(origin.x), _mm256_loadu_ps(packet.v0[0]));
+            __m256 ty = _mm256_sub_ps(_mm256_set1_ps(origin.y), _mm256_loadu_ps(packet.v0[1]));
+            __m256 tz = _mm256_sub_ps(_mm256_set1_ps(origin.z), _mm256_loadu_ps(packet.v0[2]));
+
+            // P = cross(direction, edge2)
+            __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(e2y, dz));
+            __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(e2z, dx));
+            __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(e2x, dy));
+
+            // Q = cross(T, edge1)
+            __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(e1y, tz));
+            __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(e1z, tx));
+            __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(e1x, ty));
+
+            __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, e1x), _mm256_mul_ps(py, e1y)), _mm256_mul_ps(pz, e1z));
+            __m256 f = _mm256_div_ps(one, a);
+            __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, tx), _mm256_mul_ps(py, ty)), _mm256_mul_ps(pz, tz)), f);
+            __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(qx, dx), _mm256_mul_ps(qy, dy)), _mm256_mul_ps(qz, dz)), f);
+            laneT = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(qx, e2x), _mm256_mul_ps(qy, e2y)), _mm256_mul_ps(qz, e2z)), f);
+
+            // The negated comparisons let NaNs through just like the scalar early outs do
+            __m256 valid = _mm256_and_ps(_mm256_cmp_ps(laneIndices, _mm256_set1_ps(float(firstLane)), _CMP_GE_OQ),
+                                         _mm256_cmp_ps(laneIndices, _mm256_set1_ps(float(firstLane + count)), _CMP_LT_OQ));
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_andnot_ps(signBit, a), epsilon, _CMP_NLT_UQ));
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_NGT_UQ));
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, zero, _CMP_NLT_UQ));
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(v, zero, _CMP_NLT_UQ));
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(laneT, epsilon, _CMP_GT_OQ));
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(laneT, _mm256_set1_ps(tMax), _CMP_LT_OQ));
+            return valid;
+        }
+
+        RAYTRACER_TARGET_AVX2
+        int intersectAVX2(const TrianglePacket& packet, int firstLane, int count,
+                          glm::vec3 origin, glm::vec3 direction, float tMax, float& t)
+        {
+            __m256 laneT;
+            __m256 valid = hitMaskAVX2(packet, firstLane, count, origin, direction, tMax, laneT);
+            if (_mm256_movemask_ps(valid) == 0)
+                return -1;
+
+            // Horizontal min over the valid lanes, the first lane holding it wins ties
+            __m256 candidates = _mm256_blendv_ps(_mm256_set1_ps(std::numeric_limits<float>::infinity()), laneT, valid);
+            __m256 minimum = _mm256_min_ps(candidates, _mm256_permute2f128_ps(candidates, candidates, 1));
+            minimum = _mm256_min_ps(minimum, _mm256_shuffle_ps(minimum, minimum, _MM_SHUFFLE(1, 0, 3, 2)));
+            minimum = _mm256_min_ps(minimum, _mm256_shuffle_ps(minimum, minimum, _MM_SHUFFLE(2, 3, 0, 1)));
+            int closestMask = _mm256_movemask_ps(_mm256_and_ps(valid, _mm256_cmp_ps(candidates, minimum, _CMP_EQ_OQ)));
+
+            int lane = 0;
+            while (!(closestMask & (1 << lane)))
+                ++lane;
+            t = _mm256_cvtss_f32(minimum);
+            return lane;
+        }
+
+        RAYTRACER_TARGET_AVX2
+        bool occludedAVX2(const TrianglePacket& packet, int firstLane, int count,
+                          glm::vec3 origin, glm::vec3 direction, float tMax)
+        {
+            __m256 laneT;
+            return _mm256_movemask_ps(hitMaskAVX2(packet, firstLane, count, origin, direction, tMax, laneT)) != 0;
+        }
+
+        ///----------------------------------------------
+
+        bool cpuSupportsAVX2()
+        {
+#if defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7)
+                return false;
+
+            // The OS also has to save the AVX registers on context switches
+            __cpuid(info, 1);
+            bool osUsesXSave = (info[2] & (1 << 27)) != 0;
+            bool hasAVX = (info[2] & (1 << 28)) != 0;
+            if (!osUsesXSave || !hasAVX || (_xgetbv(0) & 6) != 6)
+                return false;
+
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#else
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") != 0;
+#endif
+        }
+
+#endif // RAYTRACER_X86_SIMD
+
+        TriangleKernel::InstructionSet bestSupportedInstructionSet()
+        {
+#ifdef RAYTRACER_X86_SIMD
+            if (cpuSupportsAVX2())
+                return TriangleKernel::InstructionSet::AVX2;
+            return TriangleKernel::InstructionSet::SSE;
+#else
+            return TriangleKernel::InstructionSet::Scalar;
+#endif
+        }
+
+        TriangleKernel::InstructionSet& activeInstructionSet()
+        {
+            static TriangleKernel::InstructionSet instructionSet = bestSupportedInstructionSet();
+            return instructionSet;
+        }
+
+    } // anonymous namespace
+
+    TrianglePacket::TrianglePacket()
+    {
+        for (int lane = 0; lane < WIDTH; ++lane)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                v0[axis][lane] = 0.0f;
+                edge1[axis][lane] = 0.0f;
+                edge2[axis][lane] = 0.0f;
+            }
+            triangleIndices[lane] = -1;
+        }
+    }
+
+    ///----------------------------------------------
+
+    void TrianglePacket::setTriangle(int lane, glm::vec3 vertex0, glm::vec3 vertex1, glm::vec3 vertex2, int triangleIndex)
+    {
+        glm::vec3 e1 = vertex1 - vertex0;
+        glm::vec3 e2 = vertex2 - vertex0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            v0[axis][lane] = vertex0[axis];
+            edge1[axis][lane] = e1[axis];
+            edge2[axis][lane] = e2[axis];
+        }
+        triangleIndices[lane] = triangleIndex;
+    }
+
+    ///----------------------------------------------
+
+    TriangleKernel::InstructionSet TriangleKernel::getInstructionSet()
+    {
+        return activeInstructionSet();
+    }
+
+    ///----------------------------------------------
+
+    void TriangleKernel::setInstructionSet(InstructionSet instructionSet)
+    {
+        InstructionSet best = bestSupportedInstructionSet();
+        activeInstructionSet() = int(instructionSet) <= int(best) ? instructionSet : best;
+    }
+
+    ///----------------------------------------------
+
+    int TriangleKernel::preferredLeafSize()
+    {
+        return activeInstructionSet() == InstructionSet::AVX2 ? 8 : 4;
+    }
+
+    ///----------------------------------------------
+
+    int TriangleKernel::intersect(const TrianglePacket& packet, int firstLane, int count,
+                                  glm::vec3 origin, glm::vec3 direction, float tMax, float& t)
+    {
+        switch (activeInstructionSet())
+        {
+#ifdef RAYTRACER_X86_SIMD
+            case InstructionSet::AVX2:
+                return intersectAVX2(packet, firstLane, count, origin, direction, tMax, t);
+            case InstructionSet::SSE:
+                return intersectSSE(packet, firstLane, count, origin, direction, tMax, t);
+#endif
+            default:
+                return intersectScalar(packet, firstLane, count, origin, direction, tMax, t);
+        }
+    }
+
+    ///----------------------------------------------
+
+    bool TriangleKernel::occluded(const TrianglePacket& packet, int firstLane, int count,
+                                  glm::vec3 origin, glm::vec3 direction, float tMax)
+    {
+        switch (activeInstructionSet())
+        {
+#ifdef RAYTRACER_X86_SIMD
+            case InstructionSet::AVX2:
+                return occludedAVX2(packet, firstLane, count, origin, direction, tMax);
+            case InstructionSet::SSE:
+                return occludedSSE(packet, firstLane, count, origin, direction, tMax);
+#endif
+            default:
+                return occludedScalar(packet, firstLane, count, origin, direction, tMax);
+        }
+    }
+
+} // namespace rayTracer
@@ -0,0 +1,275 @@
+#include <WavefrontIntegrator.h>
+#include <Camera.h>
+#include <SceneObject.h>
+
+namespace rayTracer {
+
+    WavefrontIntegrator::WavefrontIntegrator(const Scene& inScene, int maxPathsPerBatch)
+        : scene(inScene)
+        , samplesPerPixel(1)
+        , shadowRaysPerPath(inScene.emissiveObjectIndices.empty() ? 0 : glm::max(0, inScene.renderSettings.numShadowRays))
+        , numBounces(0)
+    {
+        std::size_t maxPaths = std::size_t(glm::max(1, maxPathsPerBatch));
+        rays.reserve(maxPaths);
+        nextRays.reserve(maxPaths);
+        pdfs.reserve(maxPaths);
+        nextPdfs.reserve(maxPaths);
+        samplers.reserve(maxPaths);
+        hits.reserve(maxPaths);
+        continues.reserve(maxPaths);
+        shadowRaySlots.reserve(maxPaths * shadowRaysPerPath);
+        shadowRayQueue.reserve(maxPaths * shadowRaysPerPath);
+
+        // Past the first bounce a path goes on with the Russian roulette coefficient at diffuse surfaces,
+        // which gives 1 / (1 - coefficient) vertices on average. The vertices of a whole batch stay
+        // well below one and a half times that.
+        float continuation = glm::clamp(inScene.renderSettings.russianRouletteCoefficient, 0.0f, 0.95f);
+        vertices.reserve(maxPaths * std::size_t(1.5f / (1.0f - continuation) + 1.0f));
+        firstVertices.reserve(256);
+    }
+
+    ///----------------------------------------------
+
+    void WavefrontIntegrator::renderRows(Camera& camera, int firstRow, int lastRow, int firstSample, int inSamplesPerPixel,
+                                         BVH::TraversalStatistics& statistics)
+    {
+        samplesPerPixel = glm::max(1, inSamplesPerPixel);
+        generate(camera, firstRow, lastRow, firstSample);
+
+        numBounces = 0;
+        firstVertices.assign(1, 0);
+        while (!rays.empty())
+        {
+            firstVertices.push_back(firstVertices.back() + int(rays.size()));
+            vertices.resize(firstVertices.back());
+
+            extend(statistics);
+            shade(numBounces);
+            connect(numBounces, statistics);
+            compact(numBounces);
+            ++numBounces;
+        }
+
+        resolve(camera, firstRow, lastRow);
+    }
+
+    ///----------------------------------------------
+
+    void WavefrontIntegrator::generate(Camera& camera, int firstRow, int lastRow, int firstSample)
+    {
+        int pixelWidth = camera.getPixelWidth();
+        int pixelHeight = camera.getPixelHeight();
+        int numPixels = (lastRow - firstRow) * pixelWidth;
+        rays.resize(numPixels * samplesPerPixel);
+        pdfs.assign(numPixels * samplesPerPixel, 0.0f);
+        samplers.resize(numPixels * samplesPerPixel);
+
+        // Every path is stored at pixel * samplesPerPixel + sample, the first bounce keeps that order
+#pragma omp parallel for
+        for (int pixel = 0; pixel < numPixels; ++pixel)
+        {
+            int i = firstRow + pixel / pixelWidth;
+            int j = pixel % pixelWidth;
+            for (int subSample = 0; subSample < samplesPerPixel; ++subSample)
+            {
+                RandomSampler& sampler = samplers[pixel * samplesPerPixel + subSample];
+                sampler = RandomSampler(camera.getFramePixelIndex(i, j), firstSample + subSample, scene.renderSettings.randomSeed);
+                rays[pixel * samplesPerPixel + subSample] = camera.createCameraRay(j, pixelHeight - i - 1,
+                        sampler.next() - 0.5f, sampler.next() - 0.5f);
+            }
+        }
+    }
+
+    ///----------------------------------------------
+
+    void WavefrontIntegrator::extend(BVH::TraversalStatistics& statistics)
+    {
+        int numPaths = int(rays.size());
+        hits.resize(numPaths);
+
+        long long numRays = 0, numNodesVisited = 0, numPrimitivesTested = 0;
+#pragma omp parallel for reduction(+:numRays, numNodesVisited, numPrimitivesTested)
+        for (int path = 0; path < numPaths; ++path)
+        {
+            BVH::TraversalStatistics pathStatistics;
+            hits[path] = scene.findClosestIntersection(rays[path], pathStatistics);
+
+            numRays += pathStatistics.numRays;
+            numNodesVisited += pathStatistics.numNodesVisited;
+            numPrimitivesTested += pathStatistics.numPrimitivesTested;
+        }
+        statistics.numRays += numRays;
+        statistics.numNodesVisited += numNodesVisited;
+        statistics.numPrimitivesTested += numPrimitivesTested;
+    }
+
+    ///----------------------------------------------
+
+    void WavefrontIntegrator::shade(int bounce)
+    {
+        int numPaths = int(rays.size());
+        nextRays.resize(numPaths);
+        nextPdfs.resize(numPaths);
+        continues.resize(numPaths);
+        shadowRaySlots.resize(numPaths * shadowRaysPerPath);
+
+        const RenderSettings& settings = scene.renderSettings;
+        PathVertex* pathVertices = vertices.data() + firstVertices[bounce];
+
+#pragma omp parallel for
+        for (int path = 0; path < numPaths; ++path)
+        {
+            PathVertex& vertex = pathVertices[path];
+            vertex.emitted = vertex.directLight = vertex.weight = vertex.radiance = glm::vec3(0.0f);
+            vertex.nextVertex = -1;
+            continues[path] = false;
+
+            ShadowRay* shadowRays = shadowRaysPerPath > 0 ? &shadowRaySlots[path * shadowRaysPerPath] : nullptr;
+            for (int slot = 0; slot < shadowRaysPerPath; ++slot)
+                shadowRays[slot].vertex = -1;
+
+            // The path left the scene, nothing more to add
+            if (!hits[path])
+                continue;
+
+            const Ray& ray = rays[path];
+            RandomSampler& sampler = samplers[path];
+            const MaterialProperties& material = scene.getMaterial(ray);
+
+            // Same choices as Scene::shadeIntersection
+            if (material.isEmissive())
+            {
+                vertex.emitted = scene.getEmittedLight(ray, pdfs[path]);
+                continue;
+            }
+
+            glm::vec3 reflectedWeight;
+            float reflectedPdf;
+            Ray reflectedRay = ray.generateReflectedRay(material, sampler, reflectedWeight, reflectedPdf);
+
+            float randomNum = sampler.next();
+            if (!material.isDiffuse() || randomNum < settings.russianRouletteCoefficient)
+            {
+                float continuation = material.isDiffuse() ? settings.russianRouletteCoefficient : 1.0f;
+                vertex.weight = reflectedWeight / continuation;
+                nextRays[path] = reflectedRay;
+                nextPdfs[path] = reflectedPdf;
+                continues[path] = true;
+            }
+
+            if (!material.isDiffuse())
+                continue;
+
+            // Queue up the shadow rays, they are tested for all paths at once in connect()
+            Scene::ShadowConnection connections[Scene::SHADOW_RAY_BATCH_SIZE];
+            for (int first = 0; first < shadowRaysPerPath; first += Scene::SHADOW_RAY_BATCH_SIZE)
+            {
+                int count = glm::min(shadowRaysPerPath - first, int(Scene::SHADOW_RAY_BATCH_SIZE));
+                int numConnections = scene.connectToLights(ray, count, sampler, connections);
+                for (int i = 0; i < numConnections; ++i)
+                {
+                    ShadowRay& shadowRay = shadowRays[first + i];
+                    shadowRay.connection = connections[i];
+                    shadowRay.vertex = path;
+                }
+            }
+        }
+    }
+
+    ///----------------------------------------------
+
+    void WavefrontIntegrator::connect(int bounce, BVH::TraversalStatistics& statistics)
+    {
+        // Gather the slots that got a shadow ray so the tests run over a dense array
+        shadowRayQueue.clear();
+        shadowRayQueue.reserve(shadowRaySlots.size());
+        for (const ShadowRay& shadowRay : shadowRaySlots)
+        {
+            if (shadowRay.vertex >= 0)
+                shadowRayQueue.push_back(shadowRay);
+        }
+
+        int numShadowRays = int(shadowRayQueue.size());
+        long long numRays = 0, numNodesVisited = 0, numPrimitivesTested = 0;
+#pragma omp parallel for reduction(+:numRays, numNodesVisited, numPrimitivesTested)
+        for (int i = 0; i < numShadowRays; ++i)
+        {
+            BVH::TraversalStatistics shadowRayStatistics;
+            Scene::ShadowConnection& connection = shadowRayQueue[i].connection;
+            if (scene.occluded(connection.origin, connection.direction, connection.distance, shadowRayStatistics))
+                connection.contribution = glm::vec3(0.0f);
+
+            numRays += shadowRayStatistics.numRays;
+            numNodesVisited += shadowRayStatistics.numNodesVisited;
+            numPrimitivesTested += shadowRayStatistics.numPrimitivesTested;
+        }
+        statistics.numRays += numRays;
+        statistics.numNodesVisited += numNodesVisited;
+        statistics.numPrimitivesTested += numPrimitivesTested;
+
+        // Several shadow rays can belong to the same vertex, add them up serially
+        PathVertex* pathVertices = vertices.data() + firstVertices[bounce];
+        for (const ShadowRay& shadowRay : shadowRayQueue)
+            pathVertices[shadowRay.vertex].directLight += shadowRay.connection.contribution;
+    }
+
+    ///----------------------------------------------
+
+    void WavefrontIntegrator::compact(int bounce)
+    {
+        PathVertex* pathVertices = vertices.data() + firstVertices[bounce];
+        int numPaths = int(rays.size());
+        int numContinuing = 0;
+        for (int path = 0; path < numPaths; ++path)
+        {
+            if (!continues[path])
+                continue;
+
+            pathVertices[path].nextVertex = numContinuing;
+            samplers[numContinuing] = samplers[path].nextBounce();
+            pdfs[numContinuing] = nextPdfs[path];
+            rays[numContinuing++] = nextRays[path];
+        }
+        rays.resize(numContinuing);
+        pdfs.resize(numContinuing);
+        samplers.resize(numContinuing);
+    }
+
+    ///----------------------------------------------
+
+    void WavefrontIntegrator::resolve(Camera& camera, int firstRow, int lastRow)
+    {
+        // Walk the bounces backwards so the light coming from the next vertex is always known
+        for (int bounce = numBounces - 1; bounce >= 0; --bounce)
+        {
+            PathVertex* pathVertices = vertices.data() + firstVertices[bounce];
+            const PathVertex* nextVertices = vertices.data() + firstVertices[bounce + 1];
+            int numVertices = firstVertices[bounce + 1] - firstVertices[bounce];
+
+#pragma omp parallel for
+            for (int i = 0; i < numVertices; ++i)
+            {
+                PathVertex& vertex = pathVertices[i];
+                glm::vec3 indirectLight = vertex.emitted;
+                if (vertex.nextVertex >= 0)
+                    indirectLight += nextVertices[vertex.nextVertex].radiance * vertex.weight;
+
+                vertex.radiance = indirectLight + vertex.directLight;
+            }
+        }
+
+        int pixelWidth = camera.getPixelWidth();
+        int numPixels = (lastRow - firstRow) * pixelWidth;
+        for (int pixel = 0; pixel < numPixels; ++pixel)
+        {
+            glm::vec3 finalColor = glm::vec3(0.0f);
+            for (int subSample = 0; subSample < samplesPerPixel; ++subSample)
+                finalColor += scene.clampSample(vertices[pixel * samplesPerPixel + subSample].radiance);
+
+            camera.setPixelValue(firstRow + pixel / pixelWidth, pixel % pixelWidth, finalColor / float(samplesPerPixel));
+            camera.setPixelSampleCount(firstRow + pixel / pixelWidth, pixel % pixelWidth, samplesPerPixel);
+        }
+    }
+
+} // namespace rayTracer
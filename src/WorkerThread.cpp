@@ -0,0 +1,67 @@
+#include <WorkerThread.h>
+
+namespace rayTracer {
+
+    WorkerThread::~WorkerThread()
+    {
+        if (!thread.joinable())
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        thread.join();
+    }
+
+    ///----------------------------------------------
+
+    void WorkerThread::start()
+    {
+        if (!thread.joinable())
+            thread = std::thread([this]() { loop(); });
+    }
+
+    ///----------------------------------------------
+
+    void WorkerThread::run(std::function<void()> nextJob)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this]() { return !hasJob; });
+        job = std::move(nextJob);
+        hasJob = true;
+        lock.unlock();
+        condition.notify_all();
+    }
+
+    ///----------------------------------------------
+
+    void WorkerThread::wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this]() { return !hasJob; });
+    }
+
+    ///----------------------------------------------
+
+    void WorkerThread::loop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            // The job that was handed over before stopping is still run
+            condition.wait(lock, [this]() { return hasJob || stopping; });
+            if (!hasJob)
+                return;
+
+            lock.unlock();
+            job();
+            lock.lock();
+
+            hasJob = false;
+            condition.notify_all();
+        }
+    }
+
+} // namespace rayTracer
@@ -0,0 +1,263 @@
+#include <Camera.h>
+#include <ImageWriter.h>
+#include <RenderSettings.h>
+#include <Scene.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace rayTracer;
+
+/// Renders the default scene at a low resolution and checks what the commit messages claim:
+/// tracing doesn't allocate in any mode, the wavefront integrator, the scene cache, the image writers, the shards and the
+/// checkpoints give back exactly what went in. Runs in the build directory, where it writes its files.
+namespace {
+
+    const int WIDTH = 64;
+    const int HEIGHT = 36;
+    const std::string CAMERA_NAME = "TestCamera";
+
+    int numFailures = 0;
+
+    void check(bool condition, const std::string& description)
+    {
+        std::cout << (condition ? "passed: " : "FAILED: ") << description << std::endl;
+        if (!condition)
+            ++numFailures;
+    }
+
+    std::shared_ptr<Camera> createCamera()
+    {
+        return std::make_shared<Camera>(glm::vec3(0, 0, 2.8), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0),
+                                        glm::pi<float>() / 3.5f, WIDTH, HEIGHT, CAMERA_NAME);
+    }
+
+    /// The settings of main.cpp, writing to the given path
+    RenderSettings createSettings(const std::string& outputPath)
+    {
+        RenderSettings settings;
+        settings.numSubSamplesPerPixel = 2;
+        settings.numShadowRays = 3;
+        settings.russianRouletteCoefficient = 0.9f;
+        settings.outputProgressEveryXPercent = 50;
+        settings.outputPath = outputPath;
+        return settings;
+    }
+
+    /// Renders the scene with a new camera, returns the number of allocations while tracing
+    long long render(Scene& scene, const RenderSettings& settings)
+    {
+        scene.addCamera(createCamera());
+        scene.render(CAMERA_NAME, settings);
+        return scene.getNumAllocationsWhileTracing();
+    }
+
+    /// The whole file, empty if it can't be read
+    std::vector<char> readFile(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    bool sameFiles(const std::string& path, const std::string& otherPath)
+    {
+        std::vector<char> data = readFile(path);
+        return !data.empty() && data == readFile(otherPath);
+    }
+
+    /// The values of a PFM, bottom row first as they are in the file, after its three line header
+    std::vector<float> readPFM(const std::string& path)
+    {
+        std::vector<char> data = readFile(path);
+        std::size_t headerSize = 0;
+        for (int newLines = 0; headerSize < data.size() && newLines < 3; ++headerSize)
+            newLines += data[headerSize] == '\n';
+
+        std::vector<float> values((data.size() - headerSize) / sizeof(float));
+        if (!values.empty())
+            std::memcpy(values.data(), data.data() + headerSize, values.size() * sizeof(float));
+        return values;
+    }
+
+    ///----------------------------------------------
+
+    void testTracingDoesNotAllocate()
+    {
+        RenderSettings settings = createSettings("allocations.pfm");
+        check(render(*Scene::createDefaultScene(), settings) == 0, "tiles don't allocate while tracing");
+
+        settings.usePacketTracing = true;
+        check(render(*Scene::createDefaultScene(), settings) == 0, "packets don't allocate while tracing");
+
+        settings.usePacketTracing = false;
+        settings.useAdaptiveSampling = true;
+        settings.maxSubSamplesPerPixel = 8;
+        check(render(*Scene::createDefaultScene(), settings) == 0, "adaptive sampling doesn't allocate while tracing");
+
+        settings = createSettings("allocations.png");
+        settings.useStreamingOutput = true;
+        check(render(*Scene::createDefaultScene(), settings) == 0, "streaming doesn't allocate while tracing");
+
+        settings = createSettings("allocations.pfm");
+        settings.useWavefrontIntegrator = true;
+        check(render(*Scene::createDefaultScene(), settings) == 0, "the wavefront integrator doesn't allocate while tracing");
+
+        settings = createSettings("allocations.pfm");
+        settings.useProgressiveRendering = true;
+        settings.maxPasses = 3;
+        check(render(*Scene::createDefaultScene(), settings) == 0, "progressive passes don't allocate while tracing");
+
+        settings.checkpointEveryXPasses = 1;
+        check(render(*Scene::createDefaultScene(), settings) == 0, "checkpoints don't allocate while tracing");
+
+        settings.useWavefrontIntegrator = true;
+        check(render(*Scene::createDefaultScene(), settings) == 0,
+              "progressive wavefront passes don't allocate while tracing");
+    }
+
+    ///----------------------------------------------
+
+    void testWavefrontMatchesRecursive()
+    {
+        render(*Scene::createDefaultScene(), createSettings("recursive.pfm"));
+        RenderSettings settings = createSettings("wavefront.pfm");
+        settings.useWavefrontIntegrator = true;
+        render(*Scene::createDefaultScene(), settings);
+
+        // The same paths, only the sums of the light are put together in another order
+        std::vector<float> recursive = readPFM("recursive.pfm");
+        std::vector<float> wavefront = readPFM("wavefront.pfm");
+        bool sameImage = !recursive.empty() && recursive.size() == wavefront.size();
+        for (std::size_t i = 0; sameImage && i < recursive.size(); ++i)
+            sameImage = std::abs(recursive[i] - wavefront[i]) <= 1e-5f * (1.0f + std::abs(recursive[i]));
+        check(sameImage, "the wavefront integrator renders the same image up to rounding");
+    }
+
+    ///----------------------------------------------
+
+    void testSceneCacheRoundTrip()
+    {
+        std::shared_ptr<Scene> scene = Scene::createDefaultScene();
+        check(scene->saveCache("roundTrip.cache"), "the scene cache is written");
+        render(*scene, createSettings("built.pfm"));
+
+        Scene cachedScene;
+        check(cachedScene.loadCache("roundTrip.cache"), "the scene cache is loaded");
+        render(cachedScene, createSettings("cached.pfm"));
+        check(sameFiles("built.pfm", "cached.pfm"), "a cached scene renders the same image");
+    }
+
+    ///----------------------------------------------
+
+    void testImageWriters()
+    {
+        // Values that the 16 bit halfs and the 8 bit values hold exactly
+        std::vector<glm::vec3> pixels(WIDTH * HEIGHT);
+        std::vector<const glm::vec3*> rows(HEIGHT);
+        for (int row = 0; row < HEIGHT; ++row)
+        {
+            rows[row] = &pixels[row * WIDTH];
+            for (int column = 0; column < WIDTH; ++column)
+                pixels[row * WIDTH + column] = glm::vec3(float(row) / 64.0f, float(column) / 64.0f, 0.5f);
+        }
+
+        ImageWriter::DisplaySettings displaySettings;
+        check(ImageWriter::writeImage("pixels.pfm", rows.data(), WIDTH, HEIGHT, displaySettings), "a PFM is written");
+        std::vector<float> values = readPFM("pixels.pfm");
+        bool sameValues = values.size() == pixels.size() * 3;
+        for (int row = 0; sameValues && row < HEIGHT; ++row)
+        {
+            const float* fileRow = values.data() + std::size_t(HEIGHT - 1 - row) * WIDTH * 3;
+            sameValues = std::equal(fileRow, fileRow + WIDTH * 3, &rows[row]->x);
+        }
+        check(sameValues, "a PFM reads back the values written to it");
+
+        // Streaming a few rows at a time gives the same file as writing it at once
+        for (const std::string& extension : std::vector<std::string>{".ppm", ".png", ".pfm", ".exr"})
+        {
+            ImageWriter::writeImage("whole" + extension, rows.data(), WIDTH, HEIGHT, displaySettings);
+            ImageWriter imageWriter;
+            bool streamed = imageWriter.open("streamed" + extension, WIDTH, HEIGHT, displaySettings);
+            for (int row = 0; row < HEIGHT; row += 5)
+                streamed = imageWriter.writeRows(rows.data() + row, std::min(5, HEIGHT - row)) && streamed;
+            streamed = imageWriter.close() && streamed;
+            check(streamed && sameFiles("whole" + extension, "streamed" + extension),
+                  "a streamed " + extension + " is the same as one written at once");
+        }
+
+        // The streaming render writes what the render in memory does
+        render(*Scene::createDefaultScene(), createSettings("inMemory.png"));
+        RenderSettings streamingSettings = createSettings("streamedRender.png");
+        streamingSettings.useStreamingOutput = true;
+        render(*Scene::createDefaultScene(), streamingSettings);
+        check(sameFiles("inMemory.png", "streamedRender.png"), "a streamed render is the same as one in memory");
+    }
+
+    ///----------------------------------------------
+
+    void testShardsMerge()
+    {
+        render(*Scene::createDefaultScene(), createSettings("unsharded.pfm"));
+
+        const int numShards = 3;
+        std::vector<std::string> partialResultPaths;
+        for (int shard = 0; shard < numShards; ++shard)
+        {
+            RenderSettings settings = createSettings("sharded.pfm");
+            settings.numShards = numShards;
+            settings.shardIndex = shard;
+            render(*Scene::createDefaultScene(), settings);
+            partialResultPaths.push_back(Camera::getPartialResultPath(settings.outputPath, shard, numShards));
+        }
+
+        std::shared_ptr<Camera> camera = createCamera();
+        bool merged = camera->mergePartialResults(partialResultPaths)
+                && camera->generateImage("sharded.pfm", ImageWriter::DisplaySettings());
+        check(merged && sameFiles("unsharded.pfm", "sharded.pfm"), "merged shards are the same as one render");
+    }
+
+    ///----------------------------------------------
+
+    void testCheckpointResume()
+    {
+        RenderSettings settings = createSettings("straight.pfm");
+        settings.useProgressiveRendering = true;
+        settings.maxPasses = 4;
+        render(*Scene::createDefaultScene(), settings);
+
+        // Stopped after two passes, then continued from the checkpoint of the second one
+        settings.outputPath = "resumed.pfm";
+        settings.maxPasses = 2;
+        settings.checkpointEveryXPasses = 2;
+        render(*Scene::createDefaultScene(), settings);
+        settings.maxPasses = 4;
+        settings.resumeFromCheckpoint = true;
+        render(*Scene::createDefaultScene(), settings);
+        check(sameFiles("straight.pfm", "resumed.pfm"), "a resumed render is the same as one run straight through");
+    }
+
+} // anonymous namespace
+
+int main()
+{
+    testTracingDoesNotAllocate();
+    testWavefrontMatchesRecursive();
+    testSceneCacheRoundTrip();
+    testImageWriters();
+    testShardsMerge();
+    testCheckpointResume();
+
+    if (numFailures > 0)
+    {
+        std::cout << numFailures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All checks passed" << std::endl;
+    return 0;
+}